@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+#include "stm32h7xx_hal.h"
+
+/*
+ * L1 caches and the MPU regions that decide what gets cached:
+ *
+ *   flash       0x08000000  2M    write-through
+ *   AXI SRAM    0x24000000  512K  write-back, write-allocate
+ *   D2 SRAM1/2  0x30000000  256K  DMA buffers, see CACHE_DMA_BUFFERS_CACHEABLE
+ *
+ * The TCMs are never cached, peripherals use the default memory map.
+ */
+
+/* Set to 0 to run uncached as before, e.g. to compare benchmark numbers */
+#ifndef CACHE_ENABLE
+#define CACHE_ENABLE 1
+#endif
+
+/*
+ * With 0, the D2 SRAM holding the DMA_BUFFER section is not cached, so DMA and
+ * CPU always agree on its contents. With 1 it is write-back cached, and every
+ * buffer has to go through cache_clean()/cache_invalidate() around DMA.
+ */
+#ifndef CACHE_DMA_BUFFERS_CACHEABLE
+#define CACHE_DMA_BUFFERS_CACHEABLE 0
+#endif
+
+/* Set up the MPU and enable the I- and D-cache, call first thing in main() */
+void cache_init(void);
+
+/*
+ * Write the cached contents of a buffer back to RAM before a DMA reads it.
+ * Works on whole 32 byte lines, so it may also clean neighbouring data.
+ */
+void cache_clean(const void *addr, uint32_t len);
+
+/*
+ * Drop cached contents of a buffer after a DMA has written it, so the CPU
+ * sees the new data. The buffer should be cache line aligned (DMA_BUFFER is),
+ * otherwise unrelated data sharing its first or last line is lost.
+ */
+void cache_invalidate(void *addr, uint32_t len);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32h7xx_hal.h"
+
+/*
+ * Clock tree shared by the projects, from the 8 MHz HSE bypass clock of the
+ * ST-LINK:
+ *
+ *   PLL1P  480 MHz  SYSCLK, core (400 MHz on revision Y silicon)
+ *                   HCLK = core / 2, all APB buses = HCLK / 2
+ *   PLL3Q   96 MHz  USART3 kernel clock
+ *   PLL3R   16 MHz  I2C2 kernel clock
+ *
+ * The kernel clocks stay the same when the core clock is scaled with
+ * clock_set_sysclk(), so the UART and I2C timings don't depend on it.
+ */
+#define CLOCK_HSE_HZ    8000000U
+#define CLOCK_PLL3Q_HZ 96000000U
+#define CLOCK_PLL3R_HZ 16000000U
+
+/* Most clock change listeners, see clock_add_listener() */
+#define CLOCK_MAX_LISTENERS 4
+
+/* When a clock change listener is called */
+typedef enum {
+	CLOCK_CHANGING, /* before the switch, still at the old clock */
+	CLOCK_CHANGED,  /* after it, at the new clock */
+} clock_event;
+
+/*
+ * Switch to VOS0 and run the core at its maximum frequency. Replaces the
+ * projects' SystemClock_Config(), call right after HAL_Init().
+ */
+void clock_init(void);
+
+/* Core frequency set up by clock_init(), 480 or 400 MHz */
+uint32_t clock_max_sysclk(void);
+
+/*
+ * Step the core clock down (e.g. while waiting for a sensor) and back up.
+ * hz must be clock_max_sysclk() divided by 1, 2, 4, 8 or 16, and hz / 2, the
+ * timebase's timer clock, a whole number of MHz (so 16 only at 480 MHz),
+ * otherwise false is returned and nothing changes. The listeners are called with
+ * CLOCK_CHANGING, then the flash wait states and programming delay, the
+ * timebase prescaler and SystemCoreClock follow, and the listeners are called
+ * again with CLOCK_CHANGED.
+ *
+ * Only to be called from the main loop. Peripherals running from the bus
+ * clocks instead of PLL3 should be idle.
+ */
+bool clock_set_sysclk(uint32_t hz);
+
+/*
+ * Register a function that is called around every clock_set_sysclk(), so
+ * drivers can let a transfer at the old bus clock finish and recompute timings
+ * derived from the bus clocks. Returns false if CLOCK_MAX_LISTENERS are
+ * already registered.
+ */
+bool clock_add_listener(void (*listener)(clock_event event));
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32h7xx_hal.h"
+#include "clock.h"
+
+/* USART3 is connected to the ST-LINK virtual COM port */
+extern UART_HandleTypeDef huart3;
+
+/* Baud rate the console starts with, the host can negotiate a faster one */
+#define CONSOLE_DEFAULT_BAUDRATE 115200
+
+/* Largest acceptable deviation from the requested baud rate, in ppm */
+#define CONSOLE_MAX_BAUD_ERROR 20000
+
+typedef struct {
+	uint32_t baudrate;
+	bool fifo;                   /* Use the 16 byte hardware FIFOs */
+	uint32_t tx_fifo_threshold;  /* UART_TXFIFO_THRESHOLD_x_y */
+	uint32_t rx_fifo_threshold;  /* UART_RXFIFO_THRESHOLD_x_y */
+} console_config;
+
+#define CONSOLE_DEFAULT_CONFIG {                 \
+	.baudrate = CONSOLE_DEFAULT_BAUDRATE,        \
+	.fifo = true,                                \
+	.tx_fifo_threshold = UART_TXFIFO_THRESHOLD_1_8, \
+	.rx_fifo_threshold = UART_RXFIFO_THRESHOLD_1_2, \
+}
+
+/* Set up the pins and USART3, config may be NULL for the defaults */
+void console_init(const console_config *config);
+
+/*
+ * Switch to another baud rate. Picks the kernel clock and oversampling mode
+ * with the smallest error and returns false (keeping the current setting) if
+ * the error would exceed CONSOLE_MAX_BAUD_ERROR. Transfers in progress are
+ * aborted, so the caller has to restart any reception.
+ */
+bool console_set_baudrate(uint32_t baudrate);
+
+uint32_t console_get_baudrate(void);
+
+/*
+ * Baud rate handshake. The host sends "--BAUD:<rate>--", the firmware answers
+ * "--BAUD_OK:<rate>--" (or "--BAUD_ERR:<rate>--") at the old rate and then
+ * switches.
+ *
+ * console_handshake_feed() scans all received bytes for requests, which may
+ * be split over several calls, and returns the rate of the last one completed
+ * in them, 0 if none. console_handshake_reply() sends the answer and switches
+ * if the rate is supported. Projects that read the console themselves, like
+ * UART_echo, call both. The others link console_listen.c and let it listen.
+ */
+uint32_t console_handshake_feed(const uint8_t *data, uint32_t len);
+bool console_handshake_reply(uint32_t baudrate);
+
+/*
+ * Receive in the background and feed the parser from the UART interrupt,
+ * call after print_init(). Defines HAL_UARTEx_RxEventCallback() and
+ * HAL_UART_ErrorCallback().
+ */
+void console_listen(void);
+
+/* True if a request is waiting for console_handshake_poll() */
+bool console_handshake_pending(void);
+
+/*
+ * Answer a request received since the last call, after flushing print(), and
+ * keep listening. Returns true if the baud rate was switched. Only to be
+ * called from the main loop.
+ */
+bool console_handshake_poll(void);
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32h7xx_hal.h"
+
+extern UART_HandleTypeDef huart3;
+
+/* Size of the transmit buffer in bytes, must be a power of 2 */
+#ifndef PRINT_BUFFER_SIZE
+#define PRINT_BUFFER_SIZE 2048
+#endif
+
+/* What print() does with output that does not fit into the buffer */
+#define PRINT_FULL_DROP  0  /* discard it and count the dropped bytes */
+#define PRINT_FULL_BLOCK 1  /* wait until the UART has made room */
+#ifndef PRINT_FULL_POLICY
+#define PRINT_FULL_POLICY PRINT_FULL_DROP
+#endif
+
+/*
+ * Drain the buffer with DMA instead of the UART interrupt. The DMA1 controller
+ * cannot reach the DTCM, so the buffer is then placed in D2 SRAM.
+ */
+#ifndef PRINT_USE_DMA
+#define PRINT_USE_DMA 1
+#endif
+
+/* How long print_flush() waits beyond the time a full buffer takes to send */
+#ifndef PRINT_FLUSH_SLACK_MS
+#define PRINT_FLUSH_SLACK_MS 50
+#endif
+
+/* Set up the USART3 transmit interrupt (and DMA), call after console_init() */
+void print_init(void);
+
+/*
+ * Format into the transmit buffer and return, the UART sends it out in the
+ * background. Supports %d, %u, %c, %s and %f (three decimals). With
+ * PRINT_FULL_DROP, the output of a call that doesn't fit is dropped as a
+ * whole, like print_write(), rather than losing bytes in the middle of a line.
+ *
+ * Only to be called from the main loop, not from interrupt handlers.
+ */
+void print(const char *format, ...);
+
+/*
+ * Queue raw bytes, e.g. a binary telemetry frame. The block is queued as a
+ * whole or, if it doesn't fit and PRINT_FULL_POLICY is PRINT_FULL_DROP, not at
+ * all, in which case false is returned.
+ */
+bool print_write(const void *data, uint32_t len);
+
+/*
+ * Wait until everything printed so far has been sent. Gives up and returns
+ * false if the UART stops making progress, e.g. when no transmit completes.
+ */
+bool print_flush(void);
+
+/* Number of bytes discarded because the buffer was full */
+uint32_t print_dropped(void);
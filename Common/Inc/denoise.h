@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Temporal noise filters for a stream of 64 pixel frames, such as the GridEYE's
+ * in quarter degrees, applied in place to each frame as it arrives:
+ *
+ *	static denoise filter;
+ *	denoise_init(&filter, DENOISE_BOXCAR, 3);   // mean of the last 8 frames
+ *	...
+ *	denoise_apply(&filter, frame);
+ *
+ * - DENOISE_EMA: exponential moving average, each frame weighs 1/2^shift. The
+ *   state keeps 4 fraction bits.
+ * - DENOISE_BOXCAR: mean of the last 2^shift frames, with running sums that
+ *   add the newest and subtract the oldest frame.
+ * - DENOISE_MEDIAN3: median of the last three frames, which drops single
+ *   frame outliers and passes steps one frame late.
+ *
+ * All of them work on two pixels per 32 bit word with the M7's packed 16 bit
+ * instructions (SHADD16, SADD16/SSUB16, SEL), with a plain C version of the
+ * same arithmetic elsewhere. Pixels must stay within 12 bits, -2048 to 2047,
+ * as the sensor delivers them. The first frame fills the history, so there is
+ * no ramp from zero.
+ */
+
+#define DENOISE_PIXELS 64
+
+/* Longest boxcar is 2^DENOISE_MAX_SHIFT frames, the sums stay within 16 bits */
+#define DENOISE_MAX_SHIFT 4
+#define DENOISE_MAX_HISTORY (1 << DENOISE_MAX_SHIFT)
+
+typedef enum {
+	DENOISE_OFF,
+	DENOISE_EMA,
+	DENOISE_BOXCAR,
+	DENOISE_MEDIAN3,
+} denoise_mode;
+
+typedef struct {
+	denoise_mode mode;
+	uint8_t shift;
+	uint8_t head;         /* oldest frame in history */
+	bool started;
+	/* EMA in 1/16 of the frame's unit, or the boxcar sums */
+	int16_t state[DENOISE_PIXELS] __attribute__((aligned(4)));
+	int16_t history[DENOISE_MAX_HISTORY][DENOISE_PIXELS] __attribute__((aligned(4)));
+} denoise;
+
+/*
+ * shift is 1 to DENOISE_MAX_SHIFT for EMA and boxcar and ignored otherwise.
+ * Returns false if it is out of range.
+ */
+bool denoise_init(denoise *d, denoise_mode mode, uint8_t shift);
+
+void denoise_apply(denoise *d, int16_t frame[DENOISE_PIXELS]);
+
+/* Name of a mode, for printing */
+const char *denoise_name(denoise_mode mode);
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32h7xx_hal.h"
+
+/*
+ * One record in a flash sector of its own, for data that has to survive a
+ * reset, such as calibration tables:
+ *
+ *	extern const uint8_t _calibration_start[];   // from the linker script
+ *	static const flash_store store = {
+ *		.address = (uintptr_t)_calibration_start,
+ *		.magic = CALIBRATION_MAGIC,
+ *		.version = CALIBRATION_VERSION,
+ *	};
+ *
+ *	if (!flash_store_read(&store, &table, sizeof(table)))
+ *		... use defaults ...
+ *	...
+ *	flash_store_write(&store, &table, sizeof(table));
+ *
+ * The record starts with a header of magic number, layout version, length and
+ * a CRC-32 of the data. A record is only read back if all of them match, so
+ * an erased sector, a record of another layout (bump the version when the
+ * data changes) or a damaged one reads as missing.
+ *
+ * Writing erases the whole sector and programs it one 32 byte flash word at a
+ * time, the header last, so a reset in the middle also leaves no record. The
+ * sector must not hold anything else, and the linker script has to keep code
+ * out of it. Both banks stall while the sector is erased, which takes a while,
+ * so only write outside of time critical phases.
+ */
+
+typedef struct {
+	uintptr_t address; /* start of the sector, FLASH_SECTOR_SIZE aligned */
+	uint32_t magic;
+	uint16_t version;
+} flash_store;
+
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t reserved;
+	uint32_t length;
+	uint32_t crc;      /* same as zlib's crc32() over the data */
+} flash_store_header;
+
+/* Largest record, the header takes the first flash word */
+#define FLASH_STORE_WORD 32
+#define FLASH_STORE_MAX_LENGTH (FLASH_SECTOR_SIZE - FLASH_STORE_WORD)
+
+/* Copy the record to data if it is valid and exactly length bytes long */
+bool flash_store_read(const flash_store *store, void *data, uint32_t length);
+
+/* The record in place in flash, or NULL, like flash_store_read() */
+const void *flash_store_data(const flash_store *store, uint32_t length);
+
+/* Erase the sector and write a new record. False on a flash error. */
+bool flash_store_write(const flash_store *store, const void *data, uint32_t length);
+
+/* Erase the sector, so there is no record */
+bool flash_store_erase(const flash_store *store);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32h7xx_hal.h"
+
+/*
+ * A fixed set of frame buffers shared by one producer, typically an I2C or DMA
+ * completion interrupt, and any number of consumers in the main loop:
+ *
+ *	frame *f = frame_store_acquire(&store);   // producer
+ *	... fill f->data, set f->timestamp ...
+ *	frame_store_publish(&store, f);
+ *
+ *	const frame *f = frame_store_borrow(&store, last_seq);   // consumer
+ *	if (f) {
+ *		last_seq = f->seq;
+ *		... read f->data ...
+ *		frame_store_release(&store, f);
+ *	}
+ *
+ * Consumers always get the latest published frame and read it in place. A
+ * borrowed frame is never refilled, so the producer keeps going while a slow
+ * consumer holds on to an older frame. With three frames, one can be filled,
+ * one published and one borrowed at the same time.
+ *
+ * Published frames that are replaced before anyone borrowed them count as
+ * dropped. If no frame is free for the producer, that counts as an overrun.
+ */
+
+#ifndef FRAME_STORE_MAX_FRAMES
+#define FRAME_STORE_MAX_FRAMES 4
+#endif
+
+typedef struct {
+	uint32_t seq;       /* 1 for the first published frame, then counting up */
+	uint32_t timestamp; /* set by the producer, e.g. timebase_us() of the read */
+	void *data;
+} frame;
+
+typedef struct {
+	uint32_t published;
+	uint32_t dropped;
+	uint32_t overruns;
+} frame_store_stats;
+
+typedef struct {
+	frame frames[FRAME_STORE_MAX_FRAMES];
+	uint8_t borrows[FRAME_STORE_MAX_FRAMES];
+	bool seen[FRAME_STORE_MAX_FRAMES]; /* borrowed since it was published */
+	uint32_t count;
+	int8_t latest;                     /* -1 until the first publish */
+	int8_t filling;                    /* -1 if the producer holds none */
+	uint32_t seq;
+	frame_store_stats stats;
+} frame_store;
+
+/*
+ * Split storage (count * frame_size bytes, e.g. an AXI_BSS array) into count
+ * frames. Returns false if count is not 2 to FRAME_STORE_MAX_FRAMES.
+ */
+bool frame_store_init(frame_store *store, void *storage, uint32_t frame_size, uint32_t count);
+
+/*
+ * Producer side. Only one frame can be acquired at a time, NULL means that one
+ * still is or all others are borrowed. A frame that could not be filled is
+ * handed back with frame_store_abandon().
+ */
+frame *frame_store_acquire(frame_store *store);
+void frame_store_publish(frame_store *store, frame *f);
+void frame_store_abandon(frame_store *store, frame *f);
+
+/*
+ * Consumer side. Borrow the latest frame if its seq is newer than last_seq
+ * (0 for any), NULL otherwise. Every borrowed frame must be released.
+ */
+const frame *frame_store_borrow(frame_store *store, uint32_t last_seq);
+void frame_store_release(frame_store *store, const frame *f);
+
+/* seq of the latest published frame, 0 if there is none yet */
+uint32_t frame_store_latest_seq(const frame_store *store);
+
+void frame_store_get_stats(const frame_store *store, frame_store_stats *stats);
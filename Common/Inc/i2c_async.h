@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32h7xx_hal.h"
+
+/* Number of transactions that can be waiting for the bus, must be a power of 2 */
+#define I2C_ASYNC_QUEUE_LENGTH 8
+
+/*
+ * Use DMA instead of per-byte interrupts for the data phase. The DMA1
+ * controller cannot reach the DTCM where callers usually keep their buffers,
+ * so the data goes through bounce buffers in D2 SRAM of this many bytes;
+ * longer transactions fail with I2C_ASYNC_ERROR_START.
+ */
+#ifndef I2C_ASYNC_USE_DMA
+#define I2C_ASYNC_USE_DMA 1
+#endif
+#ifndef I2C_ASYNC_DMA_BUFFER_SIZE
+#define I2C_ASYNC_DMA_BUFFER_SIZE 256
+#endif
+
+/* The HAL refused to start the transfer (e.g. invalid length or bus busy) */
+#define I2C_ASYNC_ERROR_START 0x80000000U
+
+typedef struct i2c_transaction i2c_transaction;
+
+/* Called from interrupt context once a transaction has finished */
+typedef void (*i2c_callback)(i2c_transaction *t);
+
+/*
+ * A single bus transaction: tx_len bytes are written to the device, then
+ * rx_len bytes are read back. If both phases are present, the write is at most
+ * two bytes long (a register address) and is followed by a repeated start.
+ *
+ * The descriptor and its buffers are owned by the caller and must stay valid
+ * until done is set.
+ */
+struct i2c_transaction {
+	uint8_t addr;             /* 7-bit device address, unshifted */
+	const uint8_t *tx;
+	uint16_t tx_len;
+	uint8_t *rx;
+	uint16_t rx_len;
+	i2c_callback callback;    /* optional */
+	void *context;            /* free for use by the callback */
+
+	volatile bool done;
+	volatile uint32_t error;  /* HAL_I2C_ERROR_* */
+};
+
+void i2c_async_init(I2C_HandleTypeDef *hi2c);
+
+/* Queue a transaction, returns false if the queue is full */
+bool i2c_async_submit(i2c_transaction *t);
+
+/* True while a transaction is on the bus or waiting for it */
+bool i2c_async_busy(void);
+
+/* Block until t has completed. Must not be called from interrupt context. */
+void i2c_async_wait(i2c_transaction *t);
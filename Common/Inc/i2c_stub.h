@@ -4,6 +4,11 @@
 #include <stdbool.h>
 #include "stm32h7xx_hal.h"
 
+/* SCL frequency, the Timing register value is computed from it and the kernel clock */
+#ifndef I2C_SPEED_HZ
+#define I2C_SPEED_HZ 100000
+#endif
+
 void I2C_MspInit();
 
 void i2c_begin();
@@ -11,10 +16,16 @@ void i2c_begin();
 /* TODO: sendStop */
 uint8_t i2c_endTransmission(bool sendStop);
 
+/*
+ * Synchronous accessors, built on the queue in i2c_async.h. They block until
+ * the transfer is done and must not be called from interrupt context.
+ */
 uint8_t i2c_read(uint8_t addr);
 uint16_t i2c_read2(uint8_t addr);
 
 uint32_t i2c_write(uint8_t addr, uint8_t data);
 uint32_t i2c_write2(uint8_t addr, uint8_t data1, uint8_t data2);
 
+uint32_t i2c_memRead(uint8_t addr, uint8_t reg, uint8_t *data, uint16_t len);
+
 bool i2c_deviceReady(uint8_t addr);
@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdint.h>
+#include "stm32h7xx_hal.h"
+
+/*
+ * Short critical sections against the interrupt handlers. irq_save() disables
+ * interrupts and returns the previous PRIMASK, irq_restore() puts it back, so
+ * the pair nests and may be used with interrupts already off.
+ */
+static inline uint32_t irq_save(void)
+{
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	return primask;
+}
+
+static inline void irq_restore(uint32_t primask)
+{
+	__set_PRIMASK(primask);
+}
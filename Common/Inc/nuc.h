@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Per-pixel non-uniformity correction of thermal frames, e.g. the 8x8 GridEYE
+ * pixels in quarter degrees:
+ *
+ *	static nuc_capture cold;
+ *	nuc_capture_begin(&cold);
+ *	... nuc_capture_add(&cold, frame) for NUC_CAPTURE_FRAMES frames of a
+ *	    uniform target ...
+ *	nuc_compute(&table, 8, 8, &cold, NULL);       // offsets only
+ *	nuc_init(&correction, &table);
+ *	...
+ *	nuc_apply(&correction, frame);                 // in place, every frame
+ *
+ * Looking at a uniform target, every pixel should read the same. A capture
+ * averages a number of frames of one, and nuc_compute() derives per-pixel
+ * offsets that move each pixel onto the average of all pixels. With a second
+ * capture of a warmer target, gains are derived too (a two-point
+ * calibration), so each pixel also gets the same slope.
+ *
+ * Pixels that are far off the median, noisy or with an implausible gain are
+ * marked dead. nuc_apply() replaces them by the mean of their good
+ * 8-neighbours after correcting the others.
+ *
+ * nuc_table is plain data meant to be kept in flash, see flash_store.h.
+ * nuc_init() turns it into the fused form nuc_apply() uses: one multiply and
+ * add per pixel, two pixels per instruction where the M7's DSP instructions
+ * allow it, or a saturating add of the offsets when all gains are 1.
+ */
+
+#ifndef NUC_MAX_PIXELS
+#define NUC_MAX_PIXELS 64
+#endif
+
+/* Frames averaged per capture */
+#ifndef NUC_CAPTURE_FRAMES
+#define NUC_CAPTURE_FRAMES 32
+#endif
+
+/* Limits for dead pixels, in the unit of the frames (default quarter degrees) */
+#ifndef NUC_DEAD_DEVIATION
+#define NUC_DEAD_DEVIATION 32 /* from the median of the capture */
+#endif
+#ifndef NUC_DEAD_NOISE
+#define NUC_DEAD_NOISE 4      /* standard deviation over the capture */
+#endif
+/* Gains outside of 1/2 to 2 mark a pixel dead as well */
+
+/* Stored layout, bump NUC_VERSION when nuc_table changes */
+#define NUC_MAGIC   0x3143554E /* "NUC1" */
+#define NUC_VERSION 1
+
+#define NUC_GAIN_ONE 16384     /* Q14 */
+
+typedef struct {
+	uint16_t width;
+	uint16_t height;
+	uint16_t dead_count;
+	uint16_t reserved;
+	int16_t offset[NUC_MAX_PIXELS]; /* added after the gain, in the unit of the frames */
+	int16_t gain[NUC_MAX_PIXELS];   /* Q14 */
+	uint8_t dead[NUC_MAX_PIXELS];   /* 1 for dead pixels */
+} nuc_table;
+
+/* Sum of frames of a uniform target */
+typedef struct {
+	int32_t sum[NUC_MAX_PIXELS];
+	uint32_t square_sum[NUC_MAX_PIXELS]; /* of the differences to the first frame */
+	int16_t first[NUC_MAX_PIXELS];
+	uint16_t frames;
+} nuc_capture;
+
+/* A dead pixel and the good neighbours it is replaced with */
+typedef struct {
+	uint8_t pixel;
+	uint8_t count;
+	uint8_t neighbours[8];
+} nuc_repair;
+
+#ifndef NUC_MAX_DEAD
+#define NUC_MAX_DEAD 8
+#endif
+
+typedef struct {
+	uint16_t pixels;
+	bool unity_gain;
+	int16_t offset[NUC_MAX_PIXELS] __attribute__((aligned(4)));
+	int16_t gain[NUC_MAX_PIXELS] __attribute__((aligned(4)));
+	int32_t bias[NUC_MAX_PIXELS]; /* offset in Q14 plus rounding */
+	nuc_repair repairs[NUC_MAX_DEAD];
+	uint8_t repair_count;
+} nuc;
+
+/* A table that leaves frames as they are */
+void nuc_table_identity(nuc_table *table, uint16_t width, uint16_t height);
+
+void nuc_capture_begin(nuc_capture *capture);
+/* width * height pixels, as given to nuc_compute() later */
+void nuc_capture_add(nuc_capture *capture, const int16_t *frame, uint16_t pixels);
+
+/*
+ * Offsets from one capture, or offsets and gains from a capture of a cold and
+ * of a warm uniform target. Returns false for a frame larger than
+ * NUC_MAX_PIXELS, empty captures or targets less than 1 unit apart.
+ */
+bool nuc_compute(nuc_table *table, uint16_t width, uint16_t height,
+		const nuc_capture *cold, const nuc_capture *warm);
+
+/*
+ * Set up the correction for a table. Only the first NUC_MAX_DEAD dead pixels
+ * are replaced, returns false if there were more.
+ */
+bool nuc_init(nuc *n, const nuc_table *table);
+
+/* Correct a frame in place */
+void nuc_apply(const nuc *n, int16_t *frame);
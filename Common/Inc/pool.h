@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32h7xx_hal.h"
+
+/*
+ * Fixed-size block pools, for buffers that are needed for a while but not
+ * forever (frame histories, telemetry messages, I/O buffers) without a heap.
+ * Each pool is a static array of equal blocks in the memory region given to
+ * POOL_DEFINE(), so it cannot fragment:
+ *
+ *	POOL_DEFINE(frame_pool, 128, 8, AXI_BSS);   // 8 blocks of 128 bytes
+ *
+ *	pool_init(&frame_pool, "frames");
+ *	int16_t *f = pool_alloc(&frame_pool);        // NULL if none is free
+ *	...
+ *	pool_free(&frame_pool, f);
+ *
+ * The free blocks form a linked list. pool_alloc() and pool_free() pop and push
+ * its head with LDREX/STREX, so they take constant time, never disable
+ * interrupts and may be called from interrupt handlers. An interrupt between
+ * the LDREX and the STREX clears the exclusive monitor and the main loop side
+ * simply retries, which also rules out the ABA problem on the single core.
+ *
+ * Initialized pools are also size classes: pool_get(size) takes a block from
+ * the smallest class that fits and has one free, pool_put() gives it back to
+ * the class it came from.
+ */
+
+/* Number of size classes pool_init() can register */
+#ifndef POOL_MAX_CLASSES
+#define POOL_MAX_CLASSES 8
+#endif
+
+/* Blocks are rounded up to this many bytes, the 32 byte cache line */
+#define POOL_ALIGN 32
+#define POOL_BLOCK_SIZE(size) (((size) + POOL_ALIGN - 1) & ~(POOL_ALIGN - 1))
+
+typedef struct pool_block {
+	struct pool_block *next;
+} pool_block;
+
+typedef struct {
+	uint32_t used;
+	uint32_t peak;     /* high watermark of used */
+	uint32_t failures; /* allocations that found no free block */
+} pool_stats;
+
+typedef struct {
+	const char *name;
+	uint8_t *storage;
+	uint32_t block_size;
+	uint32_t count;
+	pool_block *volatile free;
+	volatile pool_stats stats;
+} pool;
+
+/*
+ * Static pool of count blocks of at least size bytes. placement is one of the
+ * sections.h macros (AXI_BSS, DMA_BUFFER) or empty for the DTCM. Blocks for DMA
+ * start and end on cache lines, see cache.h.
+ */
+#define POOL_DEFINE(name, size, blocks, placement)                              \
+	static uint8_t name##_storage[(blocks) * POOL_BLOCK_SIZE(size)]            \
+		placement __attribute__((aligned(POOL_ALIGN)));                        \
+	pool name = {                                                              \
+		.storage = name##_storage,                                             \
+		.block_size = POOL_BLOCK_SIZE(size),                                   \
+		.count = (blocks),                                                     \
+	}
+
+/*
+ * Chain all blocks into the free list and register the pool as a size class
+ * for pool_get(). Returns false if all POOL_MAX_CLASSES are taken, the pool
+ * itself can still be used with pool_alloc().
+ */
+bool pool_init(pool *p, const char *name);
+
+/* A free block of the pool, or NULL (counted as a failure) */
+void *pool_alloc(pool *p);
+
+/* Hand back a block of the pool */
+void pool_free(pool *p, void *block);
+
+/* A block of at least size bytes from the registered classes, or NULL */
+void *pool_get(uint32_t size);
+
+/* Hand back a block from pool_get() (or pool_alloc() of a registered pool) */
+void pool_put(void *block);
+
+/* The registered pool the block belongs to, NULL if none */
+pool *pool_of(const void *block);
+
+/* Copy of the pool's statistics */
+void pool_get_stats(const pool *p, pool_stats *stats);
+
+/* Write block size, usage, high watermark and failures of all classes */
+void pool_dump(void);
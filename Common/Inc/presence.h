@@ -0,0 +1,159 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Presence detection on thermal frames, e.g. the 8x8 GridEYE pixels or a frame
+ * upscaled with upscale.h:
+ *
+ *	static presence pr;
+ *	presence_config config;
+ *	presence_default_config(&config, 8, 8);
+ *	presence_init(&pr, &config);
+ *	...
+ *	presence_update(&pr, frame, timestamp);   // once per frame
+ *
+ * Each pixel has an adaptive background, a running mean and variance updated
+ * with a learning rate of 1 / 2^learn_shift. A pixel is foreground when it is
+ * warmer than its mean by more than threshold_sigma standard deviations and at
+ * least min_delta. Foreground pixels keep learning, but only at
+ * 1 / 2^foreground_shift, so someone standing still fades out slowly.
+ *
+ * Foreground pixels are grouped into 8-connected blobs, whose centroid is
+ * weighted by how much warmer than the background each pixel is. Blobs are
+ * matched to tracks, nearest to the track's predicted position first, which
+ * gives each person an ID, a position and a velocity in pixels per second. A
+ * track that crosses the counting line counts as an entry or an exit.
+ *
+ * Everything lives in the presence struct, sized by PRESENCE_MAX_PIXELS,
+ * PRESENCE_MAX_BLOBS and PRESENCE_MAX_TRACKS. A frame takes time linear in its
+ * pixels plus blobs * tracks for the matching.
+ */
+
+/* Largest frame, 32x32 so upscaled GridEYE frames fit */
+#ifndef PRESENCE_MAX_PIXELS
+#define PRESENCE_MAX_PIXELS (32 * 32)
+#endif
+
+#ifndef PRESENCE_MAX_BLOBS
+#define PRESENCE_MAX_BLOBS 8
+#endif
+
+#ifndef PRESENCE_MAX_TRACKS
+#define PRESENCE_MAX_TRACKS 8
+#endif
+
+#define PRESENCE_IGNORED 0xFF
+
+typedef struct {
+	uint16_t width;
+	uint16_t height;
+
+	/* Background model, temperatures are in the unit of the frames */
+	uint8_t learn_shift;       /* learning rate 1 / 2^n of background pixels */
+	uint8_t foreground_shift;  /* same for foreground pixels, 0 for never */
+	uint16_t warmup_frames;    /* frames learnt before anything is foreground */
+	float threshold_sigma;
+	int16_t min_delta;
+
+	/* Blobs and tracks, in pixels of the frame */
+	uint16_t min_area;         /* smaller blobs are ignored */
+	float max_distance;        /* farthest a blob may be from its track's prediction */
+	float velocity_alpha;      /* 0 to 1, weight of the newest velocity */
+	uint8_t max_missed;        /* frames a track survives without a blob */
+	uint8_t min_age;           /* frames a track must be seen before it counts */
+
+	/*
+	 * Counting line through (x0, y0) and (x1, y1). A point is on side 1 if
+	 * (x1 - x0) * (y - y0) - (y1 - y0) * (x - x0) > 0, on side -1 otherwise.
+	 * Going from side -1 to side 1 is an entry, the other way an exit. For a
+	 * line from the top to the bottom of the frame, side 1 is the left. A
+	 * track must get further than line_margin from the line to change sides.
+	 */
+	float line_x0, line_y0, line_x1, line_y1;
+	float line_margin;
+} presence_config;
+
+typedef struct {
+	float x;            /* centroid */
+	float y;
+	uint16_t area;      /* pixels */
+	int16_t peak;       /* largest difference to the background */
+	int32_t heat;       /* sum of the differences to the background */
+} presence_blob;
+
+typedef struct {
+	uint16_t id;        /* never 0, counts up */
+	float x;
+	float y;
+	float vx;           /* pixels per second */
+	float vy;
+	uint16_t age;       /* frames it was seen in */
+	uint8_t missed;     /* frames since it was last seen */
+	int8_t side;        /* of the counting line, 0 while within line_margin since it started */
+	int8_t blob;        /* index into blobs this frame, -1 if none */
+} presence_track;
+
+typedef struct {
+	uint32_t frames;
+	uint32_t entries;
+	uint32_t exits;
+	uint32_t tracks;          /* started so far */
+	uint32_t dropped_blobs;   /* over PRESENCE_MAX_BLOBS */
+	uint32_t dropped_tracks;  /* blobs without a free track */
+} presence_stats;
+
+typedef struct {
+	presence_config config;
+
+	/* Mean in 1/256 of the frame's unit, variance in 1/16 of its square */
+	int32_t mean[PRESENCE_MAX_PIXELS];
+	int32_t var[PRESENCE_MAX_PIXELS];
+	/* Difference to the background of foreground pixels, 0 elsewhere */
+	int16_t foreground[PRESENCE_MAX_PIXELS];
+	/*
+	 * Blob of each pixel as its index + 1, 0 for background, and
+	 * PRESENCE_IGNORED for blobs that were too small or did not fit. The
+	 * queue holds the pixels of the blob being labelled.
+	 */
+	uint8_t labels[PRESENCE_MAX_PIXELS];
+	uint16_t queue[PRESENCE_MAX_PIXELS];
+
+	presence_blob blobs[PRESENCE_MAX_BLOBS];
+	uint8_t blob_count;
+	presence_track tracks[PRESENCE_MAX_TRACKS];
+	uint8_t track_count;
+
+	uint32_t learnt;      /* frames in the background model */
+	uint16_t next_id;
+	uint32_t timestamp;   /* of the last frame, us */
+	uint64_t k2;          /* threshold_sigma^2 in Q8 */
+	float line_nx;        /* unit normal of the counting line */
+	float line_ny;
+	presence_stats stats;
+} presence;
+
+/*
+ * Defaults for a width x height frame: a vertical counting line through the
+ * middle, thresholds for quarter degrees (1.5 C at least), and distances
+ * scaled from what suits 8x8 pixels at 10 frames per second.
+ */
+void presence_default_config(presence_config *config, uint16_t width, uint16_t height);
+
+/* False if the frame is larger than PRESENCE_MAX_PIXELS */
+bool presence_init(presence *p, const presence_config *config);
+
+/*
+ * Feed the next frame, width * height pixels row by row, taken at timestamp
+ * (us, e.g. timebase_us()). Returns the number of tracks.
+ */
+uint8_t presence_update(presence *p, const int16_t *frame, uint32_t timestamp);
+
+/* Forget the background and all tracks, keeping the counts */
+void presence_reset(presence *p);
+
+void presence_get_stats(const presence *p, presence_stats *stats);
+
+/* print() the counts and the current tracks */
+void presence_dump(const presence *p);
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdint.h>
+#include "stm32h7xx_hal.h"
+
+/*
+ * Cycle-accurate profiling with the DWT cycle counter.
+ *
+ * A probe measures the cycles between PROFILE_BEGIN() and PROFILE_END() in the
+ * same function and keeps count, min, max, mean and a histogram of them:
+ *
+ *	PROFILE_BEGIN(read, "sensor read");
+ *	...
+ *	PROFILE_END(read);
+ *
+ * Each probe registers its name in a free slot the first time it runs. Probes
+ * may be used in interrupt handlers. Build with PROFILE_ENABLE set to 0 to
+ * compile them out.
+ *
+ * The cycle counts depend on the core clock, which clock_set_sysclk() changes.
+ * Each duration is also converted to time at the clock it was recorded at, for
+ * the mean in us of profile_dump(). A probe should not span a clock change.
+ */
+#ifndef PROFILE_ENABLE
+#define PROFILE_ENABLE 1
+#endif
+
+/* Number of probe slots */
+#ifndef PROFILE_MAX_PROBES
+#define PROFILE_MAX_PROBES 16
+#endif
+
+/* Histogram bin n counts the durations from 2^n to 2^(n+1) - 1 cycles */
+#define PROFILE_HIST_BINS 32
+
+/* Where profile_dump() writes to */
+#define PROFILE_OUTPUT_CONSOLE 0  /* print() */
+#define PROFILE_OUTPUT_ITM     1  /* ITM stimulus port 0, i.e. SWO */
+#ifndef PROFILE_OUTPUT
+#define PROFILE_OUTPUT PROFILE_OUTPUT_CONSOLE
+#endif
+
+/*
+ * Set to 1 (make BENCHMARK=1) to have the project run its fixed benchmark loop
+ * with profile_benchmark() at startup, see ../release.mk
+ */
+#ifndef BENCHMARK
+#define BENCHMARK 0
+#endif
+
+#ifndef BENCHMARK_ITERATIONS
+#define BENCHMARK_ITERATIONS 1000
+#endif
+
+#define PROFILE_NO_SLOT      (-1)  /* All slots taken, the probe is ignored */
+#define PROFILE_UNREGISTERED (-2)
+
+#if PROFILE_ENABLE
+#define PROFILE_BEGIN(probe, name)                                  \
+	static int8_t probe##_slot = PROFILE_UNREGISTERED;              \
+	if (probe##_slot == PROFILE_UNREGISTERED)                       \
+		probe##_slot = profile_register(name);                      \
+	uint32_t probe##_start = profile_cycles()
+#define PROFILE_END(probe) \
+	profile_record(probe##_slot, profile_cycles() - probe##_start)
+#else
+#define PROFILE_BEGIN(probe, name) do {} while (0)
+#define PROFILE_END(probe)         do {} while (0)
+#endif
+
+/* Start the cycle counter, call once at startup */
+void profile_init(void);
+
+static inline uint32_t profile_cycles(void)
+{
+	return DWT->CYCCNT;
+}
+
+/* Rounded, at the current core clock */
+uint32_t profile_cycles_to_us(uint32_t cycles);
+
+/* Slot for the named probe, or PROFILE_NO_SLOT if all are taken */
+int8_t profile_register(const char *name);
+
+void profile_record(int8_t slot, uint32_t cycles);
+
+/* Clear the statistics of all probes, their slots stay registered */
+void profile_reset(void);
+
+/* Write the statistics of all probes, from the main loop only */
+void profile_dump(void);
+
+/*
+ * Run fn once to warm up the caches, then iterations times, and write a
+ * "bench <name> <mean> cycles (min <min>)" line. util/build_report.py collects
+ * these lines up to the "bench done" written by profile_benchmark_done().
+ */
+void profile_benchmark(const char *name, void (*fn)(void), uint32_t iterations);
+
+/* Same for a fn that does ops operations per call, with the cycles per operation */
+void profile_benchmark_ops(const char *name, void (*fn)(void), uint32_t iterations, uint32_t ops);
+void profile_benchmark_done(void);
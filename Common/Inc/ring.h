@@ -0,0 +1,201 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include "stm32h7xx_hal.h"
+
+/*
+ * Single-producer, single-consumer ring buffer of fixed-size records, for
+ * handing data between an interrupt handler (or DMA) and the main loop
+ * without disabling interrupts. Byte streams are rings of 1 byte records.
+ *
+ * The producer only writes tail and the consumer only writes head. Both run
+ * freely and are masked with the power of 2 capacity on access, so the ring
+ * holds capacity records, not one less. A DMB orders the record accesses
+ * against the index updates, for DMA masters and the M7's write buffer.
+ *
+ * Besides copying with ring_push()/ring_write(), the producer can fill the
+ * buffer in place:
+ *
+ *	uint32_t len;
+ *	uint8_t *dst = ring_reserve(&r, &len);  // contiguous free records
+ *	... DMA or memcpy up to len records into dst ...
+ *	ring_commit(&r, n);
+ *
+ * and the consumer can likewise use ring_peek() and ring_release().
+ */
+typedef struct {
+	uint8_t *buffer;
+	uint32_t mask;          /* capacity - 1 */
+	uint32_t record_size;   /* bytes */
+	volatile uint32_t head; /* records taken out so far, written by the consumer */
+	volatile uint32_t tail; /* records put in so far, written by the producer */
+} ring;
+
+/* Static initializer, capacity is in records and must be a power of 2 */
+#define RING_INIT(storage, capacity, size) { \
+	.buffer = (uint8_t *)(storage),          \
+	.mask = (capacity) - 1,                  \
+	.record_size = (size),                   \
+}
+
+static inline void ring_init(ring *r, void *storage, uint32_t capacity, uint32_t record_size)
+{
+	r->buffer = storage;
+	r->mask = capacity - 1;
+	r->record_size = record_size;
+	r->head = 0;
+	r->tail = 0;
+}
+
+static inline uint32_t ring_capacity(const ring *r)
+{
+	return r->mask + 1;
+}
+
+static inline uint8_t *ring_slot(const ring *r, uint32_t index)
+{
+	return r->buffer + (index & r->mask) * r->record_size;
+}
+
+/*
+ * Consumer side. ring_count() may exceed the capacity if a producer that
+ * cannot wait (see ring_commit()) has lapped the consumer.
+ */
+static inline uint32_t ring_count(const ring *r)
+{
+	uint32_t tail = r->tail;
+	__DMB(); /* Acquire, the records up to tail are written */
+	return tail - r->head;
+}
+
+static inline bool ring_empty(const ring *r)
+{
+	return ring_count(r) == 0;
+}
+
+/* Contiguous filled records from head, their number in *len (0 if empty) */
+static inline void *ring_peek(const ring *r, uint32_t *len)
+{
+	uint32_t head = r->head;
+	uint32_t count = ring_count(r);
+	uint32_t contiguous = ring_capacity(r) - (head & r->mask);
+	*len = count < contiguous ? count : contiguous;
+	return ring_slot(r, head);
+}
+
+/* Hand n consumed records back to the producer */
+static inline void ring_release(ring *r, uint32_t n)
+{
+	__DMB(); /* Release, done reading the records before they are reused */
+	r->head += n;
+}
+
+static inline bool ring_pop(ring *r, void *record)
+{
+	if (ring_count(r) == 0)
+		return false;
+	memcpy(record, ring_slot(r, r->head), r->record_size);
+	ring_release(r, 1);
+	return true;
+}
+
+/* Take out up to n records, returns how many */
+static inline uint32_t ring_read(ring *r, void *data, uint32_t n)
+{
+	uint8_t *out = data;
+	uint32_t done = 0;
+	while (done < n)
+	{
+		uint32_t len;
+		const uint8_t *src = ring_peek(r, &len);
+		if (len == 0)
+			break;
+		if (len > n - done)
+			len = n - done;
+		memcpy(out, src, len * r->record_size);
+		out += len * r->record_size;
+		done += len;
+		ring_release(r, len);
+	}
+	return done;
+}
+
+static inline bool ring_get_byte(ring *r, uint8_t *byte)
+{
+	if (ring_count(r) == 0)
+		return false;
+	*byte = r->buffer[r->head & r->mask];
+	ring_release(r, 1);
+	return true;
+}
+
+/* Producer side */
+static inline uint32_t ring_space(const ring *r)
+{
+	uint32_t head = r->head;
+	__DMB(); /* Acquire, the consumer is done with the records before head */
+	return ring_capacity(r) - (r->tail - head);
+}
+
+static inline bool ring_full(const ring *r)
+{
+	return ring_space(r) == 0;
+}
+
+/* Contiguous free records from tail, their number in *len (0 if full) */
+static inline void *ring_reserve(ring *r, uint32_t *len)
+{
+	uint32_t tail = r->tail;
+	uint32_t space = ring_space(r);
+	uint32_t contiguous = ring_capacity(r) - (tail & r->mask);
+	*len = space < contiguous ? space : contiguous;
+	return ring_slot(r, tail);
+}
+
+/*
+ * Publish n records written after tail. Normally n is at most what
+ * ring_reserve() returned. A producer that cannot wait, such as a circular
+ * DMA, may commit more and overwrite unread records.
+ */
+static inline void ring_commit(ring *r, uint32_t n)
+{
+	__DMB(); /* Release, the records are written before tail moves */
+	r->tail += n;
+}
+
+static inline bool ring_push(ring *r, const void *record)
+{
+	if (ring_space(r) == 0)
+		return false;
+	memcpy(ring_slot(r, r->tail), record, r->record_size);
+	ring_commit(r, 1);
+	return true;
+}
+
+/* Put in all n records, or none if they don't fit */
+static inline bool ring_write(ring *r, const void *data, uint32_t n)
+{
+	if (ring_space(r) < n)
+		return false;
+
+	const uint8_t *in = data;
+	uint32_t tail = r->tail;
+	uint32_t first = ring_capacity(r) - (tail & r->mask);
+	if (first > n)
+		first = n;
+	memcpy(ring_slot(r, tail), in, first * r->record_size);
+	memcpy(r->buffer, in + first * r->record_size, (n - first) * r->record_size);
+	ring_commit(r, n);
+	return true;
+}
+
+static inline bool ring_put_byte(ring *r, uint8_t byte)
+{
+	if (ring_space(r) == 0)
+		return false;
+	r->buffer[r->tail & r->mask] = byte;
+	ring_commit(r, 1);
+	return true;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "timebase.h"
+
+/*
+ * Periodic sampling on the timebase. Each sensor registers a job with a period
+ * and a read function:
+ *
+ *	int8_t job = scheduler_add("grideye", 100000, read_frame, NULL);
+ *	scheduler_start(0);
+ *	while (1) {
+ *		scheduler_wait();
+ *		scheduler_run();
+ *	}
+ *
+ * A TIM2 software timer marks the job due at fixed instants, start + n * period,
+ * and scheduler_run() calls the read function from the main loop, since sensor
+ * reads block on the bus. The delay from the instant to the call is recorded
+ * as the job's jitter.
+ *
+ * If a job is still due or running when its next instant comes, that sample
+ * is skipped and counted as an overrun. The following instants stay on the
+ * grid, the period never stretches.
+ */
+
+/* Number of job slots */
+#ifndef SCHEDULER_MAX_JOBS
+#define SCHEDULER_MAX_JOBS 4
+#endif
+
+#define SCHEDULER_NO_JOB (-1)
+
+/* Passed to the read function, all times are timebase_us() values */
+typedef struct {
+	uint32_t index; /* instant on the job's grid, counting skipped ones too */
+	uint32_t due;   /* the instant itself */
+	uint32_t start; /* when the read function was called */
+} scheduler_sample;
+
+typedef void (*scheduler_read)(const scheduler_sample *sample, void *context);
+
+typedef struct {
+	uint32_t samples;
+	uint32_t overruns;
+	uint32_t jitter_min;   /* us */
+	uint32_t jitter_max;   /* us */
+	uint64_t jitter_total; /* us, over all samples */
+} scheduler_stats;
+
+/*
+ * Register a job with a period of 1 us to 2^31 us. Returns its slot, or
+ * SCHEDULER_NO_JOB if the period is out of range or all slots are taken.
+ * Jobs added after scheduler_start() wait for the next start.
+ */
+int8_t scheduler_add(const char *name, uint32_t period_us, scheduler_read read, void *context);
+
+/* Start all jobs with their instant 0 in delay_us, so they share one grid */
+void scheduler_start(uint32_t delay_us);
+
+/* Stop all jobs, samples that are already due are dropped */
+void scheduler_stop(void);
+
+/*
+ * Call the read functions of the due jobs, earliest instant first. Returns
+ * false if none was due. Only to be called from the main loop.
+ */
+bool scheduler_run(void);
+
+/* True if a job is due, e.g. to be checked with interrupts off before a WFI */
+bool scheduler_due(void);
+
+/* Sleep with WFI until a job is due, other interrupts are still handled */
+void scheduler_wait(void);
+
+/* Copy of a job's statistics, false if there is no such job */
+bool scheduler_get_stats(int8_t job, scheduler_stats *stats);
+
+void scheduler_reset_stats(void);
+
+/* print() the statistics of all jobs, from the main loop only */
+void scheduler_dump(void);
@@ -0,0 +1,23 @@
+#pragma once
+
+/*
+ * Placement in the memory regions of STM32H743ZITX_FLASH.ld. Without these,
+ * code runs from flash and data lives in the DTCM, which is fast for the CPU
+ * but out of reach of DMA1 and DMA2.
+ */
+
+/*
+ * Code copied to the ITCM at startup, runs without flash wait states. Meant
+ * for interrupt handlers and hot loops. Calls between flash and ITCM go through
+ * linker generated veneers, so keep both sides of a hot call in the ITCM.
+ */
+#define ITCM_TEXT __attribute__((section(".itcm_text")))
+
+/*
+ * Buffers in D2 SRAM1/SRAM2, reachable by DMA1 and DMA2. Aligned to the 32 byte
+ * cache line so cache maintenance on one buffer never touches another.
+ */
+#define DMA_BUFFER __attribute__((section(".dma_buffers"), aligned(32)))
+
+/* Large zero-initialized data in the 512K AXI SRAM, e.g. frame histories */
+#define AXI_BSS __attribute__((section(".axi_bss"), aligned(32)))
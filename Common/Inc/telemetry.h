@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32h7xx_hal.h"
+
+/*
+ * Binary telemetry frames, sent through the print() buffer so they can be mixed
+ * with text output. All fields are little endian:
+ *
+ *   offset  size  field
+ *        0     2  sync word, bytes 0xA5 0xC3 (never part of ASCII text)
+ *        2     1  type (TELEMETRY_TYPE_x)
+ *        3     1  protocol version
+ *        4     2  sequence number, counts every frame, also dropped ones
+ *        6     2  payload length in bytes
+ *        8     4  timestamp, timebase_us() when the data was sampled
+ *       12     n  payload
+ *     12+n     4  CRC-32 (same as zlib's crc32()) over header and payload
+ *
+ * util/telemetry.py decodes them on the host.
+ */
+#define TELEMETRY_SYNC        0xC3A5
+#define TELEMETRY_VERSION     2
+
+/* Largest payload accepted by telemetry_send() */
+#define TELEMETRY_MAX_PAYLOAD 256
+
+/* Payloads up to this size are framed in the small size class, see pool.h */
+#define TELEMETRY_SMALL_PAYLOAD 48
+
+/* Frames that can be built at the same time in each size class */
+#ifndef TELEMETRY_MESSAGES
+#define TELEMETRY_MESSAGES 2
+#endif
+
+/* 64 x int16, GridEYE pixels in quarter degrees Celsius */
+#define TELEMETRY_TYPE_GRIDEYE_FRAME    0x01
+/* 6 x float32, AS7265X calibrated channels A to F */
+#define TELEMETRY_TYPE_AS7265X_CHANNELS 0x02
+/*
+ * GridEYE pixels above the interrupt threshold: the 8 byte interrupt table
+ * followed by one int16 (quarter degrees Celsius) per flagged pixel
+ */
+#define TELEMETRY_TYPE_GRIDEYE_HOTSPOTS 0x03
+/*
+ * AS7265X_Spectrum: uint32 read time in ms, 18 x uint16 raw and 18 x float32
+ * calibrated values, sorted by wavelength
+ */
+#define TELEMETRY_TYPE_AS7265X_SPECTRUM 0x04
+
+typedef struct {
+	uint16_t sync;
+	uint8_t type;
+	uint8_t version;
+	uint16_t seq;
+	uint16_t length;
+	uint32_t timestamp;
+} telemetry_header;
+
+/* Set up the CRC unit and the frame buffer pools, call once before telemetry_send() */
+void telemetry_init(void);
+
+/*
+ * Frame the payload in a pool block and queue it for sending. Returns false
+ * if the frame was dropped because it was too long, no block was free or the
+ * print() buffer had no room for it. Like print(), only to be called from the
+ * main loop.
+ */
+bool telemetry_send(uint8_t type, const void *payload, uint16_t length);
+
+/* Same, with the timestamp of a sample taken earlier, e.g. a scheduler_sample start */
+bool telemetry_send_at(uint8_t type, const void *payload, uint16_t length, uint32_t timestamp);
+
+/* Number of frames dropped so far */
+uint32_t telemetry_dropped(void);
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "stm32h7xx_hal.h"
+
+/*
+ * Microsecond timebase on the 32 bit TIM2, which also replaces SysTick as the
+ * HAL tick: HAL_InitTick(), HAL_GetTick() and HAL_Delay() are overridden, so
+ * linking this file is all it takes. HAL_Delay() sleeps with WFI instead of
+ * spinning.
+ *
+ * The timer prescaler follows clock changes (HAL_RCC_ClockConfig() calls
+ * HAL_InitTick()), which requires a timer clock of a whole number of MHz.
+ * HAL_InitTick() returns HAL_ERROR for any other, so HAL_RCC_ClockConfig()
+ * fails instead of the timebase running fast.
+ *
+ * Times are timebase_us() values, which wrap around every 71.6 minutes.
+ * Compare them with (int32_t)(a - b), so deadlines and periods have to stay
+ * below 2^31 us (35 minutes).
+ */
+#define TIMEBASE_TIM TIM2
+
+/* Software timer, owned by the timebase while running */
+typedef struct timebase_timer timebase_timer;
+typedef void (*timebase_callback)(timebase_timer *timer);
+
+struct timebase_timer {
+	uint32_t expiry;            /* timebase_us() at which it fires next */
+	uint32_t period;            /* 0 for one-shot timers */
+	timebase_callback callback; /* called from the TIM2 interrupt */
+	void *context;              /* for the callback, untouched by the timebase */
+	timebase_timer *next;
+	bool active;
+};
+
+/* Microseconds since startup, wraps around after 2^32 */
+static inline uint32_t timebase_us(void)
+{
+	return TIMEBASE_TIM->CNT;
+}
+
+/* Microseconds since startup, without wrapping around */
+uint64_t timebase_us64(void);
+
+/*
+ * Sleep with WFI until timebase_us() reaches deadline, interrupts are still
+ * handled in the meantime. Busy-waits when called from an interrupt handler,
+ * whose priority could keep the wakeup interrupt out.
+ */
+void timebase_sleep_until(uint32_t deadline);
+void timebase_sleep_us(uint32_t us);
+
+/*
+ * Call timer->callback after delay_us, and then every period_us if that is not
+ * 0. Periodic timers are rescheduled from their previous expiry, so they don't
+ * drift. Restarts the timer if it is already running.
+ */
+void timebase_timer_start(timebase_timer *timer, uint32_t delay_us, uint32_t period_us);
+
+/* Same, but first fires at the timebase_us() value expiry, e.g. to line timers up */
+void timebase_timer_start_at(timebase_timer *timer, uint32_t expiry, uint32_t period_us);
+
+/* Does nothing if the timer isn't running */
+void timebase_timer_stop(timebase_timer *timer);
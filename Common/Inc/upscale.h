@@ -0,0 +1,101 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Interpolation of small sensor frames, e.g. the 8x8 GridEYE pixels, to a
+ * larger grid for display and for locating hot spots between pixels:
+ *
+ *	static upscaler up;
+ *	upscale_init(&up, 8, 8, 32, 32, UPSCALE_BICUBIC);
+ *	upscale_q15(&up, frame, big);          // int16 in, int16 out
+ *
+ * The corners of the output grid sit on the corner pixels of the input, so
+ * output pixel o of n lies at o * (in - 1) / (n - 1) in input pixels.
+ *
+ * upscale_init() precomputes, for every output column and row, the input
+ * pixels it is made of and their weights. Frames are then interpolated
+ * separably, first along the rows and then along the columns:
+ *
+ * - upscale_q15() works on 16 bit fixed point data, such as quarter degrees,
+ *   with Q14 weights and 2 extra fraction bits between the passes. Output is
+ *   rounded to the input's unit.
+ * - upscale_f32() works on floats. The bilinear kernel goes through
+ *   arm_bilinear_interp_f32() from CMSIS-DSP, the bicubic one is separable
+ *   like the fixed point path.
+ *
+ * Bicubic is Catmull-Rom, which passes through the input pixels but may
+ * overshoot next to steep edges.
+ */
+
+#ifndef UPSCALE_MAX_INPUT
+#define UPSCALE_MAX_INPUT 8
+#endif
+
+#ifndef UPSCALE_MAX_OUTPUT
+#define UPSCALE_MAX_OUTPUT 64
+#endif
+
+typedef enum {
+	UPSCALE_BILINEAR,
+	UPSCALE_BICUBIC,
+} upscale_kernel;
+
+#define UPSCALE_TAPS 4
+
+/* Input pixels and weights that make up one output column or row */
+typedef struct {
+	uint8_t index[UPSCALE_TAPS]; /* clamped to the input */
+	int16_t weight[UPSCALE_TAPS]; /* Q14, 16384 is 1.0, they sum up to that */
+	float weight_f32[UPSCALE_TAPS];
+	float position;               /* in input pixels */
+} upscale_tap;
+
+typedef struct {
+	uint16_t in_width;
+	uint16_t in_height;
+	uint16_t out_width;
+	uint16_t out_height;
+	upscale_kernel kernel;
+	uint8_t taps; /* 2 for bilinear, 4 for bicubic */
+	upscale_tap cols[UPSCALE_MAX_OUTPUT];
+	upscale_tap rows[UPSCALE_MAX_OUTPUT];
+
+	/* Rows interpolated to the output width, between the passes */
+	int16_t mid_q15[UPSCALE_MAX_INPUT * UPSCALE_MAX_OUTPUT];
+	float mid_f32[UPSCALE_MAX_INPUT * UPSCALE_MAX_OUTPUT];
+	/* Input with its last row and column repeated, for arm_bilinear_interp_f32() */
+	float padded[(UPSCALE_MAX_INPUT + 1) * (UPSCALE_MAX_INPUT + 1)];
+} upscaler;
+
+/*
+ * Inputs of 2 to UPSCALE_MAX_INPUT and outputs of 2 to UPSCALE_MAX_OUTPUT
+ * pixels per side. Returns false for other sizes.
+ */
+bool upscale_init(upscaler *up, uint16_t in_width, uint16_t in_height,
+		uint16_t out_width, uint16_t out_height, upscale_kernel kernel);
+
+/* in_width * in_height pixels to out_width * out_height, both row by row */
+void upscale_q15(upscaler *up, const int16_t *in, int16_t *out);
+void upscale_f32(upscaler *up, const float *in, float *out);
+
+/* Hottest pixel of an output frame */
+typedef struct {
+	uint16_t x;
+	uint16_t y;
+	int16_t value;
+} upscale_peak;
+
+void upscale_find_peak(const upscaler *up, const int16_t *out, upscale_peak *peak);
+
+/* Position of output column x or row y in input pixels */
+static inline float upscale_position_x(const upscaler *up, uint16_t x)
+{
+	return up->cols[x].position;
+}
+
+static inline float upscale_position_y(const upscaler *up, uint16_t y)
+{
+	return up->rows[y].position;
+}
@@ -0,0 +1,73 @@
+#include "cache.h"
+
+#define CACHE_LINE 32U
+
+static void region(uint8_t number, uint32_t base, uint8_t size,
+		uint8_t tex, uint8_t cacheable, uint8_t bufferable)
+{
+	MPU_Region_InitTypeDef init = {0};
+
+	init.Enable = MPU_REGION_ENABLE;
+	init.Number = number;
+	init.BaseAddress = base;
+	init.Size = size;
+	init.SubRegionDisable = 0x00;
+	init.TypeExtField = tex;
+	init.AccessPermission = MPU_REGION_FULL_ACCESS;
+	init.DisableExec = MPU_INSTRUCTION_ACCESS_ENABLE;
+	init.IsShareable = MPU_ACCESS_NOT_SHAREABLE;
+	init.IsCacheable = cacheable;
+	init.IsBufferable = bufferable;
+	HAL_MPU_ConfigRegion(&init);
+}
+
+void cache_init(void)
+{
+	HAL_MPU_Disable();
+
+#if CACHE_ENABLE
+	/* Flash, write-through. Full access, so flash programming still works. */
+	region(MPU_REGION_NUMBER0, 0x08000000, MPU_REGION_SIZE_2MB,
+			MPU_TEX_LEVEL0, MPU_ACCESS_CACHEABLE, MPU_ACCESS_NOT_BUFFERABLE);
+	/* AXI SRAM, write-back with write allocate */
+	region(MPU_REGION_NUMBER1, 0x24000000, MPU_REGION_SIZE_512KB,
+			MPU_TEX_LEVEL1, MPU_ACCESS_CACHEABLE, MPU_ACCESS_BUFFERABLE);
+#if CACHE_DMA_BUFFERS_CACHEABLE
+	region(MPU_REGION_NUMBER2, 0x30000000, MPU_REGION_SIZE_256KB,
+			MPU_TEX_LEVEL1, MPU_ACCESS_CACHEABLE, MPU_ACCESS_BUFFERABLE);
+#else
+	/* Normal memory, not cached */
+	region(MPU_REGION_NUMBER2, 0x30000000, MPU_REGION_SIZE_256KB,
+			MPU_TEX_LEVEL1, MPU_ACCESS_NOT_CACHEABLE, MPU_ACCESS_NOT_BUFFERABLE);
+#endif
+
+	HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+
+	SCB_EnableICache();
+	SCB_EnableDCache();
+#endif
+}
+
+void cache_clean(const void *addr, uint32_t len)
+{
+#if CACHE_ENABLE
+	uint32_t start = (uint32_t)addr & ~(CACHE_LINE - 1);
+	uint32_t end = (uint32_t)addr + len;
+	SCB_CleanDCache_by_Addr((uint32_t *)start, (int32_t)(end - start));
+#else
+	(void)addr;
+	(void)len;
+#endif
+}
+
+void cache_invalidate(void *addr, uint32_t len)
+{
+#if CACHE_ENABLE
+	uint32_t start = (uint32_t)addr & ~(CACHE_LINE - 1);
+	uint32_t end = (uint32_t)addr + len;
+	SCB_InvalidateDCache_by_Addr((void *)start, (int32_t)(end - start));
+#else
+	(void)addr;
+	(void)len;
+#endif
+}
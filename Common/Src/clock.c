@@ -0,0 +1,182 @@
+#include "clock.h"
+
+void Error_Handler();
+
+static uint32_t max_sysclk;
+
+static void (*listeners[CLOCK_MAX_LISTENERS])(clock_event event);
+static uint32_t listener_count;
+
+/*
+ * Flash wait states and programming delay (FLASH_ACR WRHIGHFREQ) up to an
+ * HCLK (AXI clock) at VOS0/VOS1, see RM0433 table 17. Erasing and programming
+ * with the wrong delay for the clock may fail.
+ */
+static const struct {
+	uint32_t hclk_max;
+	uint32_t latency;
+	uint32_t delay;
+} flash_settings[] = {
+	{  70000000, FLASH_LATENCY_0, FLASH_PROGRAMMING_DELAY_0 },
+	{ 140000000, FLASH_LATENCY_1, FLASH_PROGRAMMING_DELAY_1 },
+	{ 185000000, FLASH_LATENCY_2, FLASH_PROGRAMMING_DELAY_1 },
+	{ 210000000, FLASH_LATENCY_3, FLASH_PROGRAMMING_DELAY_2 },
+	{ 240000000, FLASH_LATENCY_4, FLASH_PROGRAMMING_DELAY_2 },
+};
+
+static uint32_t flash_setting(uint32_t hclk)
+{
+	uint32_t i = 0;
+	while (i < sizeof(flash_settings) / sizeof(flash_settings[0]) - 1 &&
+			hclk > flash_settings[i].hclk_max)
+		i++;
+	return i;
+}
+
+/* Core, AHB and APB dividers for a SYSCLK divider, HCLK is always half the core clock */
+static void configure_buses(uint32_t divider, uint32_t core)
+{
+	RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+
+	RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_HCLK |
+			RCC_CLOCKTYPE_D1PCLK1 | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2 |
+			RCC_CLOCKTYPE_D3PCLK1;
+	RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+	RCC_ClkInitStruct.SYSCLKDivider = divider;
+	RCC_ClkInitStruct.AHBCLKDivider = RCC_HCLK_DIV2;
+	RCC_ClkInitStruct.APB3CLKDivider = RCC_APB3_DIV2;
+	RCC_ClkInitStruct.APB1CLKDivider = RCC_APB1_DIV2;
+	RCC_ClkInitStruct.APB2CLKDivider = RCC_APB2_DIV2;
+	RCC_ClkInitStruct.APB4CLKDivider = RCC_APB4_DIV2;
+
+	/*
+	 * HAL_RCC_ClockConfig() orders the wait states and the clock change, but
+	 * leaves the programming delay alone. Raise it before speeding up and
+	 * lower it after slowing down.
+	 */
+	uint32_t flash = flash_setting(core / 2);
+	bool faster = flash_settings[flash].delay > __HAL_FLASH_GET_PROGRAM_DELAY();
+	if (faster)
+		__HAL_FLASH_SET_PROGRAM_DELAY(flash_settings[flash].delay);
+
+	/* Also updates SystemCoreClock and the HAL tick through HAL_InitTick() */
+	if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, flash_settings[flash].latency) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	if (!faster)
+		__HAL_FLASH_SET_PROGRAM_DELAY(flash_settings[flash].delay);
+}
+
+void clock_init(void)
+{
+	RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+	RCC_PeriphCLKInitTypeDef PeriphClkInit = {0};
+
+	/* Revision Y silicon has no overdrive and is rated for 400 MHz at VOS1 */
+	bool overdrive = HAL_GetREVID() >= REV_ID_V;
+	max_sysclk = overdrive ? 480000000 : 400000000;
+
+	HAL_PWREx_ConfigSupply(PWR_LDO_SUPPLY);
+
+	/* VOS0 is entered from VOS1, and the overdrive bit lives in SYSCFG */
+	__HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE1);
+	while (!__HAL_PWR_GET_FLAG(PWR_FLAG_VOSRDY)) {}
+	if (overdrive)
+	{
+		__HAL_RCC_SYSCFG_CLK_ENABLE();
+		__HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE0);
+		while (!__HAL_PWR_GET_FLAG(PWR_FLAG_VOSRDY)) {}
+	}
+
+	/* 8 MHz HSE, VCO at twice the core clock */
+	RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+	RCC_OscInitStruct.HSEState = RCC_HSE_BYPASS;
+	RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+	RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
+	RCC_OscInitStruct.PLL.PLLM = 1;
+	RCC_OscInitStruct.PLL.PLLN = 2 * max_sysclk / CLOCK_HSE_HZ;
+	RCC_OscInitStruct.PLL.PLLP = 2;
+	RCC_OscInitStruct.PLL.PLLQ = 4;
+	RCC_OscInitStruct.PLL.PLLR = 2;
+	RCC_OscInitStruct.PLL.PLLRGE = RCC_PLL1VCIRANGE_3;
+	RCC_OscInitStruct.PLL.PLLVCOSEL = RCC_PLL1VCOWIDE;
+	RCC_OscInitStruct.PLL.PLLFRACN = 0;
+	if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	configure_buses(RCC_SYSCLK_DIV1, max_sysclk);
+
+	/* PLL3 with a 384 MHz VCO for the kernel clocks of USART3 and I2C2 */
+	PeriphClkInit.PeriphClockSelection = RCC_PERIPHCLK_USART234578 | RCC_PERIPHCLK_I2C123;
+	PeriphClkInit.PLL3.PLL3M = 1;
+	PeriphClkInit.PLL3.PLL3N = 48;
+	PeriphClkInit.PLL3.PLL3P = 2;
+	PeriphClkInit.PLL3.PLL3Q = 384000000 / CLOCK_PLL3Q_HZ;
+	PeriphClkInit.PLL3.PLL3R = 384000000 / CLOCK_PLL3R_HZ;
+	PeriphClkInit.PLL3.PLL3RGE = RCC_PLL3VCIRANGE_3;
+	PeriphClkInit.PLL3.PLL3VCOSEL = RCC_PLL3VCOMEDIUM;
+	PeriphClkInit.PLL3.PLL3FRACN = 0;
+	PeriphClkInit.Usart234578ClockSelection = RCC_USART234578CLKSOURCE_PLL3;
+	PeriphClkInit.I2c123ClockSelection = RCC_I2C123CLKSOURCE_PLL3;
+	if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInit) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	/* The I/O compensation cell needs CSI and is recommended above 100 MHz */
+	__HAL_RCC_CSI_ENABLE();
+	__HAL_RCC_SYSCFG_CLK_ENABLE();
+	HAL_EnableCompensationCell();
+}
+
+uint32_t clock_max_sysclk(void)
+{
+	return max_sysclk;
+}
+
+bool clock_set_sysclk(uint32_t hz)
+{
+	static const struct {
+		uint32_t factor;
+		uint32_t divider;
+	} dividers[] = {
+		{ 1, RCC_SYSCLK_DIV1 }, { 2, RCC_SYSCLK_DIV2 }, { 4, RCC_SYSCLK_DIV4 },
+		{ 8, RCC_SYSCLK_DIV8 }, { 16, RCC_SYSCLK_DIV16 },
+	};
+
+	for (uint32_t i = 0; i < sizeof(dividers) / sizeof(dividers[0]); i++)
+	{
+		if (max_sysclk / dividers[i].factor != hz || max_sysclk % dividers[i].factor != 0)
+			continue;
+		/*
+		 * The timebase needs a timer clock of a whole number of MHz. It is the
+		 * core clock / 2 (HCLK, as the APB1 timers run at twice PCLK1), which
+		 * allows a sixteenth of 480 MHz but only an eighth of 400 MHz.
+		 */
+		if (hz % 2000000 != 0)
+			return false;
+
+		if (hz != SystemCoreClock)
+		{
+			for (uint32_t l = 0; l < listener_count; l++)
+				listeners[l](CLOCK_CHANGING);
+			configure_buses(dividers[i].divider, hz);
+			for (uint32_t l = 0; l < listener_count; l++)
+				listeners[l](CLOCK_CHANGED);
+		}
+		return true;
+	}
+	return false;
+}
+
+bool clock_add_listener(void (*listener)(clock_event event))
+{
+	if (listener_count == CLOCK_MAX_LISTENERS)
+		return false;
+	listeners[listener_count++] = listener;
+	return true;
+}
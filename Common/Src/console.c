@@ -0,0 +1,247 @@
+#include "console.h"
+
+void Error_Handler();
+
+UART_HandleTypeDef huart3;
+
+static console_config config = CONSOLE_DEFAULT_CONFIG;
+
+/*
+ * Deviation of the achievable baud rate from the requested one in ppm, or
+ * UINT32_MAX if the divider is out of range. With 8x oversampling the divider
+ * is computed from twice the kernel clock.
+ */
+static uint32_t baud_error(uint32_t freq, uint32_t baudrate, uint32_t oversampling)
+{
+	uint64_t clock = (oversampling == UART_OVERSAMPLING_8) ? 2ULL * freq : freq;
+	uint64_t div = (clock + baudrate / 2) / baudrate;
+	if (div < 16 || div > 0xFFFF)
+		return UINT32_MAX;
+
+	uint64_t actual = clock / div;
+	uint64_t diff = actual > baudrate ? actual - baudrate : baudrate - actual;
+	return (uint32_t)(diff * 1000000 / baudrate);
+}
+
+/*
+ * Choose the USART3 kernel clock and oversampling mode for a baud rate.
+ * 16x oversampling is preferred for its better noise immunity, 8x is needed for
+ * rates above a sixteenth of the kernel clock. The fixed PLL3 and HSI clocks
+ * are preferred over PCLK1, which changes with clock_set_sysclk().
+ */
+static bool select_clock(uint32_t baudrate, uint32_t *source, uint32_t *oversampling)
+{
+	struct {
+		uint32_t source;
+		uint32_t freq;
+	} clocks[3];
+	int count = 0;
+
+	/* Set up by clock_init() */
+	if (__HAL_RCC_GET_FLAG(RCC_FLAG_PLL3RDY))
+	{
+		clocks[count].source = RCC_USART234578CLKSOURCE_PLL3;
+		clocks[count].freq = CLOCK_PLL3Q_HZ;
+		count++;
+	}
+
+	/* HSI is only an option if some project already runs it */
+	if (__HAL_RCC_GET_FLAG(RCC_FLAG_HSIRDY))
+	{
+		clocks[count].source = RCC_USART234578CLKSOURCE_HSI;
+		clocks[count].freq = HSI_VALUE;
+		if (__HAL_RCC_GET_FLAG(RCC_FLAG_HSIDIV) != 0U)
+			clocks[count].freq = HSI_VALUE >> (__HAL_RCC_GET_HSI_DIVIDER() >> 3U);
+		count++;
+	}
+
+	clocks[count].source = RCC_USART234578CLKSOURCE_D2PCLK1;
+	clocks[count].freq = HAL_RCC_GetPCLK1Freq();
+	count++;
+
+	const uint32_t modes[] = { UART_OVERSAMPLING_16, UART_OVERSAMPLING_8 };
+	uint32_t best = UINT32_MAX;
+
+	for (int m = 0; m < 2; m++)
+	{
+		for (int c = 0; c < count; c++)
+		{
+			uint32_t error = baud_error(clocks[c].freq, baudrate, modes[m]);
+			if (error < best)
+			{
+				best = error;
+				*source = clocks[c].source;
+				*oversampling = modes[m];
+			}
+			/* Good enough, take the most preferred clock */
+			if (best <= CONSOLE_MAX_BAUD_ERROR / 4)
+				return true;
+		}
+	}
+
+	return best <= CONSOLE_MAX_BAUD_ERROR;
+}
+
+static bool configure(uint32_t baudrate)
+{
+	uint32_t source, oversampling;
+	if (!select_clock(baudrate, &source, &oversampling))
+		return false;
+
+	/*
+	 * Only switch the mux, HAL_RCCEx_PeriphCLKConfig() would restart PLL3
+	 * under the I2C, which shares it
+	 */
+	__HAL_RCC_USART234578_CONFIG(source);
+
+	huart3.Init.BaudRate = baudrate;
+	huart3.Init.OverSampling = oversampling;
+	if (HAL_UART_Init(&huart3) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	/* HAL_UART_Init() resets the FIFO configuration */
+	if (config.fifo)
+	{
+		if (HAL_UARTEx_SetTxFifoThreshold(&huart3, config.tx_fifo_threshold) != HAL_OK ||
+			HAL_UARTEx_SetRxFifoThreshold(&huart3, config.rx_fifo_threshold) != HAL_OK ||
+			HAL_UARTEx_EnableFifoMode(&huart3) != HAL_OK)
+		{
+			Error_Handler();
+		}
+	}
+
+	config.baudrate = baudrate;
+	return true;
+}
+
+/*
+ * Clock change listener. With PCLK1 as kernel clock everything queued has to
+ * be sent at the old bus clock, and then the divider has to follow the new
+ * one. The fixed kernel clocks need neither, the transmit goes on meanwhile.
+ */
+static void clock_changed(clock_event event)
+{
+	if (__HAL_RCC_GET_USART234578_SOURCE() != RCC_USART234578CLKSOURCE_D2PCLK1)
+		return;
+
+	if (event == CLOCK_CHANGING)
+	{
+		/*
+		 * The transmit complete interrupt starts the next queued chunk right
+		 * away, so the UART is only ready once print() has nothing left
+		 */
+		while (huart3.gState != HAL_UART_STATE_READY ||
+				__HAL_UART_GET_FLAG(&huart3, UART_FLAG_TC) == RESET) {}
+		return;
+	}
+
+	uint32_t clock = HAL_RCC_GetPCLK1Freq();
+	uint32_t brr;
+	if (huart3.Init.OverSampling == UART_OVERSAMPLING_8)
+	{
+		uint32_t div = UART_DIV_SAMPLING8(clock, config.baudrate, huart3.Init.ClockPrescaler);
+		brr = (div & 0xFFF0U) | ((div & 0x000FU) >> 1U);
+	}
+	else
+	{
+		brr = UART_DIV_SAMPLING16(clock, config.baudrate, huart3.Init.ClockPrescaler);
+	}
+
+	__HAL_UART_DISABLE(&huart3);
+	huart3.Instance->BRR = brr;
+	__HAL_UART_ENABLE(&huart3);
+}
+
+void console_init(const console_config *init)
+{
+	GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+	if (init)
+		config = *init;
+
+	// Enable GPIO clocks for USART3 TX and RX
+	__HAL_RCC_GPIOD_CLK_ENABLE();
+
+	// Enable USART3 clock
+	__HAL_RCC_USART3_CLK_ENABLE();
+
+	// Configure USART3 TX (PD8) and RX (PD9)
+	GPIO_InitStruct.Pin = GPIO_PIN_8 | GPIO_PIN_9;
+	GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
+	GPIO_InitStruct.Pull = GPIO_PULLUP;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
+	GPIO_InitStruct.Alternate = GPIO_AF7_USART3;
+	HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
+
+	// Configure UART parameters
+	huart3.Instance = USART3;
+	huart3.Init.WordLength = UART_WORDLENGTH_8B;
+	huart3.Init.StopBits = UART_STOPBITS_1;
+	huart3.Init.Parity = UART_PARITY_NONE;
+	huart3.Init.Mode = UART_MODE_TX_RX;
+	huart3.Init.HwFlowCtl = UART_HWCONTROL_NONE;
+	huart3.Init.OneBitSampling = UART_ONE_BIT_SAMPLE_DISABLE;
+	huart3.Init.ClockPrescaler = UART_PRESCALER_DIV1;
+
+	if (!configure(config.baudrate))
+	{
+		// No kernel clock can produce this baud rate
+		Error_Handler();
+	}
+
+	clock_add_listener(clock_changed);
+}
+
+bool console_set_baudrate(uint32_t baudrate)
+{
+	uint32_t source, oversampling;
+	if (!select_clock(baudrate, &source, &oversampling))
+		return false;
+
+	/* Let the last byte leave the shift register before switching */
+	while (__HAL_UART_GET_FLAG(&huart3, UART_FLAG_TC) == RESET) {}
+	HAL_UART_Abort(&huart3);
+	__HAL_UART_DISABLE(&huart3);
+
+	return configure(baudrate);
+}
+
+uint32_t console_get_baudrate(void)
+{
+	return config.baudrate;
+}
+
+static uint32_t append(uint8_t *buf, uint32_t pos, const char *str)
+{
+	while (*str)
+		buf[pos++] = *str++;
+	return pos;
+}
+
+bool console_handshake_reply(uint32_t baudrate)
+{
+	uint32_t source, oversampling;
+	bool supported = select_clock(baudrate, &source, &oversampling);
+
+	uint8_t msg[32];
+	uint32_t len = append(msg, 0, supported ? "--BAUD_OK:" : "--BAUD_ERR:");
+
+	char number[10];
+	int n = 0;
+	uint32_t rest = baudrate;
+	do {
+		number[n++] = (char)('0' + rest % 10);
+		rest /= 10;
+	} while (rest > 0);
+	while (n > 0)
+		msg[len++] = number[--n];
+	len = append(msg, len, "--");
+
+	HAL_UART_Transmit(&huart3, msg, len, 100);
+
+	if (!supported)
+		return false;
+	return console_set_baudrate(baudrate);
+}
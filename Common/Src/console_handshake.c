@@ -0,0 +1,57 @@
+#include "console.h"
+
+/*
+ * Handshake request parser, apart from the UART code in console.c so it
+ * also builds for the host simulation
+ */
+static const char request_prefix[] = "--BAUD:";
+static enum { PREFIX, DIGITS, CLOSING } state = PREFIX;
+static uint32_t prefix_matched;
+static uint32_t requested;
+static uint32_t digits;
+
+uint32_t console_handshake_feed(const uint8_t *data, uint32_t len)
+{
+	uint32_t found = 0;
+
+	for (uint32_t i = 0; i < len; i++)
+	{
+		char c = (char)data[i];
+
+		switch (state)
+		{
+			case PREFIX:
+				if (c == request_prefix[prefix_matched])
+					prefix_matched++;
+				else if (c == '-')
+					prefix_matched = (prefix_matched == 2) ? 2 : 1; // "---BAUD" still matches
+				else
+					prefix_matched = 0;
+
+				if (prefix_matched == sizeof(request_prefix) - 1)
+				{
+					state = DIGITS;
+					requested = 0;
+					digits = 0;
+				}
+				break;
+			case DIGITS:
+				if (c >= '0' && c <= '9' && digits < 9)
+				{
+					requested = requested * 10 + (c - '0');
+					digits++;
+					break;
+				}
+				state = (c == '-' && digits > 0) ? CLOSING : PREFIX;
+				prefix_matched = (c == '-') ? 1 : 0;
+				break;
+			case CLOSING:
+				state = PREFIX;
+				prefix_matched = 0;
+				if (c == '-')
+					found = requested; // Keep going, a later request wins
+				break;
+		}
+	}
+	return found;
+}
@@ -0,0 +1,59 @@
+#include "console.h"
+#include "debug.h"
+
+/* Received bytes, handed to the parser on an idle line or when full */
+static uint8_t rx_buf[32];
+
+/* Rate of the last complete request, 0 if none */
+static volatile uint32_t pending;
+
+void console_listen(void)
+{
+	if (huart3.RxState == HAL_UART_STATE_READY)
+		HAL_UARTEx_ReceiveToIdle_IT(&huart3, rx_buf, sizeof(rx_buf));
+}
+
+bool console_handshake_pending(void)
+{
+	return pending != 0;
+}
+
+bool console_handshake_poll(void)
+{
+	bool switched = false;
+	uint32_t baudrate = pending;
+
+	if (baudrate != 0)
+	{
+		pending = 0;
+		/*
+		 * The answer goes out with a blocking transmit after what print()
+		 * queued, the host repeats the request if it can't be sent
+		 */
+		if (print_flush())
+			switched = console_handshake_reply(baudrate);
+	}
+
+	/* A switch or a receive error stops the reception */
+	console_listen();
+	return switched;
+}
+
+/* Called by the HAL on an idle line or a full buffer, overrides the weak default */
+void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t size)
+{
+	if (huart != &huart3)
+		return;
+
+	uint32_t baudrate = console_handshake_feed(rx_buf, size);
+	if (baudrate != 0)
+		pending = baudrate;
+	console_listen();
+}
+
+/* Overrun or framing errors end the reception, overrides the weak default */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+	if (huart == &huart3)
+		console_listen();
+}
@@ -0,0 +1,261 @@
+#include <stdarg.h>  // Needed for variadic functions
+#include <stdbool.h>
+#include "debug.h"
+#include "cache.h"
+#include "profile.h"
+#include "ring.h"
+#include "irq.h"
+#include "sections.h"
+
+void Error_Handler();
+
+#if PRINT_USE_DMA
+#define UART_TRANSMIT HAL_UART_Transmit_DMA
+#define BUFFER_SECTION DMA_BUFFER
+#else
+#define UART_TRANSMIT HAL_UART_Transmit_IT
+#define BUFFER_SECTION
+#endif
+
+/* Transmit ring, print() produces and the UART interrupt consumes */
+static uint8_t buffer[PRINT_BUFFER_SIZE] BUFFER_SECTION;
+static ring tx = RING_INIT(buffer, PRINT_BUFFER_SIZE, 1);
+
+/* Length of the chunk the UART is currently sending, 0 if idle */
+static volatile uint32_t sending;
+
+static uint32_t dropped;
+
+/*
+ * print() stages its output after tail and commits it at the end, so with
+ * PRINT_FULL_DROP a call that doesn't fit is dropped as a whole
+ */
+static uint32_t staged;
+static uint32_t overflow;
+
+#if PRINT_USE_DMA
+static DMA_HandleTypeDef hdma_usart3_tx;
+#endif
+
+/* Send the next contiguous chunk of the buffer, if idle. Interrupts must be off. */
+static ITCM_TEXT void start_transmit(void)
+{
+	if (sending != 0)
+		return;
+
+	uint32_t len;
+	uint8_t *chunk = ring_peek(&tx, &len);
+	if (len == 0)
+		return;
+
+	sending = len;
+#if PRINT_USE_DMA
+	cache_clean(chunk, len);
+#endif
+	if (UART_TRANSMIT(&huart3, chunk, len) != HAL_OK)
+		sending = 0; // Try again on the next print
+}
+
+static void kick(void)
+{
+	uint32_t primask = irq_save();
+	start_transmit();
+	irq_restore(primask);
+}
+
+static void put_char(char c)
+{
+	while (overflow > 0 || staged >= ring_space(&tx)) {
+#if PRINT_FULL_POLICY == PRINT_FULL_BLOCK
+		/* Let the UART send what is staged so far to make room */
+		ring_commit(&tx, staged);
+		staged = 0;
+		kick();
+#else
+		overflow++;
+		return;
+#endif
+	}
+	*ring_slot(&tx, tx.tail + staged) = (uint8_t)c;
+	staged++;
+}
+
+static void put_uint(uint32_t num)
+{
+	char digits[10];  // Enough for the largest uint32_t
+	int len = 0;
+	do {
+		digits[len++] = (char)((num % 10) + '0');  // Get each digit
+		num /= 10;
+	} while (num > 0);
+
+	// Digits were produced lowest first
+	while (len > 0)
+		put_char(digits[--len]);
+}
+
+static void put_float(double num)
+{
+	if (num < 0) {
+		put_char('-');
+		num = -num;
+	}
+	put_uint((uint32_t)num);
+	put_char('.');
+
+	double frac_part = num - (uint32_t)num;
+	uint8_t precision = 3;
+	for (int i = 0; i < precision; i++) {
+		frac_part *= 10;
+		put_char((char)('0' + (uint32_t)frac_part));
+		frac_part -= (uint32_t)frac_part;
+	}
+}
+
+void print_init(void) {
+#if PRINT_USE_DMA
+	__HAL_RCC_DMA1_CLK_ENABLE();
+	hdma_usart3_tx.Instance = DMA1_Stream2;
+	hdma_usart3_tx.Init.Request = DMA_REQUEST_USART3_TX;
+	hdma_usart3_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+	hdma_usart3_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+	hdma_usart3_tx.Init.MemInc = DMA_MINC_ENABLE;
+	hdma_usart3_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+	hdma_usart3_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+	hdma_usart3_tx.Init.Mode = DMA_NORMAL;
+	hdma_usart3_tx.Init.Priority = DMA_PRIORITY_LOW;
+	hdma_usart3_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+	if (HAL_DMA_Init(&hdma_usart3_tx) != HAL_OK) {
+		Error_Handler();
+	}
+	__HAL_LINKDMA(&huart3, hdmatx, hdma_usart3_tx);
+
+	HAL_NVIC_SetPriority(DMA1_Stream2_IRQn, 6, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Stream2_IRQn);
+#endif
+
+	HAL_NVIC_SetPriority(USART3_IRQn, 6, 0);
+	HAL_NVIC_EnableIRQ(USART3_IRQn);
+}
+
+void print(const char *format, ...) {
+	PROFILE_BEGIN(print, "print");
+	va_list args;
+	va_start(args, format);
+
+	while (*format) {
+		if (*format == '%') {
+			format++;  // Move to the format specifier
+			switch (*format) {
+				case 'd': {  // Print signed integer
+					int32_t num = va_arg(args, int32_t);
+					if (num < 0) {
+						put_char('-');
+						put_uint(-(uint32_t)num);
+					} else {
+						put_uint(num);
+					}
+					break;
+				}
+				case 'u':  // Print unsigned integer
+					put_uint(va_arg(args, uint32_t));
+					break;
+				case 'c':  // Print character
+					put_char((char)va_arg(args, int));
+					break;
+				case 's': {  // Print string
+					const char *str = va_arg(args, const char*);
+					while (*str)
+						put_char(*str++);
+					break;
+				}
+				case 'f':  // Print float
+					put_float(va_arg(args, double));
+					break;
+				case '\0':  // Lone '%' at the end
+					format--;
+					break;
+				default:
+					break;
+			}
+		} else {
+			// Print regular character if not a format specifier
+			put_char(*format);
+		}
+		format++;
+	}
+
+	va_end(args);
+
+	if (overflow > 0) {
+		dropped += staged + overflow;
+		overflow = 0;
+	} else {
+		ring_commit(&tx, staged);
+	}
+	staged = 0;
+
+	kick();
+	PROFILE_END(print);
+}
+
+bool print_write(const void *data, uint32_t len) {
+	if (len > PRINT_BUFFER_SIZE) {
+		dropped += len;
+		return false;
+	}
+	while (!ring_write(&tx, data, len)) {
+#if PRINT_FULL_POLICY == PRINT_FULL_BLOCK
+		kick();
+#else
+		dropped += len;
+		return false;
+#endif
+	}
+
+	kick();
+	return true;
+}
+
+bool print_flush(void) {
+	/* Longest a full buffer takes on the wire, 10 bits per byte, and some slack */
+	uint32_t timeout_ms = PRINT_BUFFER_SIZE * 10000ULL / huart3.Init.BaudRate + PRINT_FLUSH_SLACK_MS;
+	uint32_t head = tx.head;
+	uint32_t start = HAL_GetTick();
+
+	while (!ring_empty(&tx)) {
+		/* Retries a transmit that failed to start */
+		kick();
+		if (tx.head != head) {
+			head = tx.head;
+			start = HAL_GetTick();
+		} else if (HAL_GetTick() - start > timeout_ms) {
+			return false;
+		}
+	}
+	return true;
+}
+
+uint32_t print_dropped(void) {
+	return dropped;
+}
+
+/* Called by the HAL once a chunk has been sent, overrides the weak default */
+ITCM_TEXT void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+	if (huart != &huart3)
+		return;
+
+	ring_release(&tx, sending);
+	sending = 0;
+	start_transmit();
+}
+
+ITCM_TEXT void USART3_IRQHandler(void) {
+	HAL_UART_IRQHandler(&huart3);
+}
+
+#if PRINT_USE_DMA
+void DMA1_Stream2_IRQHandler(void) {
+	HAL_DMA_IRQHandler(&hdma_usart3_tx);
+}
+#endif
@@ -0,0 +1,197 @@
+#include <string.h>
+#include "denoise.h"
+#include "sections.h"
+#include "stm32h7xx_hal.h"
+
+#define EMA_FRACTION 4
+
+bool denoise_init(denoise *d, denoise_mode mode, uint8_t shift)
+{
+	memset(d, 0, sizeof(*d));
+	if ((mode == DENOISE_EMA || mode == DENOISE_BOXCAR) && (shift < 1 || shift > DENOISE_MAX_SHIFT))
+		return false;
+	d->mode = mode;
+	d->shift = shift;
+	return true;
+}
+
+const char *denoise_name(denoise_mode mode)
+{
+	switch (mode)
+	{
+	case DENOISE_EMA:
+		return "ema";
+	case DENOISE_BOXCAR:
+		return "boxcar";
+	case DENOISE_MEDIAN3:
+		return "median3";
+	default:
+		return "off";
+	}
+}
+
+static void start(denoise *d, const int16_t *frame)
+{
+	int history = d->mode == DENOISE_BOXCAR ? 1 << d->shift : 2;
+	for (int h = 0; h < history; h++)
+		memcpy(d->history[h], frame, sizeof(d->history[h]));
+	for (int i = 0; i < DENOISE_PIXELS; i++)
+	{
+		if (d->mode == DENOISE_EMA)
+			d->state[i] = frame[i] * (1 << EMA_FRACTION);
+		else if (d->mode == DENOISE_BOXCAR)
+			d->state[i] = frame[i] * (1 << d->shift);
+	}
+	d->head = 0;
+	d->started = true;
+}
+
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+/* Rounded arithmetic shift right of both halves, the results must fit 16 - shift bits */
+static inline uint32_t shift_pair(uint32_t pair, uint32_t shift)
+{
+	uint32_t half = (1u << shift >> 1) * 0x00010001;
+	uint32_t mask = (0xFFFFu >> shift) * 0x00010001;
+	uint32_t sign = (0x8000u >> shift) * 0x00010001;
+	pair = ((uint32_t)((int32_t)__SADD16(pair, half) >> shift) & mask) ^ sign;
+	return __USUB16(pair, sign);
+}
+#endif
+
+static inline int16_t shift_rounded(int32_t value, uint32_t shift)
+{
+	return (value + (1 << shift >> 1)) >> shift;
+}
+
+/*
+ * state += (frame - state) / 2^shift, as shift halving adds of state and the
+ * new value, so it works on packed pairs without multiplies.
+ */
+ITCM_TEXT static void ema(denoise *d, int16_t *frame)
+{
+	uint32_t shift = d->shift;
+	int i = 0;
+
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+	for (; i < DENOISE_PIXELS; i += 2)
+	{
+		uint32_t pair, state;
+		memcpy(&pair, &frame[i], sizeof(pair));
+		memcpy(&state, &d->state[i], sizeof(state));
+		/* Both 12 bit pixels up by 4 bits, the low one's sign bits masked out of the high one */
+		uint32_t value = (pair << EMA_FRACTION) & 0xFFF0FFF0;
+		for (uint32_t k = 0; k < shift; k++)
+			value = __SHADD16(state, value);
+		memcpy(&d->state[i], &value, sizeof(value));
+		pair = shift_pair(value, EMA_FRACTION);
+		memcpy(&frame[i], &pair, sizeof(pair));
+	}
+#endif
+	for (; i < DENOISE_PIXELS; i++)
+	{
+		int32_t value = frame[i] * (1 << EMA_FRACTION);
+		for (uint32_t k = 0; k < shift; k++)
+			value = (d->state[i] + value) >> 1;
+		d->state[i] = value;
+		frame[i] = shift_rounded(value, EMA_FRACTION);
+	}
+}
+
+/* Running sums of the last 2^shift frames, the oldest replaced by the new one */
+ITCM_TEXT static void boxcar(denoise *d, int16_t *frame)
+{
+	uint32_t shift = d->shift;
+	int16_t *oldest = d->history[d->head];
+	int i = 0;
+
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+	for (; i < DENOISE_PIXELS; i += 2)
+	{
+		uint32_t pair, sum, old;
+		memcpy(&pair, &frame[i], sizeof(pair));
+		memcpy(&sum, &d->state[i], sizeof(sum));
+		memcpy(&old, &oldest[i], sizeof(old));
+		memcpy(&oldest[i], &pair, sizeof(pair));
+		sum = __SSUB16(__SADD16(sum, pair), old);
+		memcpy(&d->state[i], &sum, sizeof(sum));
+		pair = shift_pair(sum, shift);
+		memcpy(&frame[i], &pair, sizeof(pair));
+	}
+#endif
+	for (; i < DENOISE_PIXELS; i++)
+	{
+		d->state[i] += frame[i] - oldest[i];
+		oldest[i] = frame[i];
+		frame[i] = shift_rounded(d->state[i], shift);
+	}
+	d->head = (d->head + 1) & ((1 << shift) - 1);
+}
+
+static inline int16_t median(int16_t a, int16_t b, int16_t c)
+{
+	int16_t low = a < b ? a : b;
+	int16_t high = a < b ? b : a;
+	int16_t mid = high < c ? high : c;
+	return low > mid ? low : mid;
+}
+
+/* max(min(a, b), min(max(a, b), c)) of the last two frames and the new one */
+ITCM_TEXT static void median3(denoise *d, int16_t *frame)
+{
+	int16_t *older = d->history[d->head];
+	int16_t *newer = d->history[d->head ^ 1];
+	int i = 0;
+
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+	for (; i < DENOISE_PIXELS; i += 2)
+	{
+		uint32_t a, b, c;
+		memcpy(&a, &older[i], sizeof(a));
+		memcpy(&b, &newer[i], sizeof(b));
+		memcpy(&c, &frame[i], sizeof(c));
+		memcpy(&older[i], &c, sizeof(c));
+		/* SSUB16 sets the GE flags of the halves where the first is >= the second */
+		__SSUB16(a, b);
+		uint32_t low = __SEL(b, a);
+		uint32_t high = __SEL(a, b);
+		__SSUB16(high, c);
+		uint32_t mid = __SEL(c, high);
+		__SSUB16(low, mid);
+		uint32_t pair = __SEL(low, mid);
+		memcpy(&frame[i], &pair, sizeof(pair));
+	}
+#endif
+	for (; i < DENOISE_PIXELS; i++)
+	{
+		int16_t value = frame[i];
+		frame[i] = median(older[i], newer[i], value);
+		older[i] = value;
+	}
+	d->head ^= 1;
+}
+
+ITCM_TEXT void denoise_apply(denoise *d, int16_t frame[DENOISE_PIXELS])
+{
+	if (d->mode == DENOISE_OFF)
+		return;
+	if (!d->started)
+	{
+		start(d, frame);
+		return;
+	}
+
+	switch (d->mode)
+	{
+	case DENOISE_EMA:
+		ema(d, frame);
+		break;
+	case DENOISE_BOXCAR:
+		boxcar(d, frame);
+		break;
+	case DENOISE_MEDIAN3:
+		median3(d, frame);
+		break;
+	default:
+		break;
+	}
+}
@@ -0,0 +1,109 @@
+#include <string.h>
+#include "flash_store.h"
+#include "cache.h"
+
+/*
+ * Bitwise, since records are only checked at startup and after writing. The
+ * CRC unit stays set up for telemetry.c.
+ */
+static uint32_t crc32(const uint8_t *data, uint32_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+const void *flash_store_data(const flash_store *store, uint32_t length)
+{
+	const flash_store_header *header = (const flash_store_header *)store->address;
+	const uint8_t *data = (const uint8_t *)(store->address + FLASH_STORE_WORD);
+
+	if (header->magic != store->magic || header->version != store->version ||
+			header->length != length || length > FLASH_STORE_MAX_LENGTH)
+		return NULL;
+	if (crc32(data, length) != header->crc)
+		return NULL;
+	return data;
+}
+
+bool flash_store_read(const flash_store *store, void *data, uint32_t length)
+{
+	const void *stored = flash_store_data(store, length);
+	if (stored == NULL)
+		return false;
+	memcpy(data, stored, length);
+	return true;
+}
+
+static bool erase(const flash_store *store)
+{
+	uint32_t offset = store->address - FLASH_BANK1_BASE;
+	FLASH_EraseInitTypeDef erase = {
+		.TypeErase = FLASH_TYPEERASE_SECTORS,
+		.Banks = offset >= FLASH_BANK_SIZE ? FLASH_BANK_2 : FLASH_BANK_1,
+		.Sector = (offset % FLASH_BANK_SIZE) / FLASH_SECTOR_SIZE,
+		.NbSectors = 1,
+		.VoltageRange = FLASH_VOLTAGE_RANGE_3,
+	};
+	uint32_t error = 0;
+	return HAL_FLASHEx_Erase(&erase, &error) == HAL_OK;
+}
+
+/* The flash is cached, drop what was read before the sector changed */
+static void invalidate(const flash_store *store)
+{
+	cache_invalidate((void *)store->address, FLASH_SECTOR_SIZE);
+}
+
+bool flash_store_erase(const flash_store *store)
+{
+	HAL_FLASH_Unlock();
+	bool ok = erase(store);
+	HAL_FLASH_Lock();
+	invalidate(store);
+	return ok;
+}
+
+bool flash_store_write(const flash_store *store, const void *data, uint32_t length)
+{
+	if (length > FLASH_STORE_MAX_LENGTH)
+		return false;
+
+	/* Flash words are programmed from RAM, the last one padded like erased flash */
+	uint32_t word[FLASH_STORE_WORD / 4];
+	const uint8_t *bytes = data;
+
+	HAL_FLASH_Unlock();
+	bool ok = erase(store);
+	for (uint32_t offset = 0; ok && offset < length; offset += FLASH_STORE_WORD)
+	{
+		uint32_t n = length - offset < FLASH_STORE_WORD ? length - offset : FLASH_STORE_WORD;
+		memset(word, 0xFF, sizeof(word));
+		memcpy(word, &bytes[offset], n);
+		ok = HAL_FLASH_Program(FLASH_TYPEPROGRAM_FLASHWORD,
+				store->address + FLASH_STORE_WORD + offset, (uintptr_t)word) == HAL_OK;
+	}
+
+	if (ok)
+	{
+		flash_store_header header = {
+			.magic = store->magic,
+			.version = store->version,
+			.reserved = 0xFFFF,
+			.length = length,
+			.crc = crc32(bytes, length),
+		};
+		memset(word, 0xFF, sizeof(word));
+		memcpy(word, &header, sizeof(header));
+		ok = HAL_FLASH_Program(FLASH_TYPEPROGRAM_FLASHWORD, store->address, (uintptr_t)word) == HAL_OK;
+	}
+	HAL_FLASH_Lock();
+	invalidate(store);
+
+	return ok && flash_store_data(store, length) != NULL;
+}
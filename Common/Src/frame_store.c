@@ -0,0 +1,107 @@
+#include <string.h>
+#include "frame_store.h"
+#include "irq.h"
+#include "sections.h"
+
+static int8_t index_of(const frame_store *store, const frame *f)
+{
+	return (int8_t)(f - store->frames);
+}
+
+bool frame_store_init(frame_store *store, void *storage, uint32_t frame_size, uint32_t count)
+{
+	if (count < 2 || count > FRAME_STORE_MAX_FRAMES)
+		return false;
+
+	memset(store, 0, sizeof(*store));
+	store->count = count;
+	store->latest = -1;
+	store->filling = -1;
+	for (uint32_t i = 0; i < count; i++)
+		store->frames[i].data = (uint8_t *)storage + i * frame_size;
+	return true;
+}
+
+ITCM_TEXT frame *frame_store_acquire(frame_store *store)
+{
+	frame *f = NULL;
+
+	uint32_t primask = irq_save();
+	if (store->filling < 0)
+	{
+		for (uint32_t i = 0; i < store->count; i++)
+		{
+			if ((int8_t)i != store->latest && store->borrows[i] == 0)
+			{
+				store->filling = (int8_t)i;
+				f = &store->frames[i];
+				break;
+			}
+		}
+	}
+	if (f == NULL)
+		store->stats.overruns++;
+	irq_restore(primask);
+	return f;
+}
+
+ITCM_TEXT void frame_store_publish(frame_store *store, frame *f)
+{
+	int8_t i = index_of(store, f);
+
+	uint32_t primask = irq_save();
+	if (store->latest >= 0 && !store->seen[store->latest])
+		store->stats.dropped++;
+	f->seq = ++store->seq;
+	store->seen[i] = false;
+	store->latest = i;
+	store->filling = -1;
+	store->stats.published++;
+	irq_restore(primask);
+}
+
+ITCM_TEXT void frame_store_abandon(frame_store *store, frame *f)
+{
+	(void)f;
+	uint32_t primask = irq_save();
+	store->filling = -1;
+	irq_restore(primask);
+}
+
+const frame *frame_store_borrow(frame_store *store, uint32_t last_seq)
+{
+	const frame *f = NULL;
+
+	uint32_t primask = irq_save();
+	int8_t i = store->latest;
+	if (i >= 0 && (int32_t)(store->frames[i].seq - last_seq) > 0)
+	{
+		store->borrows[i]++;
+		store->seen[i] = true;
+		f = &store->frames[i];
+	}
+	irq_restore(primask);
+	return f;
+}
+
+void frame_store_release(frame_store *store, const frame *f)
+{
+	uint32_t primask = irq_save();
+	store->borrows[index_of(store, f)]--;
+	irq_restore(primask);
+}
+
+uint32_t frame_store_latest_seq(const frame_store *store)
+{
+	/* A single word, read atomically */
+	int8_t i = store->latest;
+	return i >= 0 ? store->frames[i].seq : 0;
+}
+
+void frame_store_get_stats(const frame_store *store, frame_store_stats *stats)
+{
+	/* Copy, so the numbers are consistent with each other */
+	uint32_t primask = irq_save();
+	*stats = store->stats;
+	irq_restore(primask);
+}
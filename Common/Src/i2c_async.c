@@ -0,0 +1,228 @@
+#include <stddef.h>
+#include <string.h>
+#include "i2c_async.h"
+#include "cache.h"
+#include "ring.h"
+#include "irq.h"
+#include "sections.h"
+
+void Error_Handler();
+
+#if I2C_ASYNC_USE_DMA
+#define I2C_MASTER_TRANSMIT HAL_I2C_Master_Transmit_DMA
+#define I2C_MASTER_RECEIVE  HAL_I2C_Master_Receive_DMA
+#define I2C_MEM_READ        HAL_I2C_Mem_Read_DMA
+#else
+#define I2C_MASTER_TRANSMIT HAL_I2C_Master_Transmit_IT
+#define I2C_MASTER_RECEIVE  HAL_I2C_Master_Receive_IT
+#define I2C_MEM_READ        HAL_I2C_Mem_Read_IT
+#endif
+
+static I2C_HandleTypeDef *handle;
+
+/* Pending transactions, submitted by the main loop and started by the interrupt */
+static i2c_transaction *queue_storage[I2C_ASYNC_QUEUE_LENGTH];
+static ring queue = RING_INIT(queue_storage, I2C_ASYNC_QUEUE_LENGTH, sizeof(i2c_transaction *));
+
+/* Transaction currently on the bus */
+static i2c_transaction *volatile current;
+
+#if I2C_ASYNC_USE_DMA
+static DMA_HandleTypeDef hdma_i2c_rx;
+static DMA_HandleTypeDef hdma_i2c_tx;
+
+/* Bounce buffers for the transaction on the bus */
+static uint8_t dma_tx[I2C_ASYNC_DMA_BUFFER_SIZE] DMA_BUFFER;
+static uint8_t dma_rx[I2C_ASYNC_DMA_BUFFER_SIZE] DMA_BUFFER;
+
+static void dma_init(DMA_HandleTypeDef *hdma, DMA_Stream_TypeDef *stream,
+		uint32_t request, uint32_t direction)
+{
+	hdma->Instance = stream;
+	hdma->Init.Request = request;
+	hdma->Init.Direction = direction;
+	hdma->Init.PeriphInc = DMA_PINC_DISABLE;
+	hdma->Init.MemInc = DMA_MINC_ENABLE;
+	hdma->Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+	hdma->Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+	hdma->Init.Mode = DMA_NORMAL;
+	hdma->Init.Priority = DMA_PRIORITY_LOW;
+	hdma->Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+	if (HAL_DMA_Init(hdma) != HAL_OK)
+	{
+		Error_Handler();
+	}
+}
+#endif
+
+static ITCM_TEXT HAL_StatusTypeDef start(i2c_transaction *t)
+{
+	uint16_t addr = t->addr << 1;
+	uint8_t *tx = (uint8_t *)t->tx;
+	uint8_t *rx = t->rx;
+
+#if I2C_ASYNC_USE_DMA
+	if (t->tx_len > sizeof(dma_tx) || t->rx_len > sizeof(dma_rx))
+		return HAL_ERROR;
+	/* A register address goes out as part of the request, not through DMA */
+	if (t->rx_len == 0)
+	{
+		memcpy(dma_tx, t->tx, t->tx_len);
+		cache_clean(dma_tx, t->tx_len);
+		tx = dma_tx;
+	}
+	rx = dma_rx;
+#endif
+
+	if (t->rx_len == 0)
+		return I2C_MASTER_TRANSMIT(handle, addr, tx, t->tx_len);
+	if (t->tx_len == 0)
+		return I2C_MASTER_RECEIVE(handle, addr, rx, t->rx_len);
+	/* Register address write, repeated start, then read */
+	if (t->tx_len == 1)
+		return I2C_MEM_READ(handle, addr, t->tx[0], I2C_MEMADD_SIZE_8BIT, rx, t->rx_len);
+	if (t->tx_len == 2)
+		return I2C_MEM_READ(handle, addr, (t->tx[0] << 8) | t->tx[1], I2C_MEMADD_SIZE_16BIT, rx, t->rx_len);
+	return HAL_ERROR;
+}
+
+static ITCM_TEXT void finish(i2c_transaction *t, uint32_t error)
+{
+#if I2C_ASYNC_USE_DMA
+	if (error == HAL_I2C_ERROR_NONE && t->rx_len > 0)
+	{
+		cache_invalidate(dma_rx, t->rx_len);
+		memcpy(t->rx, dma_rx, t->rx_len);
+	}
+#endif
+	current = NULL;
+	t->error = error;
+	t->done = true;
+	if (t->callback)
+		t->callback(t);
+}
+
+/* Must be called with interrupts disabled or from the I2C interrupt */
+static ITCM_TEXT void start_next(void)
+{
+	i2c_transaction *t;
+	while (current == NULL && ring_pop(&queue, &t))
+	{
+		current = t;
+		if (start(t) != HAL_OK)
+		{
+			uint32_t error = HAL_I2C_GetError(handle);
+			finish(t, error != HAL_I2C_ERROR_NONE ? error : I2C_ASYNC_ERROR_START);
+		}
+	}
+}
+
+static ITCM_TEXT void complete(I2C_HandleTypeDef *hi2c, uint32_t error)
+{
+	if (hi2c != handle || current == NULL)
+		return;
+
+	finish(current, error);
+	start_next();
+}
+
+void i2c_async_init(I2C_HandleTypeDef *hi2c)
+{
+	handle = hi2c;
+	ring_init(&queue, queue_storage, I2C_ASYNC_QUEUE_LENGTH, sizeof(i2c_transaction *));
+	current = NULL;
+
+#if I2C_ASYNC_USE_DMA
+	__HAL_RCC_DMA1_CLK_ENABLE();
+	dma_init(&hdma_i2c_rx, DMA1_Stream0, DMA_REQUEST_I2C2_RX, DMA_PERIPH_TO_MEMORY);
+	dma_init(&hdma_i2c_tx, DMA1_Stream1, DMA_REQUEST_I2C2_TX, DMA_MEMORY_TO_PERIPH);
+	__HAL_LINKDMA(hi2c, hdmarx, hdma_i2c_rx);
+	__HAL_LINKDMA(hi2c, hdmatx, hdma_i2c_tx);
+
+	HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, 5, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+	HAL_NVIC_SetPriority(DMA1_Stream1_IRQn, 5, 0);
+	HAL_NVIC_EnableIRQ(DMA1_Stream1_IRQn);
+#endif
+
+	HAL_NVIC_SetPriority(I2C2_EV_IRQn, 5, 0);
+	HAL_NVIC_EnableIRQ(I2C2_EV_IRQn);
+	HAL_NVIC_SetPriority(I2C2_ER_IRQn, 5, 0);
+	HAL_NVIC_EnableIRQ(I2C2_ER_IRQn);
+}
+
+bool i2c_async_submit(i2c_transaction *t)
+{
+	t->done = false;
+	t->error = HAL_I2C_ERROR_NONE;
+
+	/* Callbacks may submit follow-up transactions, keep them out meanwhile */
+	uint32_t primask = irq_save();
+	if (!ring_push(&queue, &t))
+	{
+		irq_restore(primask);
+		return false;
+	}
+	start_next();
+	irq_restore(primask);
+	return true;
+}
+
+bool i2c_async_busy(void)
+{
+	return current != NULL || !ring_empty(&queue);
+}
+
+void i2c_async_wait(i2c_transaction *t)
+{
+	while (!t->done) {}
+}
+
+/* HAL completion callbacks, these override the weak defaults */
+ITCM_TEXT void HAL_I2C_MasterTxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	complete(hi2c, HAL_I2C_ERROR_NONE);
+}
+
+ITCM_TEXT void HAL_I2C_MasterRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	complete(hi2c, HAL_I2C_ERROR_NONE);
+}
+
+ITCM_TEXT void HAL_I2C_MemRxCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	complete(hi2c, HAL_I2C_ERROR_NONE);
+}
+
+void HAL_I2C_ErrorCallback(I2C_HandleTypeDef *hi2c)
+{
+	complete(hi2c, HAL_I2C_GetError(hi2c));
+}
+
+void HAL_I2C_AbortCpltCallback(I2C_HandleTypeDef *hi2c)
+{
+	complete(hi2c, HAL_I2C_GetError(hi2c));
+}
+
+/* The sensors are connected to I2C2 */
+ITCM_TEXT void I2C2_EV_IRQHandler(void)
+{
+	HAL_I2C_EV_IRQHandler(handle);
+}
+
+void I2C2_ER_IRQHandler(void)
+{
+	HAL_I2C_ER_IRQHandler(handle);
+}
+
+#if I2C_ASYNC_USE_DMA
+void DMA1_Stream0_IRQHandler(void)
+{
+	HAL_DMA_IRQHandler(&hdma_i2c_rx);
+}
+
+void DMA1_Stream1_IRQHandler(void)
+{
+	HAL_DMA_IRQHandler(&hdma_i2c_tx);
+}
+#endif
@@ -0,0 +1,286 @@
+#include <stddef.h>
+#include "i2c_stub.h"
+#include "i2c_async.h"
+#include "profile.h"
+#include "clock.h"
+
+void Error_Handler();
+
+/* Private macro -------------------------------------------------------------*/
+/* Private variables ---------------------------------------------------------*/
+/* I2C handler declaration */
+I2C_HandleTypeDef I2cHandle;
+
+void I2C_MspInit()
+{
+	GPIO_InitTypeDef GPIO_InitStruct = {0};
+	RCC_PeriphCLKInitTypeDef PeriphClkInitStruct = {0};
+	/* USER CODE BEGIN I2C2_MspInit 0 */
+
+	/* USER CODE END I2C2_MspInit 0 */
+
+	/** Initializes the peripherals clock
+	*/
+	/* PLL3R from clock_init(), which doesn't change with the core clock */
+	if (__HAL_RCC_GET_FLAG(RCC_FLAG_PLL3RDY))
+	{
+		__HAL_RCC_I2C123_CONFIG(RCC_I2C123CLKSOURCE_PLL3);
+	}
+	else
+	{
+		PeriphClkInitStruct.PeriphClockSelection = RCC_PERIPHCLK_I2C2;
+		PeriphClkInitStruct.I2c123ClockSelection = RCC_I2C123CLKSOURCE_D2PCLK1;
+		if (HAL_RCCEx_PeriphCLKConfig(&PeriphClkInitStruct) != HAL_OK)
+		{
+			Error_Handler();
+		}
+	}
+
+	__HAL_RCC_GPIOF_CLK_ENABLE();
+	/**I2C2 GPIO Configuration
+	PF0         ------> I2C2_SDA
+	PF1         ------> I2C2_SCL
+	*/
+	GPIO_InitStruct.Pin = GPIO_PIN_0|GPIO_PIN_1;
+	GPIO_InitStruct.Mode = GPIO_MODE_AF_OD;
+	GPIO_InitStruct.Pull = GPIO_NOPULL;
+	GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+	GPIO_InitStruct.Alternate = GPIO_AF4_I2C2;
+	HAL_GPIO_Init(GPIOF, &GPIO_InitStruct);
+
+	/* Peripheral clock enable */
+	__HAL_RCC_I2C2_CLK_ENABLE();
+	/* USER CODE BEGIN I2C2_MspInit 1 */
+
+	/* USER CODE END I2C2_MspInit 1 */
+}
+
+/* Bus timing limits from the I2C specification, in ns */
+typedef struct {
+	uint32_t scl_hz;
+	uint32_t low_min;
+	uint32_t high_min;
+	uint32_t su_dat_min;
+	uint32_t rise_max;
+	uint32_t fall_max;
+} i2c_mode;
+
+static const i2c_mode modes[] = {
+	{  100000, 4700, 4000, 250, 1000, 300 }, /* Standard-mode */
+	{  400000, 1300,  600, 100,  300, 300 }, /* Fast-mode */
+	{ 1000000,  500,  260,  50,  120, 120 }, /* Fast-mode Plus */
+};
+
+/* Minimum analog filter delay */
+#define I2C_FILTER_DELAY_NS 50
+
+static uint32_t kernel_clock(void)
+{
+	if (__HAL_RCC_GET_I2C123_SOURCE() == RCC_I2C123CLKSOURCE_PLL3)
+		return CLOCK_PLL3R_HZ;
+	return HAL_RCC_GetPCLK1Freq();
+}
+
+/* Prescaled clock periods covering ns, rounded up */
+static uint32_t periods(uint32_t ns, uint32_t clock, uint32_t presc)
+{
+	uint64_t div = 1000000000ULL * (presc + 1);
+	return (uint32_t)(((uint64_t)ns * clock + div - 1) / div);
+}
+
+/*
+ * TIMINGR value for an SCL frequency. SCL low and high times get the minimum
+ * of the mode plus an even share of what is left of the period after rise and
+ * fall times, with the smallest prescaler that fits. With a slow kernel clock
+ * the bus gets slower than requested, 0 means the clock is too fast to fit.
+ */
+static uint32_t compute_timing(uint32_t clock, uint32_t scl_hz)
+{
+	const i2c_mode *mode = &modes[0];
+	while (mode->scl_hz < scl_hz && mode < &modes[sizeof(modes) / sizeof(modes[0]) - 1])
+		mode++;
+
+	uint32_t period = 1000000000U / scl_hz;
+	uint32_t fixed = mode->low_min + mode->high_min + mode->rise_max + mode->fall_max;
+	uint32_t slack = period > fixed ? period - fixed : 0;
+	uint32_t low = mode->low_min + slack / 2;
+	uint32_t high = mode->high_min + slack / 2;
+
+	/* Data hold time after SCL falls, beyond what the filter and sync add */
+	uint32_t sync = 3 * (1000000000U / clock) + I2C_FILTER_DELAY_NS;
+	uint32_t hold = mode->fall_max > sync ? mode->fall_max - sync : 0;
+
+	for (uint32_t presc = 0; presc < 16; presc++)
+	{
+		uint32_t scll = periods(low, clock, presc);
+		uint32_t sclh = periods(high, clock, presc);
+		uint32_t scldel = periods(mode->rise_max + mode->su_dat_min, clock, presc);
+		uint32_t sdadel = periods(hold, clock, presc);
+
+		if (scll > 256 || sclh > 256 || scldel > 16 || sdadel > 15)
+			continue;
+
+		return (presc << I2C_TIMINGR_PRESC_Pos) |
+				((scldel - 1) << I2C_TIMINGR_SCLDEL_Pos) |
+				(sdadel << I2C_TIMINGR_SDADEL_Pos) |
+				((sclh - 1) << I2C_TIMINGR_SCLH_Pos) |
+				((scll - 1) << I2C_TIMINGR_SCLL_Pos);
+	}
+	return 0;
+}
+
+/* Kernel clock the current Timing value was computed for */
+static uint32_t timing_clock;
+
+/* Clock change listener, only does something if I2C2 runs from PCLK1 */
+static void clock_changed(clock_event event)
+{
+	if (event != CLOCK_CHANGED)
+		return;
+
+	uint32_t clock = kernel_clock();
+	if (clock == timing_clock)
+		return;
+
+	uint32_t timing = compute_timing(clock, I2C_SPEED_HZ);
+	if (timing == 0)
+		return;
+
+	while (i2c_async_busy()) {}
+	__HAL_I2C_DISABLE(&I2cHandle);
+	I2cHandle.Instance->TIMINGR = timing;
+	I2cHandle.Init.Timing = timing;
+	__HAL_I2C_ENABLE(&I2cHandle);
+	timing_clock = clock;
+}
+
+void i2c_begin()
+{
+	I2C_MspInit();
+
+	/* USER CODE BEGIN I2C2_Init 0 */
+
+	/* USER CODE END I2C2_Init 0 */
+
+	/* USER CODE BEGIN I2C2_Init 1 */
+
+	/* USER CODE END I2C2_Init 1 */
+	I2cHandle.Instance = I2C2;
+	timing_clock = kernel_clock();
+	I2cHandle.Init.Timing = compute_timing(timing_clock, I2C_SPEED_HZ);
+	if (I2cHandle.Init.Timing == 0)
+	{
+		Error_Handler();
+	}
+	I2cHandle.Init.OwnAddress1 = 0;
+	I2cHandle.Init.AddressingMode = I2C_ADDRESSINGMODE_7BIT;
+	I2cHandle.Init.DualAddressMode = I2C_DUALADDRESS_DISABLE;
+	I2cHandle.Init.OwnAddress2 = 0;
+	I2cHandle.Init.OwnAddress2Masks = I2C_OA2_NOMASK;
+	I2cHandle.Init.GeneralCallMode = I2C_GENERALCALL_DISABLE;
+	I2cHandle.Init.NoStretchMode = I2C_NOSTRETCH_DISABLE;
+	if (HAL_I2C_Init(&I2cHandle) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	/** Configure Analogue filter
+	*/
+	if (HAL_I2CEx_ConfigAnalogFilter(&I2cHandle, I2C_ANALOGFILTER_ENABLE) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	/** Configure Digital filter
+	*/
+	if (HAL_I2CEx_ConfigDigitalFilter(&I2cHandle, 0) != HAL_OK)
+	{
+		Error_Handler();
+	}
+	/* USER CODE BEGIN I2C2_Init 2 */
+	i2c_async_init(&I2cHandle);
+	clock_add_listener(clock_changed);
+	/* USER CODE END I2C2_Init 2 */
+}
+
+/* Error of the last transfer, checked by i2c_endTransmission() */
+static uint32_t last_error = HAL_I2C_ERROR_NONE;
+
+/*
+ * Run a transaction through the asynchronous engine and wait for it to finish.
+ * A missing acknowledge is reported through i2c_endTransmission(), any other
+ * bus error is fatal.
+ */
+static uint32_t i2c_transfer(uint8_t addr, const uint8_t *tx, uint16_t tx_len,
+		uint8_t *rx, uint16_t rx_len)
+{
+	PROFILE_BEGIN(transfer, "i2c_transfer");
+	i2c_transaction t = {
+		.addr = addr,
+		.tx = tx,
+		.tx_len = tx_len,
+		.rx = rx,
+		.rx_len = rx_len,
+	};
+
+	while (!i2c_async_submit(&t)) {}
+	i2c_async_wait(&t);
+
+	last_error = t.error;
+	if (t.error != HAL_I2C_ERROR_NONE && t.error != HAL_I2C_ERROR_AF)
+		Error_Handler();
+	PROFILE_END(transfer);
+	return t.error;
+}
+
+/* TODO: sendStop */
+uint8_t i2c_endTransmission(bool sendStop)
+{
+	/* Wait for the end of the transfer */
+	while (i2c_async_busy()) {}
+	/* Did acknowledge failure occur? */
+	return (last_error == HAL_I2C_ERROR_AF);
+}
+
+uint8_t i2c_read(uint8_t addr)
+{
+	uint8_t data = 0;
+	i2c_transfer(addr, NULL, 0, &data, sizeof(data));
+	return data;
+}
+
+uint16_t i2c_read2(uint8_t addr)
+{
+	uint16_t data = 0;
+	i2c_transfer(addr, NULL, 0, (uint8_t *)&data, sizeof(data));
+	return data;
+}
+
+uint32_t i2c_write(uint8_t addr, uint8_t data)
+{
+	return i2c_transfer(addr, &data, sizeof(data), NULL, 0);
+}
+
+uint32_t i2c_write2(uint8_t addr, uint8_t data1, uint8_t data2)
+{
+	uint8_t data[2];
+	data[0] = data1;
+	data[1] = data2;
+	return i2c_transfer(addr, data, sizeof(data), NULL, 0);
+}
+
+/*
+ * Read len bytes starting at register reg in a single transfer: the register
+ * address is written, followed by a repeated start and the read, so devices
+ * with address auto-increment return consecutive registers in one go.
+ */
+uint32_t i2c_memRead(uint8_t addr, uint8_t reg, uint8_t *data, uint16_t len)
+{
+	return i2c_transfer(addr, &reg, sizeof(reg), data, len);
+}
+
+bool i2c_deviceReady(uint8_t addr) {
+	/* Polling the address is blocking, so let queued transfers finish first */
+	while (i2c_async_busy()) {}
+	return HAL_I2C_IsDeviceReady(&I2cHandle, (addr << 1), 1, 1000) != HAL_OK;
+}
@@ -0,0 +1,237 @@
+#include <math.h>
+#include <string.h>
+#include "nuc.h"
+#include "sections.h"
+#include "stm32h7xx_hal.h"
+
+void nuc_table_identity(nuc_table *table, uint16_t width, uint16_t height)
+{
+	memset(table, 0, sizeof(*table));
+	table->width = width;
+	table->height = height;
+	for (int i = 0; i < NUC_MAX_PIXELS; i++)
+		table->gain[i] = NUC_GAIN_ONE;
+}
+
+void nuc_capture_begin(nuc_capture *capture)
+{
+	memset(capture, 0, sizeof(*capture));
+}
+
+void nuc_capture_add(nuc_capture *capture, const int16_t *frame, uint16_t pixels)
+{
+	if (capture->frames == 0)
+		memcpy(capture->first, frame, pixels * sizeof(frame[0]));
+	for (uint16_t i = 0; i < pixels; i++)
+	{
+		int32_t d = frame[i] - capture->first[i];
+		capture->sum[i] += frame[i];
+		capture->square_sum[i] += d * d;
+	}
+	capture->frames++;
+}
+
+/* Mean of each pixel, and mark the ones off the median or too noisy */
+static void capture_means(const nuc_capture *capture, uint16_t pixels, float *mean, uint8_t *dead)
+{
+	float sorted[NUC_MAX_PIXELS];
+
+	for (uint16_t i = 0; i < pixels; i++)
+	{
+		mean[i] = (float)capture->sum[i] / capture->frames;
+		float d = mean[i] - capture->first[i];
+		float var = (float)capture->square_sum[i] / capture->frames - d * d;
+		if (var > NUC_DEAD_NOISE * NUC_DEAD_NOISE)
+			dead[i] = 1;
+
+		/* Insertion sort, for the median */
+		uint16_t j = i;
+		for (; j > 0 && sorted[j - 1] > mean[i]; j--)
+			sorted[j] = sorted[j - 1];
+		sorted[j] = mean[i];
+	}
+
+	float median = sorted[pixels / 2];
+	for (uint16_t i = 0; i < pixels; i++)
+	{
+		if (fabsf(mean[i] - median) > NUC_DEAD_DEVIATION)
+			dead[i] = 1;
+	}
+}
+
+/* Average of the good pixels' means, the temperature of the target */
+static float reference(const float *mean, const uint8_t *dead, uint16_t pixels)
+{
+	float sum = 0;
+	uint16_t good = 0;
+	for (uint16_t i = 0; i < pixels; i++)
+	{
+		if (!dead[i])
+		{
+			sum += mean[i];
+			good++;
+		}
+	}
+	return good ? sum / good : 0;
+}
+
+static int16_t round16(float value)
+{
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	if (value < INT16_MIN)
+		return INT16_MIN;
+	return (int16_t)lroundf(value);
+}
+
+bool nuc_compute(nuc_table *table, uint16_t width, uint16_t height,
+		const nuc_capture *cold, const nuc_capture *warm)
+{
+	uint16_t pixels = width * height;
+	float cold_mean[NUC_MAX_PIXELS];
+	float warm_mean[NUC_MAX_PIXELS];
+
+	if (pixels == 0 || pixels > NUC_MAX_PIXELS || cold->frames == 0 || (warm && warm->frames == 0))
+		return false;
+
+	nuc_table_identity(table, width, height);
+	capture_means(cold, pixels, cold_mean, table->dead);
+	if (warm)
+		capture_means(warm, pixels, warm_mean, table->dead);
+
+	float cold_ref = reference(cold_mean, table->dead, pixels);
+	float warm_ref = warm ? reference(warm_mean, table->dead, pixels) : 0;
+	if (warm && warm_ref - cold_ref < 1)
+		return false;
+
+	for (uint16_t i = 0; i < pixels; i++)
+	{
+		float gain = 1;
+		if (warm && !table->dead[i])
+		{
+			float span = warm_mean[i] - cold_mean[i];
+			gain = span > 0 ? (warm_ref - cold_ref) / span : 0;
+			if (gain < 0.5f || gain > 2)
+				table->dead[i] = 1;
+		}
+		if (table->dead[i])
+		{
+			table->dead_count++;
+			continue;
+		}
+		table->gain[i] = round16(gain * NUC_GAIN_ONE);
+		/* Offset for the rounded gain, so the cold target comes out exact */
+		table->offset[i] = round16(cold_ref - table->gain[i] * cold_mean[i] / NUC_GAIN_ONE);
+	}
+	return true;
+}
+
+bool nuc_init(nuc *n, const nuc_table *table)
+{
+	int32_t width = table->width;
+	int32_t height = table->height;
+
+	memset(n, 0, sizeof(*n));
+	n->pixels = width * height;
+	if (n->pixels > NUC_MAX_PIXELS)
+		n->pixels = 0;
+	n->unity_gain = true;
+
+	for (uint16_t i = 0; i < n->pixels; i++)
+	{
+		n->offset[i] = table->offset[i];
+		n->gain[i] = table->gain[i];
+		n->bias[i] = table->offset[i] * NUC_GAIN_ONE + NUC_GAIN_ONE / 2;
+		if (table->gain[i] != NUC_GAIN_ONE)
+			n->unity_gain = false;
+	}
+
+	bool complete = true;
+	for (uint16_t i = 0; i < n->pixels; i++)
+	{
+		if (!table->dead[i])
+			continue;
+		if (n->repair_count == NUC_MAX_DEAD)
+		{
+			complete = false;
+			break;
+		}
+
+		nuc_repair *repair = &n->repairs[n->repair_count++];
+		repair->pixel = i;
+		int32_t x = i % width;
+		int32_t y = i / width;
+		for (int32_t ny = y - 1; ny <= y + 1; ny++)
+		{
+			for (int32_t nx = x - 1; nx <= x + 1; nx++)
+			{
+				if (nx < 0 || nx >= width || ny < 0 || ny >= height)
+					continue;
+				uint16_t neighbour = ny * width + nx;
+				if (!table->dead[neighbour])
+					repair->neighbours[repair->count++] = neighbour;
+			}
+		}
+	}
+	return complete;
+}
+
+static inline int16_t correct(const nuc *n, int16_t value, uint16_t i)
+{
+	int32_t c = (value * n->gain[i] + n->bias[i]) >> 14;
+	if (c > INT16_MAX)
+		return INT16_MAX;
+	if (c < INT16_MIN)
+		return INT16_MIN;
+	return c;
+}
+
+ITCM_TEXT void nuc_apply(const nuc *n, int16_t *frame)
+{
+	uint16_t pixels = n->pixels;
+	uint16_t i = 0;
+
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+	/* Two pixels per word */
+	uint16_t pairs = pixels & ~1;
+	if (n->unity_gain)
+	{
+		for (; i < pairs; i += 2)
+		{
+			uint32_t pair, offset;
+			memcpy(&pair, &frame[i], sizeof(pair));
+			memcpy(&offset, &n->offset[i], sizeof(offset));
+			pair = __QADD16(pair, offset);
+			memcpy(&frame[i], &pair, sizeof(pair));
+		}
+	}
+	else
+	{
+		for (; i < pairs; i += 2)
+		{
+			uint32_t pair, gain;
+			memcpy(&pair, &frame[i], sizeof(pair));
+			memcpy(&gain, &n->gain[i], sizeof(gain));
+			int32_t low = __SSAT(__SMLABB(pair, gain, n->bias[i]) >> 14, 16);
+			int32_t high = __SSAT(__SMLATT(pair, gain, n->bias[i + 1]) >> 14, 16);
+			pair = __PKHBT(low, high, 16);
+			memcpy(&frame[i], &pair, sizeof(pair));
+		}
+	}
+#endif
+	for (; i < pixels; i++)
+		frame[i] = correct(n, frame[i], i);
+
+	/* Dead pixels from their corrected neighbours */
+	for (uint8_t r = 0; r < n->repair_count; r++)
+	{
+		const nuc_repair *repair = &n->repairs[r];
+		if (repair->count == 0)
+			continue;
+		int32_t sum = 0;
+		for (uint8_t k = 0; k < repair->count; k++)
+			sum += frame[repair->neighbours[k]];
+		int32_t half = repair->count / 2;
+		frame[repair->pixel] = (sum + (sum >= 0 ? half : -half)) / repair->count;
+	}
+}
@@ -0,0 +1,151 @@
+#include <string.h>
+#include "pool.h"
+#include "debug.h"
+#include "irq.h"
+#include "sections.h"
+
+/* Registered pools, sorted by block size */
+static pool *classes[POOL_MAX_CLASSES];
+static uint8_t class_count;
+
+/* The counters are updated with LDREX/STREX like the free list */
+static ITCM_TEXT uint32_t atomic_add(volatile uint32_t *value, int32_t n)
+{
+	uint32_t result;
+	do {
+		result = __LDREXW(value) + n;
+	} while (__STREXW(result, value));
+	return result;
+}
+
+static ITCM_TEXT void atomic_max(volatile uint32_t *value, uint32_t n)
+{
+	do {
+		if (__LDREXW(value) >= n)
+		{
+			__CLREX();
+			return;
+		}
+	} while (__STREXW(n, value));
+}
+
+static ITCM_TEXT pool_block *pop(pool *p)
+{
+	pool_block *block;
+	do {
+		block = (pool_block *)__LDREXW((volatile uint32_t *)&p->free);
+		if (block == NULL)
+		{
+			__CLREX();
+			return NULL;
+		}
+	} while (__STREXW((uint32_t)block->next, (volatile uint32_t *)&p->free));
+	__DMB(); /* Acquire, done with the list before the block is handed out */
+
+	atomic_max(&p->stats.peak, atomic_add(&p->stats.used, 1));
+	return block;
+}
+
+bool pool_init(pool *p, const char *name)
+{
+	p->name = name;
+	p->free = NULL;
+	memset((void *)&p->stats, 0, sizeof(p->stats));
+	for (uint32_t i = p->count; i > 0; i--)
+	{
+		pool_block *block = (pool_block *)(p->storage + (i - 1) * p->block_size);
+		block->next = p->free;
+		p->free = block;
+	}
+
+	uint32_t primask = irq_save();
+	bool registered = class_count < POOL_MAX_CLASSES;
+	if (registered)
+	{
+		uint8_t i = class_count++;
+		for (; i > 0 && classes[i - 1]->block_size > p->block_size; i--)
+			classes[i] = classes[i - 1];
+		classes[i] = p;
+	}
+	irq_restore(primask);
+	return registered;
+}
+
+ITCM_TEXT void *pool_alloc(pool *p)
+{
+	pool_block *block = pop(p);
+	if (block == NULL)
+		atomic_add(&p->stats.failures, 1);
+	return block;
+}
+
+ITCM_TEXT void pool_free(pool *p, void *block)
+{
+	pool_block *b = block;
+	__DMB(); /* Release, done with the block before it is on the list */
+	do {
+		b->next = (pool_block *)__LDREXW((volatile uint32_t *)&p->free);
+	} while (__STREXW((uint32_t)b, (volatile uint32_t *)&p->free));
+
+	atomic_add(&p->stats.used, -1);
+}
+
+ITCM_TEXT void *pool_get(uint32_t size)
+{
+	pool *first = NULL;
+	for (uint8_t i = 0; i < class_count; i++)
+	{
+		pool *p = classes[i];
+		if (p->block_size < size)
+			continue;
+		if (first == NULL)
+			first = p;
+		pool_block *block = pop(p);
+		if (block != NULL)
+			return block;
+	}
+	/* Counted where the block should have come from */
+	if (first != NULL)
+		atomic_add(&first->stats.failures, 1);
+	return NULL;
+}
+
+ITCM_TEXT pool *pool_of(const void *block)
+{
+	const uint8_t *b = block;
+	for (uint8_t i = 0; i < class_count; i++)
+	{
+		pool *p = classes[i];
+		if (b >= p->storage && b < p->storage + p->count * p->block_size)
+			return p;
+	}
+	return NULL;
+}
+
+ITCM_TEXT void pool_put(void *block)
+{
+	pool *p = pool_of(block);
+	if (p != NULL)
+		pool_free(p, block);
+}
+
+void pool_get_stats(const pool *p, pool_stats *stats)
+{
+	/* Copy, so the numbers are consistent with each other */
+	uint32_t primask = irq_save();
+	stats->used = p->stats.used;
+	stats->peak = p->stats.peak;
+	stats->failures = p->stats.failures;
+	irq_restore(primask);
+}
+
+void pool_dump(void)
+{
+	for (uint8_t i = 0; i < class_count; i++)
+	{
+		pool_stats stats;
+		pool_get_stats(classes[i], &stats);
+		print("%s: %u x %u bytes, %u used, peak %u, %u failures\r\n", classes[i]->name,
+				classes[i]->count, classes[i]->block_size, stats.used, stats.peak, stats.failures);
+	}
+}
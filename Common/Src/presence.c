@@ -0,0 +1,346 @@
+#include <math.h>
+#include <string.h>
+#include "presence.h"
+#include "debug.h"
+#include "sections.h"
+
+/* Larger differences would overflow the variance */
+#define MAX_DIFFERENCE 8191
+
+void presence_default_config(presence_config *config, uint16_t width, uint16_t height)
+{
+	float scale = width / 8.0f;
+
+	memset(config, 0, sizeof(*config));
+	config->width = width;
+	config->height = height;
+	config->learn_shift = 5;       /* 3.2 s at 10 frames per second */
+	config->foreground_shift = 10; /* 100 s */
+	config->warmup_frames = 20;
+	config->threshold_sigma = 3.0f;
+	config->min_delta = 6;         /* 1.5 C in quarter degrees */
+	config->min_area = scale * scale < 1 ? 1 : (uint16_t)(scale * scale);
+	config->max_distance = 2.5f * scale;
+	config->velocity_alpha = 0.5f;
+	config->max_missed = 3;
+	config->min_age = 3;
+	config->line_x0 = config->line_x1 = (width - 1) / 2.0f;
+	config->line_y0 = 0;
+	config->line_y1 = height - 1;
+	config->line_margin = 0.5f * scale;
+}
+
+bool presence_init(presence *p, const presence_config *config)
+{
+	if (config->width == 0 || config->height == 0 ||
+			config->width * config->height > PRESENCE_MAX_PIXELS)
+		return false;
+
+	memset(p, 0, sizeof(*p));
+	p->config = *config;
+	p->k2 = (uint64_t)lroundf(config->threshold_sigma * config->threshold_sigma * 256);
+
+	float dx = config->line_x1 - config->line_x0;
+	float dy = config->line_y1 - config->line_y0;
+	float length = sqrtf(dx * dx + dy * dy);
+	if (length > 0)
+	{
+		p->line_nx = -dy / length;
+		p->line_ny = dx / length;
+	}
+	p->next_id = 1;
+	return true;
+}
+
+void presence_reset(presence *p)
+{
+	p->learnt = 0;
+	p->blob_count = 0;
+	p->track_count = 0;
+}
+
+/* Learn the frame into the background and mark the pixels warmer than it */
+ITCM_TEXT static void update_background(presence *p, const int16_t *frame)
+{
+	const presence_config *c = &p->config;
+	uint32_t count = c->width * c->height;
+
+	if (p->learnt == 0)
+	{
+		for (uint32_t i = 0; i < count; i++)
+		{
+			p->mean[i] = frame[i] * 256;
+			p->var[i] = 0;
+			p->foreground[i] = 0;
+		}
+		p->learnt = 1;
+		return;
+	}
+
+	/* While warming up, close to the average of all frames so far */
+	bool warm = p->learnt >= c->warmup_frames;
+	uint8_t shift = c->learn_shift;
+	if (!warm)
+	{
+		uint8_t log2 = 31 - __builtin_clz(p->learnt + 1);
+		if (log2 < shift)
+			shift = log2;
+	}
+
+	for (uint32_t i = 0; i < count; i++)
+	{
+		int32_t value = frame[i];
+		int32_t mean = p->mean[i];
+		int32_t var = p->var[i];
+		int32_t d = value - ((mean + 128) >> 8);
+		if (d > MAX_DIFFERENCE)
+			d = MAX_DIFFERENCE;
+		else if (d < -MAX_DIFFERENCE)
+			d = -MAX_DIFFERENCE;
+		int32_t d2 = d * d * 16;
+
+		/* d > sigma * sqrt(var), with var in 1/16 and sigma^2 in 1/256 */
+		bool fg = warm && d > c->min_delta && (uint64_t)d2 * 256 > p->k2 * (uint32_t)var;
+		p->foreground[i] = fg ? d : 0;
+
+		uint8_t s = fg ? c->foreground_shift : shift;
+		if (fg && s == 0)
+			continue;
+		p->mean[i] = mean + ((value * 256 - mean) >> s);
+		p->var[i] = var + ((d2 - var) >> s);
+	}
+	p->learnt++;
+}
+
+/* Group the foreground into 8-connected blobs, breadth first */
+ITCM_TEXT static void label_blobs(presence *p)
+{
+	const presence_config *c = &p->config;
+	int32_t width = c->width;
+	int32_t height = c->height;
+	uint32_t count = width * height;
+
+	memset(p->labels, 0, count);
+	p->blob_count = 0;
+
+	for (uint32_t start = 0; start < count; start++)
+	{
+		if (p->foreground[start] == 0 || p->labels[start] != 0)
+			continue;
+
+		presence_blob blob = {0};
+		int32_t sum_x = 0;
+		int32_t sum_y = 0;
+		uint32_t head = 0;
+		uint32_t tail = 0;
+		p->queue[tail++] = start;
+		p->labels[start] = PRESENCE_IGNORED;
+
+		while (head < tail)
+		{
+			uint32_t i = p->queue[head++];
+			int32_t x = i % width;
+			int32_t y = i / width;
+			int16_t w = p->foreground[i];
+
+			blob.area++;
+			blob.heat += w;
+			sum_x += w * x;
+			sum_y += w * y;
+			if (w > blob.peak)
+				blob.peak = w;
+
+			for (int32_t ny = y - 1; ny <= y + 1; ny++)
+			{
+				if (ny < 0 || ny >= height)
+					continue;
+				for (int32_t nx = x - 1; nx <= x + 1; nx++)
+				{
+					if (nx < 0 || nx >= width)
+						continue;
+					uint32_t n = ny * width + nx;
+					if (p->foreground[n] != 0 && p->labels[n] == 0)
+					{
+						p->labels[n] = PRESENCE_IGNORED;
+						p->queue[tail++] = n;
+					}
+				}
+			}
+		}
+
+		if (blob.area < c->min_area)
+			continue;
+		if (p->blob_count == PRESENCE_MAX_BLOBS)
+		{
+			p->stats.dropped_blobs++;
+			continue;
+		}
+
+		blob.x = (float)sum_x / blob.heat;
+		blob.y = (float)sum_y / blob.heat;
+		uint8_t label = p->blob_count + 1;
+		for (uint32_t k = 0; k < tail; k++)
+			p->labels[p->queue[k]] = label;
+		p->blobs[p->blob_count++] = blob;
+	}
+}
+
+/* Side of the counting line, 0 within the margin */
+static int8_t line_side(const presence *p, float x, float y)
+{
+	const presence_config *c = &p->config;
+	float distance = p->line_nx * (x - c->line_x0) + p->line_ny * (y - c->line_y0);
+	if (distance > c->line_margin)
+		return 1;
+	if (distance < -c->line_margin)
+		return -1;
+	return 0;
+}
+
+static void track_blobs(presence *p, float dt)
+{
+	const presence_config *c = &p->config;
+	bool taken[PRESENCE_MAX_BLOBS] = {false};
+	float px[PRESENCE_MAX_TRACKS];
+	float py[PRESENCE_MAX_TRACKS];
+
+	for (uint8_t t = 0; t < p->track_count; t++)
+	{
+		presence_track *track = &p->tracks[t];
+		px[t] = track->x + track->vx * dt;
+		py[t] = track->y + track->vy * dt;
+		track->blob = -1;
+	}
+
+	/* Closest pair of track prediction and blob first, until none is close enough */
+	while (1)
+	{
+		float best = c->max_distance * c->max_distance;
+		int8_t best_track = -1;
+		int8_t best_blob = -1;
+		for (uint8_t t = 0; t < p->track_count; t++)
+		{
+			if (p->tracks[t].blob >= 0)
+				continue;
+			for (uint8_t b = 0; b < p->blob_count; b++)
+			{
+				if (taken[b])
+					continue;
+				float dx = p->blobs[b].x - px[t];
+				float dy = p->blobs[b].y - py[t];
+				float d2 = dx * dx + dy * dy;
+				if (d2 <= best)
+				{
+					best = d2;
+					best_track = t;
+					best_blob = b;
+				}
+			}
+		}
+		if (best_track < 0)
+			break;
+		p->tracks[best_track].blob = best_blob;
+		taken[best_blob] = true;
+	}
+
+	uint8_t kept = 0;
+	for (uint8_t t = 0; t < p->track_count; t++)
+	{
+		presence_track track = p->tracks[t];
+		if (track.blob < 0)
+		{
+			/* Coast on the prediction, but never count a crossing without a blob */
+			track.x = px[t];
+			track.y = py[t];
+			if (++track.missed > c->max_missed)
+				continue;
+		}
+		else
+		{
+			const presence_blob *blob = &p->blobs[track.blob];
+			if (dt > 0)
+			{
+				float vx = (blob->x - track.x) / dt;
+				float vy = (blob->y - track.y) / dt;
+				float alpha = track.age == 1 ? 1.0f : c->velocity_alpha;
+				track.vx += alpha * (vx - track.vx);
+				track.vy += alpha * (vy - track.vy);
+			}
+			track.x = blob->x;
+			track.y = blob->y;
+			track.missed = 0;
+			if (track.age < UINT16_MAX)
+				track.age++;
+
+			int8_t side = line_side(p, track.x, track.y);
+			if (side != 0 && side != track.side)
+			{
+				if (track.side != 0 && track.age >= c->min_age)
+				{
+					if (side > 0)
+						p->stats.entries++;
+					else
+						p->stats.exits++;
+				}
+				track.side = side;
+			}
+		}
+		p->tracks[kept++] = track;
+	}
+	p->track_count = kept;
+
+	for (uint8_t b = 0; b < p->blob_count; b++)
+	{
+		if (taken[b])
+			continue;
+		if (p->track_count == PRESENCE_MAX_TRACKS)
+		{
+			p->stats.dropped_tracks++;
+			continue;
+		}
+
+		presence_track *track = &p->tracks[p->track_count++];
+		memset(track, 0, sizeof(*track));
+		track->id = p->next_id++;
+		if (p->next_id == 0)
+			p->next_id = 1;
+		track->x = p->blobs[b].x;
+		track->y = p->blobs[b].y;
+		track->age = 1;
+		track->side = line_side(p, track->x, track->y);
+		track->blob = b;
+		p->stats.tracks++;
+	}
+}
+
+uint8_t presence_update(presence *p, const int16_t *frame, uint32_t timestamp)
+{
+	float dt = 0;
+	if (p->stats.frames > 0)
+		dt = (uint32_t)(timestamp - p->timestamp) * 1e-6f;
+	p->timestamp = timestamp;
+	p->stats.frames++;
+
+	update_background(p, frame);
+	label_blobs(p);
+	track_blobs(p, dt);
+	return p->track_count;
+}
+
+void presence_get_stats(const presence *p, presence_stats *stats)
+{
+	*stats = p->stats;
+}
+
+void presence_dump(const presence *p)
+{
+	const presence_stats *s = &p->stats;
+	print("presence: %u frames, %u tracks started, %u entries, %u exits, %u dropped blobs, %u dropped tracks\r\n",
+			s->frames, s->tracks, s->entries, s->exits, s->dropped_blobs, s->dropped_tracks);
+	for (uint8_t t = 0; t < p->track_count; t++)
+	{
+		const presence_track *track = &p->tracks[t];
+		print("track %u at %f, %f moving %f, %f px/s, seen %u frames\r\n", track->id,
+				track->x, track->y, track->vx, track->vy, track->age);
+	}
+}
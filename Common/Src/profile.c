@@ -0,0 +1,222 @@
+#include <string.h>
+#include "profile.h"
+#include "debug.h"
+#include "irq.h"
+#include "sections.h"
+
+typedef struct {
+	const char *name;
+	uint32_t count;
+	uint32_t min;
+	uint32_t max;
+	uint64_t total;
+	uint64_t time;  /* ns in Q16, each duration at the core clock it was taken at */
+	uint32_t hist[PROFILE_HIST_BINS];
+} probe_stats;
+
+static probe_stats probes[PROFILE_MAX_PROBES];
+static int8_t probe_count;
+
+/* Length of a cycle in ns in Q16, for the core clock in ns_per_cycle_clock */
+static uint32_t ns_per_cycle;
+static uint32_t ns_per_cycle_clock;
+
+void profile_init(void)
+{
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->LAR = 0xC5ACCE55; /* Unlock, needed on the M7 */
+	DWT->CYCCNT = 0;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+uint32_t profile_cycles_to_us(uint32_t cycles)
+{
+	return (uint32_t)(((uint64_t)cycles * 1000000 + SystemCoreClock / 2) / SystemCoreClock);
+}
+
+int8_t profile_register(const char *name)
+{
+	uint32_t primask = irq_save();
+
+	int8_t slot = PROFILE_NO_SLOT;
+	for (int8_t i = 0; i < probe_count; i++)
+	{
+		if (strcmp(probes[i].name, name) == 0)
+			slot = i;
+	}
+	if (slot == PROFILE_NO_SLOT && probe_count < PROFILE_MAX_PROBES)
+	{
+		slot = probe_count++;
+		probes[slot].name = name;
+		probes[slot].min = UINT32_MAX;
+	}
+
+	irq_restore(primask);
+	return slot;
+}
+
+ITCM_TEXT void profile_record(int8_t slot, uint32_t cycles)
+{
+	if (slot < 0)
+		return;
+
+	probe_stats *p = &probes[slot];
+	/* __CLZ(0) is 32, which lands in bin 0 like a single cycle */
+	uint32_t bin = cycles ? 31 - __CLZ(cycles) : 0;
+
+	uint32_t primask = irq_save();
+	/* clock_set_sysclk() may change the clock before the dump, so convert now */
+	if (ns_per_cycle_clock != SystemCoreClock)
+	{
+		ns_per_cycle_clock = SystemCoreClock;
+		ns_per_cycle = (uint32_t)(((1000000000ULL << 16) + ns_per_cycle_clock / 2) / ns_per_cycle_clock);
+	}
+	p->time += (uint64_t)cycles * ns_per_cycle;
+	p->count++;
+	p->total += cycles;
+	if (cycles < p->min)
+		p->min = cycles;
+	if (cycles > p->max)
+		p->max = cycles;
+	p->hist[bin]++;
+	irq_restore(primask);
+}
+
+void profile_reset(void)
+{
+	uint32_t primask = irq_save();
+	for (int8_t i = 0; i < probe_count; i++)
+	{
+		const char *name = probes[i].name;
+		memset(&probes[i], 0, sizeof(probes[i]));
+		probes[i].name = name;
+		probes[i].min = UINT32_MAX;
+	}
+	irq_restore(primask);
+}
+
+/* Output line being assembled by profile_dump() */
+static char line[256];
+static uint32_t line_len;
+
+static void put_str(const char *str)
+{
+	while (*str && line_len < sizeof(line) - 1)
+		line[line_len++] = *str++;
+}
+
+/* Right-aligned in width characters */
+static void put_uint(uint32_t num, uint32_t width)
+{
+	char digits[10];
+	uint32_t len = 0;
+	do {
+		digits[len++] = (char)('0' + num % 10);
+		num /= 10;
+	} while (num > 0);
+
+	while (width-- > len)
+		put_str(" ");
+	while (len > 0)
+	{
+		char c[2] = { digits[--len], '\0' };
+		put_str(c);
+	}
+}
+
+static void end_line(void)
+{
+	put_str("\r\n");
+	line[line_len] = '\0';
+#if PROFILE_OUTPUT == PROFILE_OUTPUT_ITM
+	for (uint32_t i = 0; i < line_len; i++)
+		ITM_SendChar(line[i]);
+#else
+	print("%s", line);
+	/* A dump is larger than the print buffer, let each line go out */
+	print_flush();
+#endif
+	line_len = 0;
+}
+
+void profile_dump(void)
+{
+	put_str("probe                count       min       max      mean  cycles (mean us)");
+	end_line();
+
+	for (int8_t i = 0; i < probe_count; i++)
+	{
+		/* Copy, so the numbers are consistent with each other */
+		uint32_t primask = irq_save();
+		probe_stats p = probes[i];
+		irq_restore(primask);
+
+		if (p.count == 0)
+			continue;
+
+		uint32_t mean = (uint32_t)(p.total / p.count);
+		uint32_t mean_us = (uint32_t)((p.time / p.count + (500ULL << 16)) / (1000ULL << 16));
+		put_str(p.name);
+		for (uint32_t n = strlen(p.name); n < 16; n++)
+			put_str(" ");
+		put_uint(p.count, 9);
+		put_uint(p.min, 10);
+		put_uint(p.max, 10);
+		put_uint(mean, 10);
+		put_str("  (");
+		put_uint(mean_us, 0);
+		put_str(")");
+		end_line();
+
+		/* Histogram as <log2 of cycles>:<count> for the non-empty bins */
+		put_str("  hist");
+		for (uint32_t bin = 0; bin < PROFILE_HIST_BINS; bin++)
+		{
+			if (p.hist[bin] == 0)
+				continue;
+			put_str(" 2^");
+			put_uint(bin, 0);
+			put_str(":");
+			put_uint(p.hist[bin], 0);
+		}
+		end_line();
+	}
+}
+
+void profile_benchmark(const char *name, void (*fn)(void), uint32_t iterations)
+{
+	profile_benchmark_ops(name, fn, iterations, 1);
+}
+
+void profile_benchmark_ops(const char *name, void (*fn)(void), uint32_t iterations, uint32_t ops)
+{
+	uint32_t min = UINT32_MAX;
+	uint64_t total = 0;
+
+	fn();
+	for (uint32_t i = 0; i < iterations; i++)
+	{
+		uint32_t start = profile_cycles();
+		fn();
+		uint32_t cycles = profile_cycles() - start;
+		total += cycles;
+		if (cycles < min)
+			min = cycles;
+	}
+
+	put_str("bench ");
+	put_str(name);
+	put_str(" ");
+	uint64_t calls = (uint64_t)iterations * ops;
+	put_uint(calls ? (uint32_t)((total + calls / 2) / calls) : 0, 0);
+	put_str(" cycles (min ");
+	put_uint(ops ? (uint32_t)(((uint64_t)min + ops / 2) / ops) : 0, 0);
+	put_str(")");
+	end_line();
+}
+
+void profile_benchmark_done(void)
+{
+	put_str("bench done");
+	end_line();
+}
@@ -0,0 +1,193 @@
+#include <string.h>
+#include "scheduler.h"
+#include "debug.h"
+#include "irq.h"
+#include "sections.h"
+
+typedef struct {
+	const char *name;
+	scheduler_read read;
+	void *context;
+	timebase_timer timer;
+
+	/* Set by the timer interrupt, cleared by scheduler_run() */
+	volatile bool pending;
+	volatile bool running;
+	volatile uint32_t due;
+	volatile uint32_t due_index;
+	/* Next instant on the grid */
+	volatile uint32_t index;
+
+	scheduler_stats stats;
+} job_slot;
+
+static job_slot jobs[SCHEDULER_MAX_JOBS];
+static int8_t job_count;
+
+/* Timer callback, in the TIM2 interrupt */
+static ITCM_TEXT void instant(timebase_timer *timer)
+{
+	job_slot *job = timer->context;
+	uint32_t index = job->index++;
+
+	if (job->pending || job->running)
+	{
+		job->stats.overruns++;
+		return;
+	}
+	/* The timebase already moved the expiry on to the next instant */
+	job->due = timer->expiry - timer->period;
+	job->due_index = index;
+	job->pending = true;
+}
+
+static void clear_stats(scheduler_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->jitter_min = UINT32_MAX;
+}
+
+int8_t scheduler_add(const char *name, uint32_t period_us, scheduler_read read, void *context)
+{
+	if (period_us == 0 || period_us > 0x80000000 || job_count == SCHEDULER_MAX_JOBS)
+		return SCHEDULER_NO_JOB;
+
+	job_slot *job = &jobs[job_count];
+	job->name = name;
+	job->read = read;
+	job->context = context;
+	job->timer.period = period_us;
+	job->timer.callback = instant;
+	job->timer.context = job;
+	clear_stats(&job->stats);
+	return job_count++;
+}
+
+void scheduler_start(uint32_t delay_us)
+{
+	uint32_t primask = irq_save();
+	uint32_t first = timebase_us() + delay_us;
+	for (int8_t i = 0; i < job_count; i++)
+	{
+		jobs[i].pending = false;
+		jobs[i].index = 0;
+		timebase_timer_start_at(&jobs[i].timer, first, jobs[i].timer.period);
+	}
+	irq_restore(primask);
+}
+
+void scheduler_stop(void)
+{
+	uint32_t primask = irq_save();
+	for (int8_t i = 0; i < job_count; i++)
+	{
+		timebase_timer_stop(&jobs[i].timer);
+		jobs[i].pending = false;
+	}
+	irq_restore(primask);
+}
+
+bool scheduler_run(void)
+{
+	bool ran = false;
+
+	while (1)
+	{
+		/* Earliest due job, and claim it before the next instant can */
+		uint32_t primask = irq_save();
+		uint32_t now = timebase_us();
+		job_slot *job = NULL;
+		for (int8_t i = 0; i < job_count; i++)
+		{
+			if (jobs[i].pending && (job == NULL ||
+					now - jobs[i].due > now - job->due))
+				job = &jobs[i];
+		}
+		if (job == NULL)
+		{
+			irq_restore(primask);
+			return ran;
+		}
+		scheduler_sample sample = {
+			.index = job->due_index,
+			.due = job->due,
+		};
+		job->pending = false;
+		job->running = true;
+		irq_restore(primask);
+
+		sample.start = timebase_us();
+		job->read(&sample, job->context);
+
+		uint32_t jitter = sample.start - sample.due;
+		primask = irq_save();
+		job->running = false;
+		job->stats.samples++;
+		job->stats.jitter_total += jitter;
+		if (jitter < job->stats.jitter_min)
+			job->stats.jitter_min = jitter;
+		if (jitter > job->stats.jitter_max)
+			job->stats.jitter_max = jitter;
+		irq_restore(primask);
+		ran = true;
+	}
+}
+
+bool scheduler_due(void)
+{
+	for (int8_t i = 0; i < job_count; i++)
+	{
+		if (jobs[i].pending)
+			return true;
+	}
+	return false;
+}
+
+void scheduler_wait(void)
+{
+	/* With interrupts off, an instant right after the check still ends the WFI */
+	__disable_irq();
+	while (!scheduler_due())
+	{
+		__WFI();
+		__enable_irq();
+		__disable_irq();
+	}
+	__enable_irq();
+}
+
+bool scheduler_get_stats(int8_t job, scheduler_stats *stats)
+{
+	if (job < 0 || job >= job_count)
+		return false;
+
+	/* Copy, so the numbers are consistent with each other */
+	uint32_t primask = irq_save();
+	*stats = jobs[job].stats;
+	irq_restore(primask);
+	return true;
+}
+
+void scheduler_reset_stats(void)
+{
+	uint32_t primask = irq_save();
+	for (int8_t i = 0; i < job_count; i++)
+		clear_stats(&jobs[i].stats);
+	irq_restore(primask);
+}
+
+void scheduler_dump(void)
+{
+	for (int8_t i = 0; i < job_count; i++)
+	{
+		scheduler_stats stats;
+		scheduler_get_stats(i, &stats);
+
+		print("%s: every %u us, %u samples, %u overruns", jobs[i].name,
+				jobs[i].timer.period, stats.samples, stats.overruns);
+		if (stats.samples > 0)
+			print(", jitter %u to %u us, mean %u us", stats.jitter_min, stats.jitter_max,
+					(uint32_t)(stats.jitter_total / stats.samples));
+		print("\r\n");
+	}
+}
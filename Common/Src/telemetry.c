@@ -0,0 +1,92 @@
+#include <string.h>
+#include "telemetry.h"
+#include "debug.h"
+#include "pool.h"
+#include "timebase.h"
+
+void Error_Handler();
+
+static CRC_HandleTypeDef hcrc;
+
+/* Header and CRC around the payload */
+#define FRAME_OVERHEAD (sizeof(telemetry_header) + 4)
+
+/*
+ * Frames are built in blocks of two size classes, the readings of the
+ * spectral sensor fit the small one, pixel frames take the large one
+ */
+POOL_DEFINE(telemetry_small, FRAME_OVERHEAD + TELEMETRY_SMALL_PAYLOAD, TELEMETRY_MESSAGES, );
+POOL_DEFINE(telemetry_large, FRAME_OVERHEAD + TELEMETRY_MAX_PAYLOAD, TELEMETRY_MESSAGES, );
+
+static uint16_t seq;
+static uint32_t dropped;
+
+void telemetry_init(void)
+{
+	__HAL_RCC_CRC_CLK_ENABLE();
+
+	/*
+	 * Reflected CRC-32 with the default polynomial and initial value, byte wise
+	 * input. Together with the final inversion in telemetry_send() this gives
+	 * the same result as zlib's crc32().
+	 */
+	hcrc.Instance = CRC;
+	hcrc.Init.DefaultPolynomialUse = DEFAULT_POLYNOMIAL_ENABLE;
+	hcrc.Init.DefaultInitValueUse = DEFAULT_INIT_VALUE_ENABLE;
+	hcrc.Init.InputDataInversionMode = CRC_INPUTDATA_INVERSION_BYTE;
+	hcrc.Init.OutputDataInversionMode = CRC_OUTPUTDATA_INVERSION_ENABLE;
+	hcrc.InputDataFormat = CRC_INPUTDATA_FORMAT_BYTES;
+	if (HAL_CRC_Init(&hcrc) != HAL_OK)
+	{
+		Error_Handler();
+	}
+
+	if (!pool_init(&telemetry_small, "telemetry_small") ||
+			!pool_init(&telemetry_large, "telemetry_large"))
+	{
+		Error_Handler();
+	}
+}
+
+bool telemetry_send(uint8_t type, const void *payload, uint16_t length)
+{
+	return telemetry_send_at(type, payload, length, timebase_us());
+}
+
+bool telemetry_send_at(uint8_t type, const void *payload, uint16_t length, uint32_t timestamp)
+{
+	uint8_t *frame = length <= TELEMETRY_MAX_PAYLOAD ? pool_get(FRAME_OVERHEAD + length) : NULL;
+	if (frame == NULL)
+	{
+		dropped++;
+		return false;
+	}
+
+	telemetry_header header = {
+		.sync = TELEMETRY_SYNC,
+		.type = type,
+		.version = TELEMETRY_VERSION,
+		.seq = seq++,
+		.length = length,
+		.timestamp = timestamp,
+	};
+	memcpy(frame, &header, sizeof(header));
+	memcpy(frame + sizeof(header), payload, length);
+
+	uint32_t size = sizeof(header) + length;
+	uint32_t crc = ~HAL_CRC_Calculate(&hcrc, (uint32_t *)frame, size);
+	memcpy(frame + size, &crc, sizeof(crc));
+	size += sizeof(crc);
+
+	/* print_write() copies the frame, the block is free again right away */
+	bool sent = print_write(frame, size);
+	pool_put(frame);
+	if (!sent)
+		dropped++;
+	return sent;
+}
+
+uint32_t telemetry_dropped(void)
+{
+	return dropped;
+}
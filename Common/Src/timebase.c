@@ -0,0 +1,244 @@
+#include "timebase.h"
+#include "irq.h"
+#include "sections.h"
+
+/* Number of TIM2 overflows, the upper half of timebase_us64() */
+static volatile uint32_t overflows;
+
+/* Running software timers, sorted by expiry */
+static timebase_timer *timers;
+
+static bool started;
+
+/* The APB1 timers run at twice PCLK1 unless the APB1 prescaler is 1 */
+static uint32_t timer_clock(void)
+{
+	uint32_t pclk1 = HAL_RCC_GetPCLK1Freq();
+	if ((RCC->D2CFGR & RCC_D2CFGR_D2PPRE1) == RCC_APB1_DIV1)
+		return pclk1;
+	return 2 * pclk1;
+}
+
+/*
+ * Overrides the HAL's weak SysTick version. Called by HAL_Init() and after
+ * every clock change by HAL_RCC_ClockConfig(), so the prescaler is adjusted
+ * without losing the count.
+ */
+HAL_StatusTypeDef HAL_InitTick(uint32_t TickPriority)
+{
+	uint32_t clock = timer_clock();
+	/* With a fraction of a MHz left over, every microsecond would be short */
+	if (clock < 1000000 || clock % 1000000 != 0 || TickPriority >= (1UL << __NVIC_PRIO_BITS))
+		return HAL_ERROR;
+	uint32_t prescaler = clock / 1000000 - 1;
+
+	if (!started)
+	{
+		__HAL_RCC_TIM2_CLK_ENABLE();
+		TIMEBASE_TIM->CR1 = TIM_CR1_URS; /* Only overflows set UIF, not UG */
+		TIMEBASE_TIM->ARR = 0xFFFFFFFF;
+		TIMEBASE_TIM->PSC = prescaler;
+		TIMEBASE_TIM->EGR = TIM_EGR_UG;
+		TIMEBASE_TIM->SR = 0;
+		TIMEBASE_TIM->DIER = TIM_DIER_UIE;
+		TIMEBASE_TIM->CR1 |= TIM_CR1_CEN;
+		started = true;
+	}
+	else if (TIMEBASE_TIM->PSC != prescaler)
+	{
+		/*
+		 * Without UG the new prescaler would only be loaded at the next
+		 * overflow, 71 minutes away. UG loads it right away, but clears the
+		 * counter and restarts the prescaler, dropping the part of a tick
+		 * counted so far. Right after a tick that is just the few cycles up
+		 * to the UG rather than up to 1 us, which would add up to ~10 ppm
+		 * with the GridEYE's clock changes.
+		 */
+		uint32_t primask = irq_save();
+		uint32_t last = TIMEBASE_TIM->CNT;
+		uint32_t count;
+		while ((count = TIMEBASE_TIM->CNT) == last) {}
+		TIMEBASE_TIM->PSC = prescaler;
+		TIMEBASE_TIM->EGR = TIM_EGR_UG;
+		TIMEBASE_TIM->CNT = count;
+		irq_restore(primask);
+	}
+
+	HAL_NVIC_SetPriority(TIM2_IRQn, TickPriority, 0U);
+	HAL_NVIC_EnableIRQ(TIM2_IRQn);
+	uwTickPrio = TickPriority;
+	return HAL_OK;
+}
+
+/* Overrides the HAL's weak version, milliseconds derived from the timebase */
+ITCM_TEXT uint32_t HAL_GetTick(void)
+{
+	return (uint32_t)(timebase_us64() / 1000);
+}
+
+/* Overrides the HAL's weak busy-waiting version */
+void HAL_Delay(uint32_t Delay)
+{
+	uint64_t end = timebase_us64() + (uint64_t)Delay * 1000;
+	uint64_t now;
+	while ((now = timebase_us64()) < end)
+	{
+		uint64_t left = end - now;
+		timebase_sleep_us(left > 0x40000000 ? 0x40000000 : (uint32_t)left);
+	}
+}
+
+ITCM_TEXT uint64_t timebase_us64(void)
+{
+	uint32_t primask = irq_save();
+	uint32_t high = overflows;
+	uint32_t low = TIMEBASE_TIM->CNT;
+	/* An overflow that the interrupt hasn't counted yet */
+	if ((TIMEBASE_TIM->SR & TIM_SR_UIF) && low < 0x80000000)
+		high++;
+	irq_restore(primask);
+	return ((uint64_t)high << 32) | low;
+}
+
+void timebase_sleep_until(uint32_t deadline)
+{
+	if (__get_IPSR() != 0)
+	{
+		while ((int32_t)(deadline - timebase_us()) > 0) {}
+		return;
+	}
+
+	/* Channel 2 interrupts only to end the WFI */
+	TIMEBASE_TIM->CCR2 = deadline;
+	TIMEBASE_TIM->SR = ~TIM_SR_CC2IF;
+	TIMEBASE_TIM->DIER |= TIM_DIER_CC2IE;
+
+	/* With interrupts off, a match right after the check still ends the WFI */
+	__disable_irq();
+	while ((int32_t)(deadline - timebase_us()) > 0)
+	{
+		__WFI();
+		__enable_irq();
+		__disable_irq();
+	}
+	__enable_irq();
+
+	TIMEBASE_TIM->DIER &= ~TIM_DIER_CC2IE;
+}
+
+void timebase_sleep_us(uint32_t us)
+{
+	timebase_sleep_until(timebase_us() + us);
+}
+
+/* Program channel 1 for the first timer. Interrupts must be off. */
+static ITCM_TEXT void arm(void)
+{
+	if (timers == NULL)
+	{
+		TIMEBASE_TIM->DIER &= ~TIM_DIER_CC1IE;
+		return;
+	}
+
+	TIMEBASE_TIM->CCR1 = timers->expiry;
+	TIMEBASE_TIM->DIER |= TIM_DIER_CC1IE;
+	/* Already due, the counter won't match until it wraps around */
+	if ((int32_t)(timers->expiry - timebase_us()) <= 0)
+		TIMEBASE_TIM->EGR = TIM_EGR_CC1G;
+}
+
+/* Interrupts must be off */
+static ITCM_TEXT void insert(timebase_timer *timer)
+{
+	uint32_t now = timebase_us();
+	timebase_timer **link = &timers;
+	while (*link && (int32_t)((*link)->expiry - now) <= (int32_t)(timer->expiry - now))
+		link = &(*link)->next;
+	timer->next = *link;
+	*link = timer;
+	timer->active = true;
+}
+
+/* Interrupts must be off */
+static ITCM_TEXT void unlink(timebase_timer *timer)
+{
+	for (timebase_timer **link = &timers; *link; link = &(*link)->next)
+	{
+		if (*link == timer)
+		{
+			*link = timer->next;
+			break;
+		}
+	}
+	timer->active = false;
+}
+
+void timebase_timer_start(timebase_timer *timer, uint32_t delay_us, uint32_t period_us)
+{
+	uint32_t primask = irq_save();
+	timebase_timer_start_at(timer, timebase_us() + delay_us, period_us);
+	irq_restore(primask);
+}
+
+void timebase_timer_start_at(timebase_timer *timer, uint32_t expiry, uint32_t period_us)
+{
+	uint32_t primask = irq_save();
+	if (timer->active)
+		unlink(timer);
+	timer->expiry = expiry;
+	timer->period = period_us;
+	insert(timer);
+	arm();
+	irq_restore(primask);
+}
+
+void timebase_timer_stop(timebase_timer *timer)
+{
+	uint32_t primask = irq_save();
+	if (timer->active)
+	{
+		unlink(timer);
+		arm();
+	}
+	irq_restore(primask);
+}
+
+static ITCM_TEXT void run_timers(void)
+{
+	uint32_t primask = irq_save();
+	while (timers && (int32_t)(timers->expiry - timebase_us()) <= 0)
+	{
+		timebase_timer *timer = timers;
+		unlink(timer);
+		if (timer->period != 0)
+		{
+			timer->expiry += timer->period;
+			insert(timer);
+		}
+		/* The callback may start and stop timers itself */
+		irq_restore(primask);
+		timer->callback(timer);
+		primask = irq_save();
+	}
+	arm();
+	irq_restore(primask);
+}
+
+ITCM_TEXT void TIM2_IRQHandler(void)
+{
+	uint32_t status = TIMEBASE_TIM->SR;
+
+	if (status & TIM_SR_UIF)
+	{
+		TIMEBASE_TIM->SR = ~TIM_SR_UIF;
+		overflows++;
+	}
+	/* Nothing to do, it only woke up timebase_sleep_until() */
+	if (status & TIM_SR_CC2IF)
+		TIMEBASE_TIM->SR = ~TIM_SR_CC2IF;
+	if (status & TIM_SR_CC1IF)
+	{
+		TIMEBASE_TIM->SR = ~TIM_SR_CC1IF;
+		run_timers();
+	}
+}
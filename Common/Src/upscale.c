@@ -0,0 +1,220 @@
+#include <math.h>
+#include "upscale.h"
+#include "arm_math.h"
+#include "sections.h"
+
+#define Q14_ONE 16384
+
+/* Catmull-Rom weights of the pixels at -1, 0, 1 and 2 for a point t in [0, 1) */
+static void cubic_weights(float t, float w[UPSCALE_TAPS])
+{
+	float t2 = t * t;
+	float t3 = t2 * t;
+	w[0] = 0.5f * (-t3 + 2 * t2 - t);
+	w[1] = 0.5f * (3 * t3 - 5 * t2 + 2);
+	w[2] = 0.5f * (-3 * t3 + 4 * t2 + t);
+	w[3] = 0.5f * (t3 - t2);
+}
+
+static uint8_t clamp_index(int32_t i, uint16_t size)
+{
+	if (i < 0)
+		return 0;
+	if (i >= size)
+		return size - 1;
+	return i;
+}
+
+static void init_taps(upscale_tap *taps, uint16_t in, uint16_t out, upscale_kernel kernel)
+{
+	for (uint16_t o = 0; o < out; o++)
+	{
+		upscale_tap *tap = &taps[o];
+		float position = (float)(o * (in - 1)) / (out - 1);
+		int32_t i = (int32_t)position;
+		float t = position - i;
+		tap->position = position;
+
+		if (kernel == UPSCALE_BILINEAR)
+		{
+			tap->index[0] = clamp_index(i, in);
+			tap->index[1] = clamp_index(i + 1, in);
+			tap->index[2] = tap->index[3] = tap->index[1];
+			tap->weight_f32[0] = 1 - t;
+			tap->weight_f32[1] = t;
+			tap->weight_f32[2] = tap->weight_f32[3] = 0;
+		}
+		else
+		{
+			for (int k = 0; k < UPSCALE_TAPS; k++)
+				tap->index[k] = clamp_index(i - 1 + k, in);
+			cubic_weights(t, tap->weight_f32);
+		}
+
+		/* Round to Q14, the largest weight takes the rounding error so they sum to 1 */
+		int32_t sum = 0;
+		int largest = 0;
+		for (int k = 0; k < UPSCALE_TAPS; k++)
+		{
+			tap->weight[k] = (int16_t)lroundf(tap->weight_f32[k] * Q14_ONE);
+			sum += tap->weight[k];
+			if (tap->weight[k] > tap->weight[largest])
+				largest = k;
+		}
+		tap->weight[largest] += Q14_ONE - sum;
+	}
+}
+
+bool upscale_init(upscaler *up, uint16_t in_width, uint16_t in_height,
+		uint16_t out_width, uint16_t out_height, upscale_kernel kernel)
+{
+	if (in_width < 2 || in_width > UPSCALE_MAX_INPUT || in_height < 2 || in_height > UPSCALE_MAX_INPUT ||
+			out_width < 2 || out_width > UPSCALE_MAX_OUTPUT || out_height < 2 || out_height > UPSCALE_MAX_OUTPUT)
+		return false;
+
+	up->in_width = in_width;
+	up->in_height = in_height;
+	up->out_width = out_width;
+	up->out_height = out_height;
+	up->kernel = kernel;
+	up->taps = kernel == UPSCALE_BILINEAR ? 2 : UPSCALE_TAPS;
+	init_taps(up->cols, in_width, out_width, kernel);
+	init_taps(up->rows, in_height, out_height, kernel);
+	return true;
+}
+
+static inline int16_t saturate16(int32_t value)
+{
+	if (value > INT16_MAX)
+		return INT16_MAX;
+	if (value < INT16_MIN)
+		return INT16_MIN;
+	return value;
+}
+
+ITCM_TEXT void upscale_q15(upscaler *up, const int16_t *in, int16_t *out)
+{
+	uint16_t in_width = up->in_width;
+	uint16_t out_width = up->out_width;
+	uint8_t taps = up->taps;
+
+	/* Along the rows, Q14 weights leave 2 more fraction bits than the input has */
+	int16_t *mid = up->mid_q15;
+	for (uint16_t r = 0; r < up->in_height; r++)
+	{
+		const int16_t *row = &in[r * in_width];
+		for (uint16_t x = 0; x < out_width; x++)
+		{
+			const upscale_tap *tap = &up->cols[x];
+			int32_t acc = 0;
+			for (uint8_t k = 0; k < taps; k++)
+				acc += tap->weight[k] * row[tap->index[k]];
+			*mid++ = saturate16((acc + (1 << 11)) >> 12);
+		}
+	}
+
+	/* Along the columns, back to the input's unit */
+	for (uint16_t y = 0; y < up->out_height; y++)
+	{
+		const upscale_tap *tap = &up->rows[y];
+		const int16_t *src[UPSCALE_TAPS];
+		for (uint8_t k = 0; k < taps; k++)
+			src[k] = &up->mid_q15[tap->index[k] * out_width];
+
+		for (uint16_t x = 0; x < out_width; x++)
+		{
+			int32_t acc = 0;
+			for (uint8_t k = 0; k < taps; k++)
+				acc += tap->weight[k] * src[k][x];
+			*out++ = saturate16((acc + (1 << 15)) >> 16);
+		}
+	}
+}
+
+/* Per output pixel, with the CMSIS-DSP bilinear interpolation */
+static void bilinear_f32(upscaler *up, const float *in, float *out)
+{
+	/*
+	 * arm_bilinear_interp_f32() takes 1-based coordinates, checks both of
+	 * them against numRows and reads the pixel to the right and below even on
+	 * the last row and column. A square table with the last row and column
+	 * repeated keeps it inside.
+	 */
+	uint16_t size = (up->in_width > up->in_height ? up->in_width : up->in_height) + 1;
+	for (uint16_t y = 0; y < size; y++)
+	{
+		const float *row = &in[clamp_index(y, up->in_height) * up->in_width];
+		for (uint16_t x = 0; x < size; x++)
+			up->padded[y * size + x] = row[clamp_index(x, up->in_width)];
+	}
+
+	arm_bilinear_interp_instance_f32 table = {
+		.numRows = size,
+		.numCols = size,
+		.pData = up->padded,
+	};
+	for (uint16_t y = 0; y < up->out_height; y++)
+	{
+		float32_t ypos = up->rows[y].position + 1;
+		for (uint16_t x = 0; x < up->out_width; x++)
+			*out++ = arm_bilinear_interp_f32(&table, up->cols[x].position + 1, ypos);
+	}
+}
+
+static void bicubic_f32(upscaler *up, const float *in, float *out)
+{
+	uint16_t in_width = up->in_width;
+	uint16_t out_width = up->out_width;
+
+	float *mid = up->mid_f32;
+	for (uint16_t r = 0; r < up->in_height; r++)
+	{
+		const float *row = &in[r * in_width];
+		for (uint16_t x = 0; x < out_width; x++)
+		{
+			const upscale_tap *tap = &up->cols[x];
+			float acc = 0;
+			for (int k = 0; k < UPSCALE_TAPS; k++)
+				acc += tap->weight_f32[k] * row[tap->index[k]];
+			*mid++ = acc;
+		}
+	}
+
+	for (uint16_t y = 0; y < up->out_height; y++)
+	{
+		const upscale_tap *tap = &up->rows[y];
+		const float *src[UPSCALE_TAPS];
+		for (int k = 0; k < UPSCALE_TAPS; k++)
+			src[k] = &up->mid_f32[tap->index[k] * out_width];
+
+		for (uint16_t x = 0; x < out_width; x++)
+		{
+			float acc = 0;
+			for (int k = 0; k < UPSCALE_TAPS; k++)
+				acc += tap->weight_f32[k] * src[k][x];
+			*out++ = acc;
+		}
+	}
+}
+
+void upscale_f32(upscaler *up, const float *in, float *out)
+{
+	if (up->kernel == UPSCALE_BILINEAR)
+		bilinear_f32(up, in, out);
+	else
+		bicubic_f32(up, in, out);
+}
+
+void upscale_find_peak(const upscaler *up, const int16_t *out, upscale_peak *peak)
+{
+	uint32_t count = up->out_width * up->out_height;
+	uint32_t best = 0;
+	for (uint32_t i = 1; i < count; i++)
+	{
+		if (out[i] > out[best])
+			best = i;
+	}
+	peak->x = best % up->out_width;
+	peak->y = best / up->out_width;
+	peak->value = out[best];
+}
@@ -0,0 +1,82 @@
+# Optimized release build, included at the end of the project Makefiles
+#
+# `make release` builds build/release/$(PROJECT_NAME).bin next to the debug
+# build from `make`. It uses the double precision FPv5-D16 FPU with the hard
+# float ABI (instead of software floating point), $(RELEASE_OPT), link time
+# optimization and section garbage collection. The HAL and BSP sources are
+# compiled once into build/release/libhal.a, so changes to the application
+# don't rebuild them. Set RELEASE_OPT=-Os to optimize for size instead.
+#
+# `make report` writes build/release/$(PROJECT_NAME).report with the section
+# sizes per memory region. Built with BENCHMARK=1, the firmware runs a fixed
+# benchmark loop at startup and prints the cycles it takes; with
+# PORT=/dev/ttyACM0 the report target flashes the board and adds them.
+#
+# The project Makefile has to define PROJECT_NAME, SOURCES (without the HAL),
+# HAL_SOURCES, CFLAGS, INCLUDES, LDFLAGS and OPENOCD_FLAGS.
+
+AR = arm-none-eabi-gcc-ar
+OBJDUMP = arm-none-eabi-objdump
+
+RELEASE_DIR = build/release
+RELEASE_OPT ?= -O2
+
+ifeq ($(BENCHMARK),1)
+CFLAGS += -DBENCHMARK=1
+endif
+
+# Same defines and section flags as the debug build
+RELEASE_CFLAGS = $(filter-out -O% -lc -lm,$(CFLAGS))
+RELEASE_CFLAGS += -mfpu=fpv5-d16 -mfloat-abi=hard $(RELEASE_OPT) -flto
+
+# ../Common/Src/x.c is built as $(RELEASE_DIR)/Common/Src/x.o
+release_objects = $(addprefix $(RELEASE_DIR)/,$(subst ../,,$(1:.c=.o)))
+RELEASE_OBJECTS = $(call release_objects,$(SOURCES)) $(RELEASE_DIR)/startup_stm32h753xx.o
+RELEASE_HAL_OBJECTS = $(call release_objects,$(HAL_SOURCES))
+RELEASE_ELF = $(RELEASE_DIR)/$(PROJECT_NAME).elf
+
+release: $(RELEASE_DIR)/$(PROJECT_NAME).bin
+
+$(RELEASE_DIR)/%.o: ../%.c
+	@mkdir -p $(dir $@)
+	$(CC) $(RELEASE_CFLAGS) $(INCLUDES) -c $< -o $@
+
+$(RELEASE_DIR)/%.o: %.c
+	@mkdir -p $(dir $@)
+	$(CC) $(RELEASE_CFLAGS) $(INCLUDES) -c $< -o $@
+
+$(RELEASE_DIR)/%.o: %.s
+	@mkdir -p $(dir $@)
+	$(CC) $(RELEASE_CFLAGS) -c $< -o $@
+
+# gcc-ar adds the symbol index the linker needs for LTO objects
+$(RELEASE_DIR)/libhal.a: $(RELEASE_HAL_OBJECTS)
+	rm -f $@
+	$(AR) rcs $@ $^
+
+$(RELEASE_ELF): $(RELEASE_OBJECTS) $(RELEASE_DIR)/libhal.a
+	$(CC) $(RELEASE_CFLAGS) $(LDFLAGS) -o $@ $(RELEASE_OBJECTS) $(RELEASE_DIR)/libhal.a -lc -lm
+
+$(RELEASE_DIR)/$(PROJECT_NAME).bin: $(RELEASE_ELF)
+	$(OBJCOPY) -O binary $< $@
+
+REPORT_FLAGS = --objdump $(OBJDUMP) --linker-script $(firstword $(filter %.ld,$(LDFLAGS)))
+ifdef PORT
+REPORT_FLAGS += --port $(PORT) --reset-cmd "openocd $(OPENOCD_FLAGS) -c init -c 'reset run' -c shutdown"
+endif
+
+report: $(RELEASE_DIR)/$(PROJECT_NAME).bin
+ifdef PORT
+	openocd $(OPENOCD_FLAGS) -c "program $(RELEASE_DIR)/$(PROJECT_NAME).bin 0x08000000 verify exit"
+endif
+	../util/build_report.py $(REPORT_FLAGS) $(RELEASE_ELF) | tee $(RELEASE_DIR)/$(PROJECT_NAME).report
+
+flash-release: $(RELEASE_DIR)/$(PROJECT_NAME).bin
+	openocd $(OPENOCD_FLAGS) -c "program $(RELEASE_DIR)/$(PROJECT_NAME).bin 0x08000000 verify reset exit"
+
+clean-release:
+	rm -rf $(RELEASE_DIR)
+
+clean: clean-release
+
+.PHONY: release report flash-release clean-release
@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * Stand-in for CMSIS-DSP's arm_math.h, whose intrinsics only build for Arm.
+ * Only what the Common modules use, with the same behaviour as the original.
+ */
+
+#include <stdint.h>
+
+typedef float float32_t;
+
+typedef struct {
+	uint16_t numRows;
+	uint16_t numCols;
+	float32_t *pData;
+} arm_bilinear_interp_instance_f32;
+
+/* Same as the CMSIS-DSP version, including the 1-based coordinates */
+static inline float32_t arm_bilinear_interp_f32(const arm_bilinear_interp_instance_f32 *S,
+		float32_t X, float32_t Y)
+{
+	int32_t xIndex = (int32_t)X;
+	int32_t yIndex = (int32_t)Y;
+
+	if (xIndex < 0 || xIndex > (S->numRows - 1) || yIndex < 0 || yIndex > (S->numCols - 1))
+		return 0;
+
+	int32_t index = (xIndex - 1) + (yIndex - 1) * S->numCols;
+	float32_t f00 = S->pData[index];
+	float32_t f01 = S->pData[index + 1];
+	index = (xIndex - 1) + yIndex * S->numCols;
+	float32_t f10 = S->pData[index];
+	float32_t f11 = S->pData[index + 1];
+
+	float32_t xdiff = X - xIndex;
+	float32_t ydiff = Y - yIndex;
+	return f00 + (f01 - f00) * xdiff + (f10 - f00) * ydiff + (f00 - f01 - f10 + f11) * xdiff * ydiff;
+}
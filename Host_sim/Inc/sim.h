@@ -0,0 +1,139 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Simulated board for running the sensor drivers on the host.
+ *
+ * Time is virtual: it only moves when the bus is clocking or the code sleeps
+ * (HAL_Delay(), timebase_sleep_us()), so a 2 s delay returns at once.
+ *
+ * The drivers' i2c_stub.h and i2c_async.h calls go to a virtual I2C bus with
+ * device models attached. Each transaction takes the time its start, address,
+ * data and stop bits would take at I2C_SPEED_HZ. A transaction to an address
+ * without a device is not acknowledged.
+ *
+ * print() and the telemetry bytes go to the UART sink, stderr by default.
+ */
+
+/* Virtual time since the start of the simulation */
+uint64_t sim_time_us(void);
+void sim_advance_us(uint64_t us);
+
+/* A device on the virtual bus */
+typedef struct {
+	uint8_t addr; /* 7-bit, unshifted */
+	/* Write phase of a transaction, tx_len bytes */
+	void (*write)(void *context, const uint8_t *tx, uint16_t tx_len);
+	/* Read phase, fill rx_len bytes */
+	void (*read)(void *context, uint8_t *rx, uint16_t rx_len);
+	void *context;
+} sim_i2c_device;
+
+/* Attach a device, at most SIM_I2C_MAX_DEVICES */
+#define SIM_I2C_MAX_DEVICES 4
+void sim_i2c_attach(const sim_i2c_device *device);
+
+typedef struct {
+	uint32_t transactions;
+	uint32_t nacks;
+	uint32_t bytes;   /* data bytes in both directions, without addresses */
+	uint64_t bus_us;  /* time the bus was busy */
+} sim_i2c_stats;
+
+void sim_i2c_get_stats(sim_i2c_stats *stats);
+
+/* The next count transactions are not acknowledged, like a device that hangs */
+void sim_i2c_fail(uint32_t count);
+
+/* Where the UART sink writes to, NULL to only count the bytes */
+void sim_uart_open(const char *path);
+uint32_t sim_uart_bytes(void);
+
+/*
+ * Send the UART bytes to buffer instead, up to size of them, until the next
+ * call. Returns the number of bytes captured since the previous call, so
+ * sim_uart_capture(NULL, 0) ends a capture.
+ */
+uint32_t sim_uart_capture(uint8_t *buffer, uint32_t size);
+
+/*
+ * Cost of a driver call: transactions, bytes, bus time and virtual time from
+ * sim_call_begin() to sim_call_end(), which writes them as one report line.
+ */
+typedef struct {
+	sim_i2c_stats i2c;
+	uint64_t start_us;
+} sim_call;
+
+void sim_call_begin(sim_call *call);
+void sim_call_end(const sim_call *call, const char *name);
+void sim_call_header(void);
+
+#define SIM_CALL(name, statement)      \
+	do {                               \
+		sim_call call_;                \
+		sim_call_begin(&call_);        \
+		statement;                     \
+		sim_call_end(&call_, (name));  \
+	} while (0)
+
+/*
+ * AMG88 (GridEYE) model at address 0x69: the register file with pixel and
+ * thermistor temperatures, frame rate, interrupt levels, table and status.
+ * A new frame comes from the scene every 100 ms (1 s at 1 FPS) of virtual time
+ * while the sensor is in normal mode.
+ *
+ * The scene fills the 64 pixels in quarter degrees Celsius for a frame number.
+ * Without one, a warm spot drifts over a 22 C background with 1 LSB of noise.
+ */
+typedef void (*amg88_scene)(uint32_t frame, int16_t pixels[64], void *context);
+
+void amg88_attach(void);
+void amg88_set_scene(amg88_scene scene, void *context);
+/* The frame in the temperature registers right now */
+void amg88_current_frame(int16_t pixels[64]);
+
+/*
+ * AS7265x model at address 0x49: the STATUS/WRITE/READ handshake, where the
+ * slave takes AS7265X_SIM_SLAVE_US to act on each byte written to WRITE, and
+ * the virtual registers of the three devices. A one-shot measurement becomes
+ * ready after twice the integration time.
+ */
+#ifndef AS7265X_SIM_SLAVE_US
+#define AS7265X_SIM_SLAVE_US 100
+#endif
+
+void as7265x_attach(void);
+/* Bytes written to WRITE while the slave was still busy with the previous one */
+uint32_t as7265x_overruns(void);
+
+/*
+ * GridEYE frames recorded on the board: a raw capture of its UART, e.g.
+ * `cat /dev/ttyACM0 > walk.bin` while the button is held, of which the
+ * TELEMETRY_TYPE_GRIDEYE_FRAME frames with a valid CRC are kept and
+ * everything else is skipped. As a scene, frame n of the AMG88 is recorded
+ * frame n, and the recording loops.
+ */
+typedef struct {
+	int16_t (*frames)[64];
+	uint32_t count;
+} sim_recording;
+
+/* False if the file can't be read or holds no GridEYE frames */
+bool sim_recording_load(sim_recording *recording, const char *path);
+void sim_recording_free(sim_recording *recording);
+void sim_recording_scene(uint32_t frame, int16_t pixels[64], void *context);
+
+/*
+ * Flash behind the HAL_FLASH functions, see sim_flash in stm32h7xx_hal.h. It
+ * starts out as zeros, not erased, like a sector that held something else.
+ */
+typedef struct {
+	uint32_t erases;     /* sectors */
+	uint32_t words;      /* flash words programmed */
+	uint32_t reprograms; /* refused, the word was not erased */
+} sim_flash_stats;
+
+void sim_flash_get_stats(sim_flash_stats *stats);
@@ -0,0 +1,150 @@
+#pragma once
+
+/*
+ * Stand-in for the STM32H7 HAL and CMSIS headers on the host. It declares just
+ * what the drivers and the headers in ../Common/Inc use, backed by the virtual
+ * clock and I2C bus in sim.h.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+	HAL_OK = 0x00,
+	HAL_ERROR = 0x01,
+	HAL_BUSY = 0x02,
+	HAL_TIMEOUT = 0x03,
+} HAL_StatusTypeDef;
+
+#define HAL_I2C_ERROR_NONE 0x00000000U
+#define HAL_I2C_ERROR_BERR 0x00000001U
+#define HAL_I2C_ERROR_AF   0x00000004U
+
+typedef struct {
+	uint32_t Timing;
+} I2C_InitTypeDef;
+
+typedef struct {
+	I2C_InitTypeDef Init;
+} I2C_HandleTypeDef;
+
+typedef struct {
+	uint32_t BaudRate;
+} UART_InitTypeDef;
+
+typedef struct {
+	UART_InitTypeDef Init;
+} UART_HandleTypeDef;
+
+/* HAL tick in ms and HAL_Delay(), both on the virtual clock */
+uint32_t HAL_GetTick(void);
+void HAL_Delay(uint32_t ms);
+
+/* TIM2 counter for timebase_us(), kept at the virtual time in us */
+typedef struct {
+	volatile uint32_t CNT;
+} TIM_TypeDef;
+extern TIM_TypeDef sim_tim2;
+#define TIM2 (&sim_tim2)
+
+/* DWT cycle counter for profile.h, counts virtual time at SystemCoreClock */
+typedef struct {
+	volatile uint32_t CTRL;
+	volatile uint32_t CYCCNT;
+	volatile uint32_t LAR;
+} DWT_Type;
+extern DWT_Type sim_dwt;
+#define DWT (&sim_dwt)
+#define DWT_CTRL_CYCCNTENA_Msk 1UL
+
+typedef struct {
+	volatile uint32_t DEMCR;
+} CoreDebug_Type;
+extern CoreDebug_Type sim_core_debug;
+#define CoreDebug (&sim_core_debug)
+#define CoreDebug_DEMCR_TRCENA_Msk (1UL << 24)
+
+extern uint32_t SystemCoreClock;
+
+/* CMSIS intrinsics, there is a single thread and no interrupts */
+#define __DMB() __sync_synchronize()
+#define __DSB() __sync_synchronize()
+#define __ISB() __sync_synchronize()
+#define __WFI() do {} while (0)
+#define __disable_irq() do {} while (0)
+#define __enable_irq() do {} while (0)
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+static inline uint32_t __CLZ(uint32_t value) { return value ? __builtin_clz(value) : 32; }
+
+/*
+ * Exclusive accesses that always succeed. pool.c keeps pointers in 32 bit
+ * words, so the Makefile links without PIE to keep the pools below 4G.
+ */
+static inline uint32_t __LDREXW(volatile uint32_t *addr) { return *addr; }
+static inline uint32_t __STREXW(uint32_t value, volatile uint32_t *addr) { *addr = value; return 0; }
+#define __CLREX() do {} while (0)
+
+/*
+ * Flash of two 1M banks with 128K sectors, backed by sim_flash. Addresses are
+ * host pointers into it, so FLASH_BANK1_BASE is the array itself.
+ */
+#define FLASH_BANK_SIZE                 0x00100000UL
+#define FLASH_SECTOR_SIZE               0x00020000UL
+#define FLASH_NB_32BITWORD_IN_FLASHWORD 8U
+extern uint8_t sim_flash[2 * FLASH_BANK_SIZE];
+#define FLASH_BANK1_BASE ((uintptr_t)sim_flash)
+
+#define FLASH_TYPEERASE_SECTORS      0x00U
+#define FLASH_BANK_1                 0x01U
+#define FLASH_BANK_2                 0x02U
+#define FLASH_VOLTAGE_RANGE_3        0x00000020U
+#define FLASH_TYPEPROGRAM_FLASHWORD  0x01U
+
+typedef struct {
+	uint32_t TypeErase;
+	uint32_t Banks;
+	uint32_t Sector;
+	uint32_t NbSectors;
+	uint32_t VoltageRange;
+} FLASH_EraseInitTypeDef;
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void);
+HAL_StatusTypeDef HAL_FLASH_Lock(void);
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *erase, uint32_t *sector_error);
+/* Pointers as uintptr_t instead of the HAL's uint32_t, for 64 bit hosts */
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uintptr_t flash_address, uintptr_t data_address);
+
+/*
+ * CRC unit, computed bit by bit like the hardware: MSB first with the default
+ * polynomial 0x04C11DB7 and initial value 0xFFFFFFFF, and the configured
+ * input and output bit reversal. Only byte input is modelled.
+ */
+#define DEFAULT_POLYNOMIAL_ENABLE        0x00U
+#define DEFAULT_INIT_VALUE_ENABLE        0x00U
+#define CRC_INPUTDATA_INVERSION_NONE     0x00000000U
+#define CRC_INPUTDATA_INVERSION_BYTE     0x00000020U
+#define CRC_OUTPUTDATA_INVERSION_DISABLE 0x00000000U
+#define CRC_OUTPUTDATA_INVERSION_ENABLE  0x00000080U
+#define CRC_INPUTDATA_FORMAT_BYTES       0x00000001U
+
+typedef struct {
+	uint8_t DefaultPolynomialUse;
+	uint8_t DefaultInitValueUse;
+	uint32_t InputDataInversionMode;
+	uint32_t OutputDataInversionMode;
+} CRC_InitTypeDef;
+
+typedef struct {
+	void *Instance;
+	CRC_InitTypeDef Init;
+	uint32_t InputDataFormat;
+} CRC_HandleTypeDef;
+
+#define CRC NULL
+#define __HAL_RCC_CRC_CLK_ENABLE() do {} while (0)
+
+HAL_StatusTypeDef HAL_CRC_Init(CRC_HandleTypeDef *hcrc);
+/* Length in bytes with CRC_INPUTDATA_FORMAT_BYTES, as in the HAL */
+uint32_t HAL_CRC_Calculate(CRC_HandleTypeDef *hcrc, uint32_t *buffer, uint32_t length);
@@ -0,0 +1,210 @@
+#include <string.h>
+#include "sim.h"
+
+#define AMG88_ADDR 0x69
+
+/* Registers, see SparkFun_GridEYE_Arduino_Library.h */
+#define PCTL   0x00
+#define RST    0x01
+#define FPSC   0x02
+#define INTC   0x03
+#define STAT   0x04
+#define SCLR   0x05
+#define AVE    0x07
+#define INTHL  0x08
+#define INTLL  0x0A
+#define IHYSL  0x0C
+#define TTHL   0x0E
+#define INT0   0x10
+#define T01L   0x80
+
+#define PCTL_NORMAL 0x00
+#define RST_FLAG    0x30
+#define RST_INITIAL 0x3F
+#define INTC_INTEN  0x01
+#define INTC_INTMOD 0x02 /* absolute instead of difference mode */
+#define STAT_INTF   0x02
+
+#define PIXELS 64
+
+/* Thermistor at 25 C, 0.0625 C per LSB */
+#define THERMISTOR_RAW 400
+
+typedef struct {
+	uint8_t regs[256];
+	uint8_t pointer;
+	int16_t pixels[PIXELS];
+	int16_t previous[PIXELS];
+	uint32_t frame;       /* number of the frame in the registers */
+	uint64_t frame_start; /* virtual time frame 0 started */
+	amg88_scene scene;
+	void *context;
+} amg88;
+
+static amg88 sensor;
+
+/* Warm spot drifting over a 22 C background, with 1 LSB of noise */
+static void default_scene(uint32_t frame, int16_t pixels[64], void *context)
+{
+	(void)context;
+	static uint32_t seed = 1;
+	int x0 = frame / 10 % 8;
+	int y0 = (frame / 80) % 8;
+	for (int i = 0; i < PIXELS; i++)
+	{
+		int dx = i % 8 - x0;
+		int dy = i / 8 - y0;
+		int d2 = dx * dx + dy * dy;
+		int16_t t = 88; /* 22 C */
+		if (d2 <= 2)
+			t += 48 - 16 * d2; /* up to 34 C */
+		seed = seed * 1103515245 + 12345;
+		t += (int)((seed >> 16) % 3) - 1;
+		pixels[i] = t;
+	}
+}
+
+static int16_t get12(uint8_t reg)
+{
+	uint16_t value = sensor.regs[reg] | (sensor.regs[reg + 1] << 8);
+	value &= 0x0FFF;
+	return (value & 0x0800) ? (int16_t)(value | 0xF000) : (int16_t)value;
+}
+
+static void put12(uint8_t reg, int16_t value)
+{
+	uint16_t v = (uint16_t)value & 0x0FFF;
+	sensor.regs[reg] = v & 0xFF;
+	sensor.regs[reg + 1] = v >> 8;
+}
+
+/* Interrupt table and flag for the frame that was just loaded */
+static void update_interrupts(void)
+{
+	uint8_t intc = sensor.regs[INTC];
+	int16_t upper = get12(INTHL);
+	int16_t lower = get12(INTLL);
+	bool any = false;
+
+	memset(&sensor.regs[INT0], 0, 8);
+	for (int i = 0; i < PIXELS; i++)
+	{
+		int16_t value = sensor.pixels[i];
+		if (!(intc & INTC_INTMOD))
+			value -= sensor.previous[i];
+		if (value > upper || value < lower)
+		{
+			sensor.regs[INT0 + i / 8] |= 1 << (i % 8);
+			any = true;
+		}
+	}
+	if (any && (intc & INTC_INTEN))
+		sensor.regs[STAT] |= STAT_INTF;
+}
+
+static void load_frame(uint32_t frame)
+{
+	memcpy(sensor.previous, sensor.pixels, sizeof(sensor.pixels));
+	sensor.scene(frame, sensor.pixels, sensor.context);
+	for (int i = 0; i < PIXELS; i++)
+		put12(T01L + 2 * i, sensor.pixels[i]);
+	sensor.frame = frame;
+	update_interrupts();
+}
+
+/* Bring the registers up to the current virtual time */
+static void update(void)
+{
+	if (sensor.regs[PCTL] != PCTL_NORMAL)
+		return;
+
+	uint64_t period = (sensor.regs[FPSC] & 0x01) ? 1000000 : 100000;
+	uint32_t frame = (uint32_t)((sim_time_us() - sensor.frame_start) / period);
+	if (frame != sensor.frame)
+		load_frame(frame);
+}
+
+static void reset(bool initial)
+{
+	if (initial)
+	{
+		uint8_t pointer = sensor.pointer;
+		memset(sensor.regs, 0, sizeof(sensor.regs));
+		sensor.pointer = pointer;
+		put12(TTHL, THERMISTOR_RAW);
+		sensor.frame_start = sim_time_us();
+		load_frame(0);
+	}
+	sensor.regs[STAT] = 0;
+	memset(&sensor.regs[INT0], 0, 8);
+}
+
+static void bus_write(void *context, const uint8_t *tx, uint16_t tx_len)
+{
+	(void)context;
+	update();
+	if (tx_len == 0)
+		return;
+
+	/* The first byte sets the register pointer, the rest is written from there */
+	sensor.pointer = tx[0];
+	for (uint16_t i = 1; i < tx_len; i++)
+	{
+		uint8_t reg = sensor.pointer++;
+		switch (reg)
+		{
+		case RST:
+			if (tx[i] == RST_INITIAL || tx[i] == RST_FLAG)
+				reset(tx[i] == RST_INITIAL);
+			break;
+		case SCLR:
+			sensor.regs[STAT] &= ~tx[i];
+			if (tx[i] & STAT_INTF)
+				memset(&sensor.regs[INT0], 0, 8);
+			break;
+		case STAT:
+		case TTHL:
+		case TTHL + 1:
+			break; /* read only */
+		default:
+			if (reg < T01L && (reg < INT0 || reg >= INT0 + 8))
+				sensor.regs[reg] = tx[i];
+			break;
+		}
+	}
+}
+
+static void bus_read(void *context, uint8_t *rx, uint16_t rx_len)
+{
+	(void)context;
+	update();
+	for (uint16_t i = 0; i < rx_len; i++)
+		rx[i] = sensor.regs[sensor.pointer++];
+}
+
+void amg88_set_scene(amg88_scene scene, void *context)
+{
+	sensor.scene = scene != NULL ? scene : default_scene;
+	sensor.context = context;
+	sensor.frame_start = sim_time_us();
+	load_frame(0);
+}
+
+void amg88_current_frame(int16_t pixels[64])
+{
+	update();
+	memcpy(pixels, sensor.pixels, sizeof(sensor.pixels));
+}
+
+void amg88_attach(void)
+{
+	sensor.scene = default_scene;
+	reset(true);
+
+	static const sim_i2c_device device = {
+		.addr = AMG88_ADDR,
+		.write = bus_write,
+		.read = bus_read,
+	};
+	sim_i2c_attach(&device);
+}
@@ -0,0 +1,261 @@
+#include <string.h>
+#include "sim.h"
+
+#define AS7265X_ADDR 0x49
+
+/* Physical registers */
+#define STATUS_REG 0x00
+#define WRITE_REG  0x01
+#define READ_REG   0x02
+#define TX_VALID   0x02
+#define RX_VALID   0x01
+
+/* Virtual registers, see SparkFun_AS7265X.h */
+#define HW_VERSION_HIGH  0x00
+#define HW_VERSION_LOW   0x01
+#define CONFIG           0x04
+#define INTEGRATION_TIME 0x05
+#define DEVICE_TEMP      0x06
+#define RAW_START        0x08
+#define CAL_START        0x14
+#define DEV_SELECT       0x4F
+
+#define CONFIG_RST      0x80
+#define CONFIG_DATA_RDY 0x02
+#define CONFIG_BANK(v)  (((v) >> 2) & 0x03)
+#define BANK_CONTINUOUS 2
+#define BANK_ONE_SHOT   3
+
+/* Both slaves found, in the upper bits of DEV_SELECT */
+#define SLAVES_PRESENT 0x30
+
+#define DEVICES  3
+#define CHANNELS 6
+
+/* Wavelength in nm of each device's channels, in register order */
+static const uint16_t wavelengths[DEVICES][CHANNELS] = {
+	{610, 680, 730, 760, 810, 860}, /* AS72651, NIR */
+	{560, 585, 645, 705, 900, 940}, /* AS72652, visible */
+	{410, 435, 460, 485, 510, 535}, /* AS72653, UV */
+};
+
+static const float gains[4] = {1.0f, 3.7f, 16.0f, 64.0f};
+
+typedef struct {
+	uint8_t pointer;      /* physical register */
+	uint8_t vregs[DEVICES][0x80];
+	uint8_t config;       /* shared by the devices, like the selection */
+	uint8_t integration;
+	uint8_t selected;
+
+	/* Byte written to WRITE, acted on at tx_done */
+	bool tx_valid;
+	uint8_t tx_byte;
+	uint64_t tx_done;
+	/* After an address with bit 7 set, the next byte is its data */
+	bool write_pending;
+	uint8_t write_addr;
+
+	bool rx_valid;
+	uint8_t rx_byte;
+
+	bool measuring;
+	uint64_t measurement_done;
+	uint32_t overruns;
+} as7265x;
+
+static as7265x sensor;
+
+/* A smooth spectrum with a peak in the visible range, in uW/cm^2 */
+static float irradiance(uint16_t nm)
+{
+	float x = (nm - 560.0f) / 150.0f;
+	return 40.0f / (1.0f + x * x);
+}
+
+static void put_be32(uint8_t *dst, uint32_t value)
+{
+	dst[0] = value >> 24;
+	dst[1] = value >> 16;
+	dst[2] = value >> 8;
+	dst[3] = value;
+}
+
+static void measurement_ready(void)
+{
+	float gain = gains[(sensor.config >> 4) & 0x03];
+	float cycles = sensor.integration + 1;
+
+	for (int d = 0; d < DEVICES; d++)
+	{
+		for (int c = 0; c < CHANNELS; c++)
+		{
+			float cal = irradiance(wavelengths[d][c]);
+			float counts = cal * gain * cycles / 4.0f;
+			uint16_t raw = counts > 65535.0f ? 65535 : (uint16_t)counts;
+
+			sensor.vregs[d][RAW_START + 2 * c] = raw >> 8;
+			sensor.vregs[d][RAW_START + 2 * c + 1] = raw & 0xFF;
+			uint32_t bits;
+			memcpy(&bits, &cal, sizeof(bits));
+			put_be32(&sensor.vregs[d][CAL_START + 4 * c], bits);
+		}
+	}
+	sensor.config |= CONFIG_DATA_RDY;
+	sensor.measuring = false;
+}
+
+/* Twice the integration time of 2.8 ms per cycle, for all six channels */
+static void start_measurement(void)
+{
+	sensor.config &= ~CONFIG_DATA_RDY;
+	sensor.measuring = true;
+	sensor.measurement_done = sim_time_us() + 2 * 2800 * (sensor.integration + 1);
+}
+
+static void reset(void)
+{
+	memset(sensor.vregs, 0, sizeof(sensor.vregs));
+	for (int d = 0; d < DEVICES; d++)
+	{
+		sensor.vregs[d][HW_VERSION_HIGH] = 0x40;
+		sensor.vregs[d][HW_VERSION_LOW] = 0x41;
+		sensor.vregs[d][DEVICE_TEMP] = 28 + d;
+	}
+	sensor.config = BANK_ONE_SHOT << 2;
+	sensor.integration = 0xFF;
+	sensor.selected = 0;
+	sensor.measuring = false;
+}
+
+static uint8_t virtual_read(uint8_t addr)
+{
+	switch (addr)
+	{
+	case CONFIG:
+		return sensor.config;
+	case INTEGRATION_TIME:
+		return sensor.integration;
+	case DEV_SELECT:
+		return SLAVES_PRESENT | sensor.selected;
+	default:
+		return sensor.vregs[sensor.selected][addr & 0x7F];
+	}
+}
+
+static void virtual_write(uint8_t addr, uint8_t value)
+{
+	switch (addr)
+	{
+	case CONFIG:
+		if (value & CONFIG_RST)
+		{
+			reset();
+			return;
+		}
+		sensor.config = (sensor.config & CONFIG_DATA_RDY) | (value & ~CONFIG_DATA_RDY);
+		if (CONFIG_BANK(value) >= BANK_CONTINUOUS)
+			start_measurement();
+		break;
+	case INTEGRATION_TIME:
+		sensor.integration = value;
+		break;
+	case DEV_SELECT:
+		sensor.selected = (value & 0x03) < DEVICES ? (value & 0x03) : 0;
+		break;
+	default:
+		sensor.vregs[sensor.selected][addr & 0x7F] = value;
+		break;
+	}
+}
+
+/* Let the slave catch up with the virtual time */
+static void update(void)
+{
+	uint64_t now = sim_time_us();
+
+	if (sensor.measuring && now >= sensor.measurement_done)
+	{
+		measurement_ready();
+		if (CONFIG_BANK(sensor.config) == BANK_CONTINUOUS)
+			start_measurement();
+	}
+
+	if (sensor.tx_valid && now >= sensor.tx_done)
+	{
+		uint8_t byte = sensor.tx_byte;
+		sensor.tx_valid = false;
+		if (sensor.write_pending)
+		{
+			sensor.write_pending = false;
+			virtual_write(sensor.write_addr, byte);
+		}
+		else if (byte & 0x80)
+		{
+			sensor.write_pending = true;
+			sensor.write_addr = byte & 0x7F;
+		}
+		else
+		{
+			sensor.rx_byte = virtual_read(byte);
+			sensor.rx_valid = true;
+		}
+	}
+}
+
+static void bus_write(void *context, const uint8_t *tx, uint16_t tx_len)
+{
+	(void)context;
+	update();
+	if (tx_len == 0)
+		return;
+
+	sensor.pointer = tx[0];
+	if (tx_len < 2 || sensor.pointer != WRITE_REG)
+		return;
+
+	if (sensor.tx_valid)
+		sensor.overruns++;
+	sensor.tx_valid = true;
+	sensor.tx_byte = tx[1];
+	sensor.tx_done = sim_time_us() + AS7265X_SIM_SLAVE_US;
+}
+
+static void bus_read(void *context, uint8_t *rx, uint16_t rx_len)
+{
+	(void)context;
+	update();
+	for (uint16_t i = 0; i < rx_len; i++)
+	{
+		switch (sensor.pointer)
+		{
+		case STATUS_REG:
+			rx[i] = (sensor.tx_valid ? TX_VALID : 0) | (sensor.rx_valid ? RX_VALID : 0);
+			break;
+		case READ_REG:
+			rx[i] = sensor.rx_byte;
+			sensor.rx_valid = false;
+			break;
+		default:
+			rx[i] = 0;
+			break;
+		}
+	}
+}
+
+uint32_t as7265x_overruns(void)
+{
+	return sensor.overruns;
+}
+
+void as7265x_attach(void)
+{
+	reset();
+
+	static const sim_i2c_device device = {
+		.addr = AS7265X_ADDR,
+		.write = bus_write,
+		.read = bus_read,
+	};
+	sim_i2c_attach(&device);
+}
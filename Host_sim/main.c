@@ -0,0 +1,1075 @@
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "stm32h7xx_hal.h"
+#include "sim.h"
+#include "SparkFun_GridEYE_Arduino_Library.h"
+#include "SparkFun_AS7265X.h"
+#include "upscale.h"
+#include "presence.h"
+#include "nuc.h"
+#include "flash_store.h"
+#include "denoise.h"
+#include "console.h"
+#include "telemetry.h"
+#include "debug.h"
+#include "profile.h"
+#include "timebase.h"
+#include "ring.h"
+#include "pool.h"
+
+/*
+ * Runs the driver calls the projects use against the simulated sensors and
+ * writes what each one costs on the bus. Exits with 1 if a driver read back
+ * something other than what the model holds.
+ *
+ *	./sim [-u uart.log] [-r recording.bin] [-t telemetry.bin]
+ *
+ * With -r, the presence detection also runs on GridEYE frames recorded on the
+ * board, see sim_recording_load(). With -t, the text and telemetry frames of
+ * the telemetry check are written to a file, for util/telemetry.py.
+ */
+
+static int failures;
+
+static void check(bool ok, const char *what)
+{
+	if (!ok)
+	{
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+static void grideye(void)
+{
+	int16_t frame[GRIDEYE_PIXEL_COUNT];
+	int16_t expected[GRIDEYE_PIXEL_COUNT];
+	uint8_t table[GRIDEYE_INT_TABLE_LENGTH];
+	float temp = 0;
+
+	SIM_CALL("GridEYE_begin", GridEYE_begin());
+
+	SIM_CALL("GridEYE_readFrame", GridEYE_readFrame(frame));
+	amg88_current_frame(expected);
+	check(memcmp(frame, expected, sizeof(frame)) == 0, "GridEYE_readFrame matches the model");
+
+	SIM_CALL("GridEYE_getPixelTemperature", temp = GridEYE_getPixelTemperature(0));
+	amg88_current_frame(expected);
+	check(temp == expected[0] * 0.25f, "GridEYE_getPixelTemperature matches the model");
+
+	/* What reading a frame took before the burst read */
+	SIM_CALL("GridEYE_getPixelTemperature x 64",
+		for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+			GridEYE_getPixelTemperature(i));
+
+	SIM_CALL("GridEYE_getDeviceTemperature", temp = GridEYE_getDeviceTemperature());
+	check(temp == 25.0f, "GridEYE_getDeviceTemperature is 25 C");
+
+	SIM_CALL("GridEYE_setUpperInterruptValue", GridEYE_setUpperInterruptValue(30.0f));
+	SIM_CALL("GridEYE_setLowerInterruptValue", GridEYE_setLowerInterruptValue(-20.0f));
+	SIM_CALL("GridEYE_setInterruptModeAbsolute", GridEYE_setInterruptModeAbsolute());
+	SIM_CALL("GridEYE_interruptPinEnable", GridEYE_interruptPinEnable());
+
+	/* The default scene's warm spot is above 30 C in the next frame */
+	HAL_Delay(100);
+	bool flagged = false;
+	SIM_CALL("GridEYE_interruptFlagSet", flagged = GridEYE_interruptFlagSet());
+	check(flagged, "GridEYE interrupt flag is set by the warm spot");
+	SIM_CALL("GridEYE_readInterruptTable", GridEYE_readInterruptTable(table));
+	SIM_CALL("GridEYE_clearAllStatusFlags", GridEYE_clearAllStatusFlags());
+	check(!GridEYE_interruptFlagSet(), "GridEYE interrupt flag is cleared");
+}
+
+/* Pixels over the whole 12 bit range, to check the sign extension */
+static void range_scene(uint32_t frame, int16_t pixels[64], void *context)
+{
+	(void)context;
+	for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+		pixels[i] = (int16_t)(i * 64 - 2048 + frame % 64);
+}
+
+/* The same, without changing between frames */
+static void still_range_scene(uint32_t frame, int16_t pixels[64], void *context)
+{
+	(void)frame;
+	range_scene(0, pixels, context);
+}
+
+static void grideye_fixed_point(void)
+{
+	int16_t frame[GRIDEYE_PIXEL_COUNT];
+	int16_t expected[GRIDEYE_PIXEL_COUNT];
+	char text[GRIDEYE_FORMAT_LENGTH];
+	char reference[32];
+
+	amg88_set_scene(range_scene, NULL);
+	GridEYE_readFrame(frame);
+	amg88_current_frame(expected);
+	check(memcmp(frame, expected, sizeof(frame)) == 0, "GridEYE_decodeFrame sign-extends negative pixels");
+
+	/* The burst read against the original pixel by pixel conversion */
+	float temps[GRIDEYE_PIXEL_COUNT];
+	amg88_set_scene(still_range_scene, NULL);
+	GridEYE_readFrame(frame);
+	GridEYE_convertFrameToFloat(frame, temps);
+	bool same = true;
+	for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+		same &= temps[i] == GridEYE_getPixelTemperature(i);
+	check(same, "GridEYE_readFrame matches GridEYE_convertSigned12ToFloat of each pixel");
+
+	/* A failed read must not hand back the buffer as a frame */
+	uint8_t table[GRIDEYE_INT_TABLE_LENGTH];
+	sim_i2c_fail(1);
+	check(!GridEYE_readFrame(frame), "GridEYE_readFrame fails when the sensor does not acknowledge");
+	sim_i2c_fail(1);
+	check(!GridEYE_readInterruptTable(table), "GridEYE_readInterruptTable fails when the sensor does not acknowledge");
+	check(GridEYE_readFrame(frame), "GridEYE_readFrame works again after a failed read");
+	amg88_set_scene(NULL, NULL);
+
+	bool exact = true;
+	for (int32_t q = INT16_MIN; q <= INT16_MAX; q++)
+	{
+		GridEYE_formatQuarters(q, text);
+		snprintf(reference, sizeof(reference), "%.2f", q * 0.25);
+		exact &= strcmp(text, reference) == 0;
+	}
+	check(exact, "GridEYE_formatQuarters matches %.2f for all int16_t");
+}
+
+/* Both kernels of both paths on a frame of the default scene */
+static void upscale(void)
+{
+	static upscaler up;
+	int16_t frame[GRIDEYE_PIXEL_COUNT];
+	float frame_f32[GRIDEYE_PIXEL_COUNT];
+	int16_t big[32 * 32];
+	float big_f32[32 * 32];
+
+	check(!upscale_init(&up, 8, 8, UPSCALE_MAX_OUTPUT + 1, 32, UPSCALE_BILINEAR), "upscale_init rejects outputs that do not fit");
+
+	GridEYE_readFrame(frame);
+	for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+		frame_f32[i] = frame[i];
+
+	for (int kernel = UPSCALE_BILINEAR; kernel <= UPSCALE_BICUBIC; kernel++)
+	{
+		upscale_init(&up, 8, 8, 32, 32, kernel);
+		upscale_q15(&up, frame, big);
+		upscale_f32(&up, frame_f32, big_f32);
+
+		bool corners = big[0] == frame[0] && big[31] == frame[7] &&
+				big[31 * 32] == frame[56] && big[32 * 32 - 1] == frame[63];
+		check(corners, "upscale_q15 keeps the corner pixels");
+
+		bool close = true;
+		for (int i = 0; i < 32 * 32; i++)
+			close &= fabsf(big[i] - big_f32[i]) <= 1.0f;
+		check(close, "upscale_q15 is within 1 LSB of upscale_f32");
+
+		upscale_peak peak;
+		upscale_find_peak(&up, big, &peak);
+		int16_t hottest = INT16_MIN;
+		for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+			hottest = frame[i] > hottest ? frame[i] : hottest;
+		check(peak.value >= hottest, "upscale_find_peak is at least the hottest pixel");
+	}
+
+	/* A flat frame stays flat, also with the overshoot of bicubic */
+	for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+		frame[i] = GRIDEYE_QUARTERS(21);
+	upscale_q15(&up, frame, big);
+	bool flat = true;
+	for (int i = 0; i < 32 * 32; i++)
+		flat &= big[i] == frame[0];
+	check(flat, "upscale_q15 keeps a flat frame flat");
+}
+
+/*
+ * People walking through the frame at a third of a pixel per frame, as bumps
+ * up to 8 C warmer than a 22 C background: one from the left to the right,
+ * one back, then two passing each other in different rows. With the default
+ * counting line that makes two exits and two entries.
+ */
+typedef struct {
+	uint32_t start;
+	uint32_t end;
+	float x0, y0, x1, y1;
+} walker;
+
+static const walker walkers[] = {
+	{ 30,  60, -1.5f, 3.0f,  8.5f, 3.0f},
+	{ 80, 110,  8.5f, 4.5f, -1.5f, 4.5f},
+	{140, 170, -1.5f, 1.0f,  8.5f, 1.5f},
+	{140, 170,  8.5f, 6.0f, -1.5f, 5.5f},
+};
+
+#define WALKERS_FRAMES 200
+
+static void walkers_scene(uint32_t frame, int16_t pixels[64], void *context)
+{
+	(void)context;
+	static uint32_t seed = 7;
+	for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		float t = 88 + (int)((seed >> 16) % 3) - 1;
+		for (unsigned w = 0; w < sizeof(walkers) / sizeof(walkers[0]); w++)
+		{
+			const walker *walker = &walkers[w];
+			if (frame < walker->start || frame > walker->end)
+				continue;
+			float f = (float)(frame - walker->start) / (walker->end - walker->start);
+			float dx = i % 8 - (walker->x0 + (walker->x1 - walker->x0) * f);
+			float dy = i / 8 - (walker->y0 + (walker->y1 - walker->y0) * f);
+			t += 32 * expf(-(dx * dx + dy * dy) / 1.5f);
+		}
+		pixels[i] = (int16_t)lroundf(t);
+	}
+}
+
+static uint64_t host_ns(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Read frames of a scene at 10 frames per second and run the presence
+ * detection on them, upscaled to size x size unless that is 8. Writes the
+ * counts and the host time presence_update() took.
+ */
+static void presence_replay(const char *name, amg88_scene scene, void *context,
+		uint32_t frames, uint16_t size, presence_stats *stats)
+{
+	static presence pr;
+	static upscaler up;
+	int16_t frame[GRIDEYE_PIXEL_COUNT];
+	int16_t big[32 * 32];
+	presence_config config;
+
+	presence_default_config(&config, size, size);
+	presence_init(&pr, &config);
+	if (size != 8)
+		upscale_init(&up, 8, 8, size, size, UPSCALE_BICUBIC);
+
+	amg88_set_scene(scene, context);
+	uint64_t start = sim_time_us();
+	uint64_t total_ns = 0;
+	uint64_t max_ns = 0;
+	for (uint32_t n = 0; n < frames; n++)
+	{
+		/* Halfway through each of the sensor's frames */
+		sim_advance_us(start + n * 100000ULL + 50000 - sim_time_us());
+		GridEYE_readFrame(frame);
+		const int16_t *in = frame;
+		if (size != 8)
+		{
+			upscale_q15(&up, frame, big);
+			in = big;
+		}
+
+		uint64_t t0 = host_ns();
+		presence_update(&pr, in, (uint32_t)sim_time_us());
+		uint64_t ns = host_ns() - t0;
+		total_ns += ns;
+		if (ns > max_ns)
+			max_ns = ns;
+	}
+	amg88_set_scene(NULL, NULL);
+
+	presence_get_stats(&pr, stats);
+	printf("%-16s %2ux%-2u %6u %7u %8u %6u %10.2f %10.2f\n", name, size, size, frames,
+			stats->tracks, stats->entries, stats->exits,
+			total_ns / 1000.0 / frames, max_ns / 1000.0);
+}
+
+static void presence_header(void)
+{
+	printf("\n%-16s %5s %6s %7s %8s %6s %10s %10s\n", "presence", "grid", "frames",
+			"tracks", "entries", "exits", "us/frame", "max us");
+}
+
+static void presence_walkers(void)
+{
+	presence_stats stats;
+
+	presence_header();
+	presence_replay("walkers", walkers_scene, NULL, WALKERS_FRAMES, 8, &stats);
+	check(stats.entries == 2 && stats.exits == 2, "presence counts the walkers on 8x8 pixels");
+	check(stats.tracks == 4, "presence tracks each walker once on 8x8 pixels");
+
+	presence_replay("walkers", walkers_scene, NULL, WALKERS_FRAMES, 32, &stats);
+	check(stats.entries == 2 && stats.exits == 2, "presence counts the walkers on 32x32 pixels");
+	check(stats.tracks == 4, "presence tracks each walker once on 32x32 pixels");
+}
+
+static void presence_recording(const char *path)
+{
+	sim_recording recording;
+	presence_stats stats;
+
+	if (!sim_recording_load(&recording, path))
+	{
+		printf("FAIL: no GridEYE frames in %s\n", path);
+		failures++;
+		return;
+	}
+	presence_replay("recording", sim_recording_scene, &recording, recording.count, 8, &stats);
+	presence_replay("recording", sim_recording_scene, &recording, recording.count, 32, &stats);
+	sim_recording_free(&recording);
+}
+
+/*
+ * A uniform target seen through pixels with their own gain and offset, and
+ * one stuck pixel, with 1 LSB of noise
+ */
+#define STUCK_PIXEL 19
+
+typedef struct {
+	int16_t target;
+	uint32_t seed;
+} fixed_pattern;
+
+static void fixed_pattern_scene(uint32_t frame, int16_t pixels[64], void *context)
+{
+	(void)frame;
+	fixed_pattern *pattern = context;
+	for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+	{
+		float gain = 0.95f + 0.1f * ((i * 37) % 64) / 63.0f;
+		float offset = (i * 11) % 17 - 8;
+		pattern->seed = pattern->seed * 1103515245 + 12345;
+		int noise = (int)((pattern->seed >> 16) % 3) - 1;
+		pixels[i] = (int16_t)lroundf(gain * pattern->target + offset) + noise;
+	}
+	pixels[STUCK_PIXEL] = 0;
+}
+
+/* Average frames of the target at 10 frames per second */
+static void capture_target(nuc_capture *capture, fixed_pattern *pattern)
+{
+	int16_t frame[GRIDEYE_PIXEL_COUNT];
+
+	amg88_set_scene(fixed_pattern_scene, pattern);
+	uint64_t start = sim_time_us();
+	nuc_capture_begin(capture);
+	for (int n = 0; n < NUC_CAPTURE_FRAMES; n++)
+	{
+		sim_advance_us(start + n * 100000ULL + 50000 - sim_time_us());
+		GridEYE_readFrame(frame);
+		nuc_capture_add(capture, frame, GRIDEYE_PIXEL_COUNT);
+	}
+	amg88_set_scene(NULL, NULL);
+}
+
+static int16_t spread(const int16_t *frame, int skip)
+{
+	int16_t low = INT16_MAX;
+	int16_t high = INT16_MIN;
+	for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+	{
+		if (i == skip)
+			continue;
+		low = frame[i] < low ? frame[i] : low;
+		high = frame[i] > high ? frame[i] : high;
+	}
+	return high - low;
+}
+
+static void calibration(void)
+{
+	static nuc_capture cold, warm;
+	static nuc_table table, loaded;
+	static nuc correction;
+	fixed_pattern pattern = {.seed = 3};
+	int16_t frame[GRIDEYE_PIXEL_COUNT];
+
+	/* Two-point calibration against 20 C and 35 C */
+	pattern.target = GRIDEYE_QUARTERS(20);
+	capture_target(&cold, &pattern);
+	pattern.target = GRIDEYE_QUARTERS(35);
+	capture_target(&warm, &pattern);
+	check(nuc_compute(&table, 8, 8, &cold, &warm), "nuc_compute takes two targets");
+	check(table.dead_count == 1 && table.dead[STUCK_PIXEL], "nuc_compute finds the stuck pixel");
+
+	/* The last sector of bank 2, as in the GridEYE linker script */
+	flash_store store = {
+		.address = FLASH_BANK1_BASE + 2 * FLASH_BANK_SIZE - FLASH_SECTOR_SIZE,
+		.magic = NUC_MAGIC,
+		.version = NUC_VERSION,
+	};
+	check(!flash_store_read(&store, &loaded, sizeof(loaded)), "flash_store_read finds nothing in a blank sector");
+	check(flash_store_write(&store, &table, sizeof(table)), "flash_store_write writes the table");
+	check(flash_store_write(&store, &table, sizeof(table)), "flash_store_write writes over an old record");
+
+	/* After a reset, only what is in flash is left */
+	memset(&loaded, 0, sizeof(loaded));
+	check(flash_store_read(&store, &loaded, sizeof(loaded)) && memcmp(&loaded, &table, sizeof(table)) == 0,
+			"flash_store_read reads the table back");
+	nuc_init(&correction, &loaded);
+
+	pattern.target = GRIDEYE_QUARTERS(27);
+	amg88_set_scene(fixed_pattern_scene, &pattern);
+	GridEYE_readFrame(frame);
+	amg88_set_scene(NULL, NULL);
+	int16_t before = spread(frame, STUCK_PIXEL);
+
+	uint64_t t0 = host_ns();
+	nuc_apply(&correction, frame);
+	uint64_t ns = host_ns() - t0;
+	int16_t after = spread(frame, -1);
+	printf("\nnuc_apply: %u to %u LSB across the pixels, %.2f us on the host\n",
+			before, after, ns / 1000.0);
+	/* What is left is the noise and the rounding of scene and correction */
+	check(after <= 4, "nuc_apply flattens a uniform target");
+	check(abs(frame[STUCK_PIXEL] - frame[STUCK_PIXEL + 1]) <= 3, "nuc_apply replaces the stuck pixel");
+
+	/* Offsets only, through the unity gain path */
+	check(nuc_compute(&table, 8, 8, &cold, NULL), "nuc_compute takes one target");
+	nuc_init(&correction, &table);
+	check(correction.unity_gain, "one target gives unity gains");
+	pattern.target = GRIDEYE_QUARTERS(20);
+	amg88_set_scene(fixed_pattern_scene, &pattern);
+	GridEYE_readFrame(frame);
+	amg88_set_scene(NULL, NULL);
+	nuc_apply(&correction, frame);
+	check(spread(frame, -1) <= 4, "nuc_apply flattens the calibration target with offsets only");
+
+	/* Damaged and outdated records read as missing */
+	sim_flash[store.address - FLASH_BANK1_BASE + FLASH_STORE_WORD + 5] ^= 0x01;
+	check(!flash_store_read(&store, &loaded, sizeof(loaded)), "flash_store_read rejects a bad CRC");
+	flash_store_write(&store, &table, sizeof(table));
+	store.version++;
+	check(!flash_store_read(&store, &loaded, sizeof(loaded)), "flash_store_read rejects another version");
+
+	sim_flash_stats stats;
+	sim_flash_get_stats(&stats);
+	check(stats.reprograms == 0, "flash_store_write never programs a word twice");
+}
+
+/*
+ * A still scene with 2 LSB of noise, 1 in 100 pixels reading 12 C hot for a
+ * frame, and a 4 C step up at DENOISE_STEP_FRAME
+ */
+#define DENOISE_FRAMES 300
+#define DENOISE_SETTLE 20
+#define DENOISE_STEP_FRAME 200
+#define DENOISE_STEP GRIDEYE_QUARTERS(4)
+#define DENOISE_SPIKE GRIDEYE_QUARTERS(12)
+
+typedef struct {
+	uint32_t seed;
+	int16_t truth[GRIDEYE_PIXEL_COUNT];
+	uint32_t spikes;
+} noisy;
+
+static void noisy_scene(uint32_t frame, int16_t pixels[64], void *context)
+{
+	noisy *scene = context;
+	for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+	{
+		scene->truth[i] = GRIDEYE_QUARTERS(24) + (i % 8) * 2 + i / 8;
+		if (frame >= DENOISE_STEP_FRAME)
+			scene->truth[i] += DENOISE_STEP;
+		scene->seed = scene->seed * 1103515245 + 12345;
+		uint32_t r = scene->seed >> 8;
+		pixels[i] = scene->truth[i] + (int)(r % 5) + (int)(r / 5 % 5) - 4;
+		if (r / 25 % 100 == 0)
+		{
+			pixels[i] += DENOISE_SPIKE;
+			if (frame >= DENOISE_SETTLE && frame < DENOISE_STEP_FRAME)
+				scene->spikes++;
+		}
+	}
+}
+
+typedef struct {
+	float deviation;  /* per pixel over the still part, averaged */
+	float bias;       /* mean error against the scene */
+	uint32_t spikes;  /* pixels more than DENOISE_SPIKE / 2 off */
+	int lag;          /* frames until the mean is 90% through the step */
+	float ns;         /* host time per frame */
+} denoise_result;
+
+static void denoise_run(denoise_mode mode, uint8_t shift, uint32_t *raw_spikes, denoise_result *result)
+{
+	static denoise filter;
+	static float sum[GRIDEYE_PIXEL_COUNT], square_sum[GRIDEYE_PIXEL_COUNT];
+	noisy scene = {.seed = 5};
+	int16_t frame[GRIDEYE_PIXEL_COUNT];
+	float error = 0;
+	uint64_t total_ns = 0;
+
+	denoise_init(&filter, mode, shift);
+	memset(sum, 0, sizeof(sum));
+	memset(square_sum, 0, sizeof(square_sum));
+	memset(result, 0, sizeof(*result));
+	result->lag = -1;
+
+	amg88_set_scene(noisy_scene, &scene);
+	uint64_t start = sim_time_us();
+	for (uint32_t n = 0; n < DENOISE_FRAMES; n++)
+	{
+		sim_advance_us(start + n * 100000ULL + 50000 - sim_time_us());
+		GridEYE_readFrame(frame);
+
+		uint64_t t0 = host_ns();
+		denoise_apply(&filter, frame);
+		total_ns += host_ns() - t0;
+
+		float mean = 0;
+		for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+		{
+			int d = frame[i] - scene.truth[i];
+			mean += d;
+			if (n < DENOISE_SETTLE || n >= DENOISE_STEP_FRAME)
+				continue;
+			sum[i] += frame[i];
+			square_sum[i] += (float)frame[i] * frame[i];
+			error += d;
+			if (abs(d) > DENOISE_SPIKE / 2)
+				result->spikes++;
+		}
+		/* Off by the whole step right after it, 10% of it left */
+		mean /= GRIDEYE_PIXEL_COUNT;
+		if (n >= DENOISE_STEP_FRAME && result->lag < 0 && mean > -DENOISE_STEP / 10.0f)
+			result->lag = n - DENOISE_STEP_FRAME;
+	}
+	amg88_set_scene(NULL, NULL);
+
+	uint32_t frames = DENOISE_STEP_FRAME - DENOISE_SETTLE;
+	for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+	{
+		float mean = sum[i] / frames;
+		result->deviation += sqrtf(square_sum[i] / frames - mean * mean) / GRIDEYE_PIXEL_COUNT;
+	}
+	result->bias = error / frames / GRIDEYE_PIXEL_COUNT;
+	result->ns = (float)total_ns / DENOISE_FRAMES;
+	*raw_spikes = scene.spikes;
+}
+
+/*
+ * Noise left by each filter against what it costs. The cycles on the board
+ * come from the benchmarks of the GridEYE project.
+ */
+static void denoising(void)
+{
+	static const struct {
+		denoise_mode mode;
+		uint8_t shift;
+	} filters[] = {
+		{DENOISE_OFF, 0},
+		{DENOISE_EMA, 1}, {DENOISE_EMA, 2}, {DENOISE_EMA, 3},
+		{DENOISE_BOXCAR, 2}, {DENOISE_BOXCAR, 3}, {DENOISE_BOXCAR, 4},
+		{DENOISE_MEDIAN3, 0},
+	};
+	denoise_result raw, result;
+	uint32_t spikes;
+
+	denoise_run(DENOISE_OFF, 0, &spikes, &raw);
+	printf("\n%-8s %5s %8s %6s %7s %9s %10s %10s\n", "denoise", "shift", "std LSB", "gain",
+			"bias", "spikes", "lag 90%", "us/frame");
+	for (unsigned f = 0; f < sizeof(filters) / sizeof(filters[0]); f++)
+	{
+		denoise_mode mode = filters[f].mode;
+		uint8_t shift = filters[f].shift;
+		denoise_run(mode, shift, &spikes, &result);
+		printf("%-8s %5u %8.2f %6.2f %7.2f %4u/%-4u %10d %10.3f\n", denoise_name(mode), shift,
+				result.deviation, raw.deviation / result.deviation, result.bias,
+				result.spikes, spikes, result.lag, result.ns / 1000);
+
+		if (mode == DENOISE_EMA && shift == 2)
+			check(result.deviation * 2 < raw.deviation, "denoise EMA 1/4 halves the noise");
+		if (mode == DENOISE_BOXCAR && shift == 3)
+			check(result.deviation * 2 < raw.deviation, "denoise boxcar of 8 halves the noise");
+		if (mode == DENOISE_BOXCAR)
+			check(result.lag < (1 << shift), "denoise boxcar follows a step within its length");
+		if (mode == DENOISE_MEDIAN3)
+			check(result.spikes * 10 < spikes && result.lag <= 1, "denoise median drops spikes and follows a step");
+		/* The spikes move the mean of the input, only the median drops them */
+		if (mode == DENOISE_EMA || mode == DENOISE_BOXCAR)
+			check(fabsf(result.bias - raw.bias) < 0.25f, "denoise keeps the mean");
+	}
+}
+
+static void as7265x(void)
+{
+	bool found = false;
+	AS7265X_Spectrum spectrum;
+	float cal[AS7265X_CAL_CHANNEL_COUNT];
+
+	SIM_CALL("AS7265X_begin", found = AS7265X_begin());
+	check(found, "AS7265X_begin finds the sensor");
+
+	SIM_CALL("AS7265X_virtualReadRegister", AS7265X_virtualReadRegister(AS7265X_CONFIG));
+	SIM_CALL("AS7265X_virtualWriteRegister", AS7265X_virtualWriteRegister(AS7265X_INTERGRATION_TIME, 49));
+	SIM_CALL("AS7265X_takeMeasurements", AS7265X_takeMeasurements());
+	SIM_CALL("AS7265X_getCalibratedA", AS7265X_getCalibratedA());
+	SIM_CALL("AS7265X_getCalibratedValues", AS7265X_getCalibratedValues(AS72652_VISIBLE, cal));
+	SIM_CALL("AS7265X_readSpectrum", AS7265X_readSpectrum(&spectrum));
+
+	/* The model's peak is at 560 nm, channel G */
+	for (int i = 0; i < AS7265X_CHANNEL_COUNT; i++)
+		check(spectrum.calibrated[i] <= spectrum.calibrated[6], "AS7265X spectrum peaks at 560 nm");
+	check(as7265x_overruns() == 0, "AS7265X handshake never overran the slave");
+}
+
+/* zlib's crc32(), the reference for the frames' CRC */
+static uint32_t zlib_crc32(const uint8_t *data, uint32_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static bool write_file(const char *path, const uint8_t *data, uint32_t size)
+{
+	FILE *file = fopen(path, "wb");
+	if (file == NULL)
+		return false;
+	bool ok = fwrite(data, 1, size, file) == size;
+	return fclose(file) == 0 && ok;
+}
+
+#define TELEMETRY_FRAMES 8
+
+/*
+ * Frames of telemetry.c, with the CRC unit of the HAL stand-in, against the
+ * layout of telemetry.h and zlib's crc32(), and decoded again from a stream
+ * with text and a corrupted frame by sim_recording_load()
+ */
+static void telemetry(const char *path)
+{
+	static uint8_t stream[4096];
+	uint8_t buffer[TELEMETRY_MAX_PAYLOAD + 16];
+	int16_t pixels[GRIDEYE_PIXEL_COUNT];
+
+	check(zlib_crc32((const uint8_t *)"123456789", 9) == 0xCBF43926, "zlib_crc32 gives the CRC-32 check value");
+
+	telemetry_init();
+	amg88_current_frame(pixels);
+
+	sim_uart_capture(buffer, sizeof(buffer));
+	bool sent = telemetry_send_at(TELEMETRY_TYPE_GRIDEYE_FRAME, pixels, sizeof(pixels), 0x12345678);
+	uint32_t size = sim_uart_capture(NULL, 0);
+	check(sent && size == sizeof(telemetry_header) + sizeof(pixels) + 4, "telemetry_send_at writes header, payload and CRC");
+	check(get16(&buffer[0]) == TELEMETRY_SYNC && buffer[2] == TELEMETRY_TYPE_GRIDEYE_FRAME &&
+			buffer[3] == TELEMETRY_VERSION && get16(&buffer[6]) == sizeof(pixels) && get32(&buffer[8]) == 0x12345678,
+			"telemetry header has the layout of telemetry.h");
+	check(memcmp(&buffer[12], pixels, sizeof(pixels)) == 0, "telemetry payload follows the header");
+	check(get32(&buffer[size - 4]) == zlib_crc32(buffer, size - 4), "telemetry CRC matches zlib's crc32()");
+
+	/* Lengths that end in the middle of a word of the CRC unit */
+	uint16_t seq = get16(&buffer[4]);
+	bool crc_ok = true;
+	for (uint16_t length = 0; length <= 8; length++)
+	{
+		sim_uart_capture(buffer, sizeof(buffer));
+		telemetry_send(TELEMETRY_TYPE_AS7265X_CHANNELS, pixels, length);
+		size = sim_uart_capture(NULL, 0);
+		crc_ok &= size == sizeof(telemetry_header) + length + 4 && get16(&buffer[4]) == ++seq &&
+				get32(&buffer[size - 4]) == zlib_crc32(buffer, size - 4);
+	}
+	check(crc_ok, "telemetry CRC matches zlib's crc32() for all payload lengths and seq counts up");
+
+	uint32_t dropped = telemetry_dropped();
+	sim_uart_capture(buffer, sizeof(buffer));
+	sent = telemetry_send(TELEMETRY_TYPE_GRIDEYE_FRAME, stream, TELEMETRY_MAX_PAYLOAD + 1);
+	size = sim_uart_capture(NULL, 0);
+	check(!sent && size == 0 && telemetry_dropped() == dropped + 1, "telemetry_send drops payloads that are too large");
+
+	/* Text and frames, as the GridEYE sends them */
+	int16_t frames[TELEMETRY_FRAMES][GRIDEYE_PIXEL_COUNT];
+	uint32_t offsets[TELEMETRY_FRAMES];
+	size = 0;
+	for (int f = 0; f < TELEMETRY_FRAMES; f++)
+	{
+		for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+			frames[f][i] = pixels[i] + (f - 4) * 40;
+		sim_uart_capture(stream + size, sizeof(stream) - size);
+		print("frame %d\r\n", f);
+		size += sim_uart_capture(NULL, 0);
+		offsets[f] = size;
+		sim_uart_capture(stream + size, sizeof(stream) - size);
+		telemetry_send(TELEMETRY_TYPE_GRIDEYE_FRAME, frames[f], sizeof(frames[f]));
+		size += sim_uart_capture(NULL, 0);
+	}
+	if (path != NULL && !write_file(path, stream, size))
+		printf("can't write %s\n", path);
+
+	/* One flipped bit and a frame cut short at the end */
+	char temp[] = "/tmp/sim_telemetry_XXXXXX";
+	int fd = mkstemp(temp);
+	if (fd < 0)
+	{
+		perror("mkstemp");
+		failures++;
+		return;
+	}
+	close(fd);
+	stream[offsets[3] + 40] ^= 0x10;
+	bool written = write_file(temp, stream, size - 1);
+
+	sim_recording recording;
+	bool loaded = written && sim_recording_load(&recording, temp);
+	unlink(temp);
+	check(loaded && recording.count == TELEMETRY_FRAMES - 2, "sim_recording_load skips the text and the broken frames");
+	if (loaded)
+	{
+		bool same = true;
+		for (uint32_t r = 0, f = 0; r < recording.count; r++, f++)
+		{
+			if (f == 3)
+				f++;
+			same &= memcmp(recording.frames[r], frames[f], sizeof(frames[f])) == 0;
+		}
+		check(same, "sim_recording_load decodes the frames that were sent");
+		sim_recording_free(&recording);
+	}
+}
+
+static void sleep_10us(void)
+{
+	timebase_sleep_us(10);
+}
+
+/*
+ * A benchmark line of profile_benchmark(), which util/build_report.py reads
+ * back from the UART, here from `make check`
+ */
+static void benchmark(void)
+{
+	char line[128];
+
+	profile_init();
+	sim_uart_capture((uint8_t *)line, sizeof(line) - 1);
+	profile_benchmark("sleep_10us", sleep_10us, 100);
+	uint32_t size = sim_uart_capture(NULL, 0);
+	line[size] = '\0';
+	check(strcmp(line, "bench sleep_10us 4800 cycles (min 4800)\r\n") == 0,
+			"profile_benchmark writes the cycles at SystemCoreClock as build_report.py reads them");
+
+	print_write(line, size);
+	profile_benchmark_done();
+}
+
+/* Durations recorded before and after the core clock is stepped down */
+static void profiling(void)
+{
+	char dump[512];
+
+	check(profile_cycles_to_us(719) == 1 && profile_cycles_to_us(720) == 2, "profile_cycles_to_us rounds");
+
+	int8_t slot = profile_register("clock_change");
+	profile_record(slot, 4800);
+	SystemCoreClock /= 8;
+	profile_record(slot, 600);
+	sim_uart_capture((uint8_t *)dump, sizeof(dump) - 1);
+	profile_dump();
+	uint32_t size = sim_uart_capture(NULL, 0);
+	dump[size] = '\0';
+	SystemCoreClock *= 8;
+
+	const char *probe = strstr(dump, "clock_change");
+	check(probe != NULL && strstr(probe, "(10)\r\n") == strchr(probe, '('),
+			"profile_dump takes each duration at the clock it was recorded at");
+}
+
+#define RING_RECORDS  64
+#define RING_STRESS_N 2000000
+
+/* Sequence numbers through a ring, each record counts up from the last */
+typedef struct {
+	ring r;
+	uint32_t storage[RING_RECORDS];
+	uint32_t produced;
+	uint32_t consumed;
+	bool in_order;
+} ring_stress;
+
+static uint32_t next_random(uint32_t *seed)
+{
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 16;
+}
+
+/* Up to n records in place, returns how many */
+static uint32_t stress_produce(ring_stress *s, uint32_t n)
+{
+	uint32_t len;
+	uint32_t *dst = ring_reserve(&s->r, &len);
+	if (len > n)
+		len = n;
+	for (uint32_t i = 0; i < len; i++)
+		dst[i] = s->produced++;
+	ring_commit(&s->r, len);
+	return len;
+}
+
+static uint32_t stress_consume(ring_stress *s, uint32_t n)
+{
+	uint32_t len;
+	const uint32_t *src = ring_peek(&s->r, &len);
+	if (len > n)
+		len = n;
+	for (uint32_t i = 0; i < len; i++)
+		s->in_order &= src[i] == s->consumed++;
+	ring_release(&s->r, len);
+	return len;
+}
+
+static void *stress_producer(void *context)
+{
+	ring_stress *s = context;
+	uint32_t seed = 1;
+	while (s->produced < RING_STRESS_N)
+	{
+		uint32_t left = RING_STRESS_N - s->produced;
+		uint32_t r = next_random(&seed);
+		uint32_t n = 1 + r % RING_RECORDS;
+		/* Let the consumer in at random points, also when the host has one CPU */
+		if (stress_produce(s, n < left ? n : left) == 0 || (r & 0x700) == 0)
+			sched_yield();
+	}
+	return NULL;
+}
+
+/*
+ * The single producer and consumer of ring.h, with indices that start just
+ * below the 32 bit wrap: first interleaved at random on one thread, mixing
+ * the copying and the in-place calls, then on two threads
+ */
+static void ring_spsc(void)
+{
+	static ring_stress s;
+	uint32_t seed = 5;
+
+	ring_init(&s.r, s.storage, RING_RECORDS, sizeof(s.storage[0]));
+	s.r.head = s.r.tail = 0xFFFFFF00;
+	s.produced = s.consumed = 0;
+	s.in_order = true;
+	bool bounded = true;
+	while (s.consumed < RING_STRESS_N)
+	{
+		uint32_t op = next_random(&seed);
+		uint32_t n = 1 + (op >> 3) % RING_RECORDS;
+		uint32_t record;
+		switch (op & 7)
+		{
+		case 0:
+			if (ring_push(&s.r, &s.produced))
+				s.produced++;
+			break;
+		case 1:
+		{
+			uint32_t block[RING_RECORDS];
+			for (uint32_t i = 0; i < n; i++)
+				block[i] = s.produced + i;
+			if (ring_write(&s.r, block, n))
+				s.produced += n;
+			break;
+		}
+		case 2:
+		case 3:
+			stress_produce(&s, n);
+			break;
+		case 4:
+			if (ring_pop(&s.r, &record))
+				s.in_order &= record == s.consumed++;
+			break;
+		case 5:
+		{
+			uint32_t block[RING_RECORDS];
+			uint32_t got = ring_read(&s.r, block, n);
+			for (uint32_t i = 0; i < got; i++)
+				s.in_order &= block[i] == s.consumed++;
+			break;
+		}
+		default:
+			stress_consume(&s, n);
+			break;
+		}
+		bounded &= ring_count(&s.r) <= RING_RECORDS && ring_count(&s.r) + ring_space(&s.r) == RING_RECORDS;
+	}
+	check(s.in_order && bounded, "ring keeps the order across the wrap with interleaved calls");
+	check(s.r.tail - s.r.head == s.produced - s.consumed, "ring counts every record once with interleaved calls");
+
+	ring_init(&s.r, s.storage, RING_RECORDS, sizeof(s.storage[0]));
+	s.r.head = s.r.tail = 0xFFFFFF00;
+	s.produced = s.consumed = 0;
+	s.in_order = true;
+	pthread_t producer;
+	if (pthread_create(&producer, NULL, stress_producer, &s) != 0)
+	{
+		perror("pthread_create");
+		failures++;
+		return;
+	}
+	seed = 9;
+	while (s.consumed < RING_STRESS_N)
+	{
+		uint32_t r = next_random(&seed);
+		if (stress_consume(&s, 1 + r % RING_RECORDS) == 0 || (r & 0x700) == 0)
+			sched_yield();
+	}
+	pthread_join(producer, NULL);
+	check(s.in_order && ring_empty(&s.r), "ring keeps the order and count with the producer on another thread");
+}
+
+#define POOL_TEST_BLOCKS 4
+POOL_DEFINE(test_pool, 40, POOL_TEST_BLOCKS, );
+
+/* Whether the pool_dump() line of the named pool is the expected one */
+static bool pool_line(const char *dump, const char *expected)
+{
+	const char *line = strstr(dump, expected);
+	return line != NULL && (line == dump || line[-1] == '\n');
+}
+
+/* Pool allocation, exhaustion and statistics, and the telemetry frame buffers */
+static void pools(void)
+{
+	void *blocks[POOL_TEST_BLOCKS + 1];
+	pool_stats stats;
+	char dump[512];
+
+	check(pool_init(&test_pool, "test_pool"), "pool_init registers the pool");
+	bool distinct = true;
+	for (int i = 0; i < POOL_TEST_BLOCKS; i++)
+	{
+		blocks[i] = pool_alloc(&test_pool);
+		distinct &= blocks[i] != NULL && ((uintptr_t)blocks[i] & (POOL_ALIGN - 1)) == 0 &&
+				pool_of(blocks[i]) == &test_pool;
+		for (int j = 0; j < i; j++)
+			distinct &= blocks[i] != blocks[j];
+	}
+	check(distinct, "pool_alloc hands out each aligned block of the pool once");
+	blocks[POOL_TEST_BLOCKS] = pool_alloc(&test_pool);
+	pool_get_stats(&test_pool, &stats);
+	check(blocks[POOL_TEST_BLOCKS] == NULL && stats.failures == 1, "pool_alloc fails and counts it when the pool is exhausted");
+	check(stats.used == POOL_TEST_BLOCKS && stats.peak == POOL_TEST_BLOCKS, "pool counts the blocks in use up to the peak");
+
+	pool_free(&test_pool, blocks[1]);
+	pool_put(blocks[2]);
+	void *again = pool_alloc(&test_pool);
+	pool_get_stats(&test_pool, &stats);
+	check((again == blocks[1] || again == blocks[2]) && stats.used == POOL_TEST_BLOCKS - 1 &&
+			stats.peak == POOL_TEST_BLOCKS, "pool_free and pool_put hand blocks back, the peak stays");
+	pool_free(&test_pool, again);
+	pool_free(&test_pool, blocks[0]);
+	pool_free(&test_pool, blocks[3]);
+	check(pool_get(TELEMETRY_MAX_PAYLOAD * 2) == NULL, "pool_get fails for a size no class has");
+
+	/* The telemetry frames of the GridEYE need a block of the large class */
+	uint32_t frame_size = sizeof(telemetry_header) + GRIDEYE_PIXEL_COUNT * 2 + 4;
+	void *taken[TELEMETRY_MESSAGES];
+	int count = 0;
+	while (count < TELEMETRY_MESSAGES && (taken[count] = pool_get(frame_size)) != NULL)
+		count++;
+	int16_t pixels[GRIDEYE_PIXEL_COUNT] = {0};
+	uint32_t dropped = telemetry_dropped();
+	sim_uart_capture((uint8_t *)dump, sizeof(dump));
+	bool sent = telemetry_send(TELEMETRY_TYPE_GRIDEYE_FRAME, pixels, sizeof(pixels));
+	uint32_t size = sim_uart_capture(NULL, 0);
+	check(count == TELEMETRY_MESSAGES && !sent && size == 0 && telemetry_dropped() == dropped + 1,
+			"telemetry_send drops the frame when no buffer is free");
+	while (count > 0)
+		pool_put(taken[--count]);
+
+	sim_uart_capture((uint8_t *)dump, sizeof(dump) - 1);
+	pool_dump();
+	size = sim_uart_capture(NULL, 0);
+	dump[size] = '\0';
+	check(pool_line(dump, "test_pool: 4 x 64 bytes, 0 used, peak 4, 1 failures\r\n"),
+			"pool_dump writes the usage, peak and failures");
+	check(pool_line(dump, "telemetry_large: 2 x 288 bytes, 0 used, peak 2, 1 failures\r\n"),
+			"telemetry hands back its frame buffers");
+}
+
+static uint32_t feed(const char *text)
+{
+	return console_handshake_feed((const uint8_t *)text, strlen(text));
+}
+
+/* The baud rate request parser on what the host may send */
+static void handshake(void)
+{
+	check(feed("--BAUD:921600--") == 921600, "console_handshake_feed finds a request");
+	check(feed("--BA") == 0 && feed("UD:4000") == 0 && feed("000-") == 0 && feed("-") == 4000000,
+			"console_handshake_feed finds a request split over several buffers");
+	check(feed("text\r\n---BAUD:115200--more text") == 115200,
+			"console_handshake_feed finds a request between text");
+	check(feed("--BAUD:9600----BAUD:230400--") == 230400,
+			"console_handshake_feed returns the last of several requests");
+	check(feed("--BAUD:115200--\xa5\xc3--BAUD:") == 115200 && feed("460800--") == 460800,
+			"console_handshake_feed keeps parsing after a request");
+	check(feed("--BAUD:--") == 0 && feed("--BAUD:12x4--") == 0 && feed("--BAUD:1234567890--") == 0,
+			"console_handshake_feed ignores requests without a valid rate");
+	check(feed("--BAUD:115200-x\r\n") == 0 && feed("x-BAUD:115200--") == 0,
+			"console_handshake_feed ignores requests with broken framing");
+}
+
+int main(int argc, char **argv)
+{
+	const char *recording = NULL;
+	const char *telemetry_path = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-u") == 0 && i + 1 < argc)
+			sim_uart_open(argv[++i]);
+		else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+			recording = argv[++i];
+		else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+			telemetry_path = argv[++i];
+	}
+
+	amg88_attach();
+	as7265x_attach();
+
+	sim_call_header();
+	grideye();
+	grideye_fixed_point();
+	upscale();
+	as7265x();
+	handshake();
+	telemetry(telemetry_path);
+	benchmark();
+	profiling();
+	ring_spsc();
+	pools();
+
+	presence_walkers();
+	calibration();
+	denoising();
+	if (recording != NULL)
+		presence_recording(recording);
+
+	sim_i2c_stats stats;
+	sim_i2c_get_stats(&stats);
+	printf("total: %u transfers, %u nacks, %u bytes, %llu us on the bus, %llu us simulated, %u bytes to the UART\n",
+			stats.transactions, stats.nacks, stats.bytes, (unsigned long long)stats.bus_us,
+			(unsigned long long)sim_time_us(), sim_uart_bytes());
+	return failures > 0;
+}
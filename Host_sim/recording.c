@@ -0,0 +1,101 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "sim.h"
+#include "telemetry.h"
+
+#define HEADER_BYTES 12
+#define CRC_BYTES    4
+
+/* Same as zlib's crc32() and the board's CRC unit */
+static uint32_t crc32(const uint8_t *data, uint32_t length)
+{
+	uint32_t crc = 0xFFFFFFFF;
+	for (uint32_t i = 0; i < length; i++)
+	{
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+	}
+	return ~crc;
+}
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void append(sim_recording *recording, const uint8_t *payload)
+{
+	if ((recording->count & (recording->count - 1)) == 0)
+	{
+		uint32_t capacity = recording->count ? recording->count * 2 : 64;
+		recording->frames = realloc(recording->frames, capacity * sizeof(recording->frames[0]));
+		if (recording->frames == NULL)
+		{
+			perror("realloc");
+			exit(1);
+		}
+	}
+	for (int i = 0; i < 64; i++)
+		recording->frames[recording->count][i] = (int16_t)get16(&payload[2 * i]);
+	recording->count++;
+}
+
+bool sim_recording_load(sim_recording *recording, const char *path)
+{
+	memset(recording, 0, sizeof(*recording));
+
+	FILE *file = fopen(path, "rb");
+	if (file == NULL)
+		return false;
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint8_t *data = malloc(size > 0 ? size : 1);
+	bool ok = data != NULL && fread(data, 1, size, file) == (size_t)size;
+	fclose(file);
+	if (!ok)
+	{
+		free(data);
+		return false;
+	}
+
+	/* Same as parse_frame() in util/telemetry.py, skip a byte on anything invalid */
+	long i = 0;
+	while (i + HEADER_BYTES + CRC_BYTES <= size)
+	{
+		const uint8_t *header = &data[i];
+		uint16_t length = get16(&header[6]);
+		if (get16(header) != TELEMETRY_SYNC || header[3] != TELEMETRY_VERSION ||
+				length > TELEMETRY_MAX_PAYLOAD || i + HEADER_BYTES + length + CRC_BYTES > size ||
+				crc32(header, HEADER_BYTES + length) != get32(&header[HEADER_BYTES + length]))
+		{
+			i++;
+			continue;
+		}
+
+		if (header[2] == TELEMETRY_TYPE_GRIDEYE_FRAME && length == 64 * 2)
+			append(recording, &header[HEADER_BYTES]);
+		i += HEADER_BYTES + length + CRC_BYTES;
+	}
+	free(data);
+	return recording->count > 0;
+}
+
+void sim_recording_free(sim_recording *recording)
+{
+	free(recording->frames);
+	memset(recording, 0, sizeof(*recording));
+}
+
+void sim_recording_scene(uint32_t frame, int16_t pixels[64], void *context)
+{
+	const sim_recording *recording = context;
+	memcpy(pixels, recording->frames[frame % recording->count], sizeof(recording->frames[0]));
+}
@@ -0,0 +1,65 @@
+#include <string.h>
+#include "stm32h7xx_hal.h"
+#include "sim.h"
+
+/*
+ * Like the H7's flash, a flash word can only be programmed once after an
+ * erase (its ECC would not match otherwise) and only while unlocked.
+ */
+uint8_t sim_flash[2 * FLASH_BANK_SIZE];
+
+#define FLASH_WORD (FLASH_NB_32BITWORD_IN_FLASHWORD * 4)
+
+static bool unlocked;
+static sim_flash_stats stats;
+
+HAL_StatusTypeDef HAL_FLASH_Unlock(void)
+{
+	unlocked = true;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Lock(void)
+{
+	unlocked = false;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASHEx_Erase(FLASH_EraseInitTypeDef *erase, uint32_t *sector_error)
+{
+	*sector_error = 0xFFFFFFFF;
+	if (!unlocked || erase->TypeErase != FLASH_TYPEERASE_SECTORS ||
+			(erase->Banks != FLASH_BANK_1 && erase->Banks != FLASH_BANK_2) ||
+			erase->Sector + erase->NbSectors > FLASH_BANK_SIZE / FLASH_SECTOR_SIZE)
+		return HAL_ERROR;
+
+	uint8_t *bank = &sim_flash[(erase->Banks - 1) * FLASH_BANK_SIZE];
+	memset(&bank[erase->Sector * FLASH_SECTOR_SIZE], 0xFF, erase->NbSectors * FLASH_SECTOR_SIZE);
+	stats.erases += erase->NbSectors;
+	return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_FLASH_Program(uint32_t type, uintptr_t flash_address, uintptr_t data_address)
+{
+	uintptr_t offset = flash_address - FLASH_BANK1_BASE;
+	if (!unlocked || type != FLASH_TYPEPROGRAM_FLASHWORD || offset % FLASH_WORD != 0 ||
+			offset >= sizeof(sim_flash))
+		return HAL_ERROR;
+
+	for (uint32_t i = 0; i < FLASH_WORD; i++)
+	{
+		if (sim_flash[offset + i] != 0xFF)
+		{
+			stats.reprograms++;
+			return HAL_ERROR;
+		}
+	}
+	memcpy(&sim_flash[offset], (const void *)data_address, FLASH_WORD);
+	stats.words++;
+	return HAL_OK;
+}
+
+void sim_flash_get_stats(sim_flash_stats *out)
+{
+	*out = stats;
+}
@@ -0,0 +1,196 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stm32h7xx_hal.h"
+#include "sim.h"
+#include "debug.h"
+#include "timebase.h"
+#include "cache.h"
+
+/* Same as the board after clock_init() */
+uint32_t SystemCoreClock = 480000000;
+
+TIM_TypeDef sim_tim2;
+DWT_Type sim_dwt;
+CoreDebug_Type sim_core_debug;
+UART_HandleTypeDef huart3;
+
+static uint64_t now_us;
+
+uint64_t sim_time_us(void)
+{
+	return now_us;
+}
+
+void sim_advance_us(uint64_t us)
+{
+	now_us += us;
+	sim_tim2.CNT = (uint32_t)now_us;
+	sim_dwt.CYCCNT = (uint32_t)(now_us * (SystemCoreClock / 1000000));
+}
+
+/* HAL tick */
+uint32_t HAL_GetTick(void)
+{
+	return (uint32_t)(now_us / 1000);
+}
+
+void HAL_Delay(uint32_t ms)
+{
+	sim_advance_us((uint64_t)ms * 1000);
+}
+
+/* The parts of timebase.h the drivers use */
+uint64_t timebase_us64(void)
+{
+	return now_us;
+}
+
+void timebase_sleep_until(uint32_t deadline)
+{
+	int32_t left = (int32_t)(deadline - timebase_us());
+	if (left > 0)
+		sim_advance_us((uint64_t)left);
+}
+
+void timebase_sleep_us(uint32_t us)
+{
+	sim_advance_us(us);
+}
+
+/* The parts of cache.h the drivers use, there is no data cache */
+void cache_invalidate(void *addr, uint32_t len)
+{
+	(void)addr;
+	(void)len;
+}
+
+/* CRC unit */
+static uint32_t reverse_bits(uint32_t value, int bits)
+{
+	uint32_t reversed = 0;
+	for (int i = 0; i < bits; i++)
+	{
+		reversed = (reversed << 1) | (value & 1);
+		value >>= 1;
+	}
+	return reversed;
+}
+
+HAL_StatusTypeDef HAL_CRC_Init(CRC_HandleTypeDef *hcrc)
+{
+	if (hcrc->Init.DefaultPolynomialUse != DEFAULT_POLYNOMIAL_ENABLE ||
+			hcrc->Init.DefaultInitValueUse != DEFAULT_INIT_VALUE_ENABLE ||
+			hcrc->InputDataFormat != CRC_INPUTDATA_FORMAT_BYTES)
+		return HAL_ERROR;
+	return HAL_OK;
+}
+
+uint32_t HAL_CRC_Calculate(CRC_HandleTypeDef *hcrc, uint32_t *buffer, uint32_t length)
+{
+	const uint8_t *data = (const uint8_t *)buffer;
+	uint32_t crc = 0xFFFFFFFF;
+
+	for (uint32_t i = 0; i < length; i++)
+	{
+		uint32_t byte = data[i];
+		if (hcrc->Init.InputDataInversionMode == CRC_INPUTDATA_INVERSION_BYTE)
+			byte = reverse_bits(byte, 8);
+		crc ^= byte << 24;
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc << 1) ^ (0x04C11DB7 & -(crc >> 31));
+	}
+	if (hcrc->Init.OutputDataInversionMode == CRC_OUTPUTDATA_INVERSION_ENABLE)
+		crc = reverse_bits(crc, 32);
+	return crc;
+}
+
+/* UART sink behind print() */
+static FILE *uart;
+static bool uart_default = true;
+static uint32_t uart_bytes;
+
+static uint8_t *capture;
+static uint32_t capture_size;
+static uint32_t captured;
+
+void sim_uart_open(const char *path)
+{
+	if (uart != NULL && uart != stderr)
+		fclose(uart);
+	uart = path != NULL ? fopen(path, "wb") : NULL;
+	uart_default = false;
+}
+
+uint32_t sim_uart_bytes(void)
+{
+	return uart_bytes;
+}
+
+uint32_t sim_uart_capture(uint8_t *buffer, uint32_t size)
+{
+	uint32_t length = captured;
+	capture = buffer;
+	capture_size = size;
+	captured = 0;
+	return length;
+}
+
+void print_init(void)
+{
+}
+
+bool print_write(const void *data, uint32_t len)
+{
+	if (uart_default)
+	{
+		uart = stderr;
+		uart_default = false;
+	}
+	if (capture != NULL)
+	{
+		uint32_t kept = len < capture_size - captured ? len : capture_size - captured;
+		memcpy(capture + captured, data, kept);
+		captured += kept;
+	}
+	else if (uart != NULL)
+	{
+		fwrite(data, 1, len, uart);
+	}
+	uart_bytes += len;
+	return true;
+}
+
+void print(const char *format, ...)
+{
+	char buffer[256];
+	va_list args;
+	va_start(args, format);
+	int len = vsnprintf(buffer, sizeof(buffer), format, args);
+	va_end(args);
+
+	if (len > (int)sizeof(buffer) - 1)
+		len = sizeof(buffer) - 1;
+	if (len > 0)
+		print_write(buffer, len);
+}
+
+bool print_flush(void)
+{
+	if (uart != NULL)
+		fflush(uart);
+	return true;
+}
+
+uint32_t print_dropped(void)
+{
+	return 0;
+}
+
+/* Called by the drivers on fatal bus errors */
+void Error_Handler(void)
+{
+	fprintf(stderr, "Error_Handler() at %llu us\n", (unsigned long long)now_us);
+	exit(1);
+}
@@ -0,0 +1,190 @@
+#include <stdio.h>
+#include "sim.h"
+#include "i2c_async.h"
+#include "i2c_stub.h"
+
+static sim_i2c_device devices[SIM_I2C_MAX_DEVICES];
+static uint8_t device_count;
+
+static sim_i2c_stats stats;
+static uint32_t fail_count;
+
+/* Error of the last transfer, checked by i2c_endTransmission() */
+static uint32_t last_error = HAL_I2C_ERROR_NONE;
+
+void sim_i2c_attach(const sim_i2c_device *device)
+{
+	if (device_count < SIM_I2C_MAX_DEVICES)
+		devices[device_count++] = *device;
+}
+
+void sim_i2c_get_stats(sim_i2c_stats *out)
+{
+	*out = stats;
+}
+
+void sim_i2c_fail(uint32_t count)
+{
+	fail_count = count;
+}
+
+static const sim_i2c_device *find(uint8_t addr)
+{
+	for (uint8_t i = 0; i < device_count; i++)
+	{
+		if (devices[i].addr == addr)
+			return &devices[i];
+	}
+	return NULL;
+}
+
+/* Start, 8 address/data bits and the acknowledge per byte */
+static uint32_t phase_bits(uint16_t len)
+{
+	return 1 + 9 * (1 + len);
+}
+
+static void clock_bits(uint32_t bits)
+{
+	uint64_t us = ((uint64_t)bits * 1000000 + I2C_SPEED_HZ - 1) / I2C_SPEED_HZ;
+	stats.bus_us += us;
+	sim_advance_us(us);
+}
+
+/* Run a transaction on the bus, returns its HAL_I2C_ERROR_* */
+static uint32_t transfer(uint8_t addr, const uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t rx_len)
+{
+	const sim_i2c_device *device = find(addr);
+	stats.transactions++;
+
+	if (device == NULL || fail_count > 0)
+	{
+		if (device != NULL)
+			fail_count--;
+		/* Only the address goes out, then a stop */
+		clock_bits(phase_bits(0) + 1);
+		stats.nacks++;
+		return HAL_I2C_ERROR_AF;
+	}
+
+	uint32_t bits = 1; /* stop */
+	if (tx_len > 0 || rx_len == 0)
+	{
+		bits += phase_bits(tx_len);
+		if (device->write != NULL)
+			device->write(device->context, tx, tx_len);
+	}
+	if (rx_len > 0)
+	{
+		bits += phase_bits(rx_len);
+		if (device->read != NULL)
+			device->read(device->context, rx, rx_len);
+	}
+	stats.bytes += tx_len + rx_len;
+	clock_bits(bits);
+	return HAL_I2C_ERROR_NONE;
+}
+
+/* i2c_async.h, transactions run to completion right away */
+void i2c_async_init(I2C_HandleTypeDef *hi2c)
+{
+	(void)hi2c;
+}
+
+bool i2c_async_submit(i2c_transaction *t)
+{
+	t->done = false;
+	t->error = transfer(t->addr, t->tx, t->tx_len, t->rx, t->rx_len);
+	t->done = true;
+	if (t->callback != NULL)
+		t->callback(t);
+	return true;
+}
+
+bool i2c_async_busy(void)
+{
+	return false;
+}
+
+void i2c_async_wait(i2c_transaction *t)
+{
+	(void)t;
+}
+
+/* i2c_stub.h */
+void I2C_MspInit()
+{
+}
+
+void i2c_begin()
+{
+}
+
+uint8_t i2c_endTransmission(bool sendStop)
+{
+	(void)sendStop;
+	return (last_error == HAL_I2C_ERROR_AF);
+}
+
+static uint32_t stub_transfer(uint8_t addr, const uint8_t *tx, uint16_t tx_len, uint8_t *rx, uint16_t rx_len)
+{
+	last_error = transfer(addr, tx, tx_len, rx, rx_len);
+	return last_error;
+}
+
+uint8_t i2c_read(uint8_t addr)
+{
+	uint8_t data = 0;
+	stub_transfer(addr, NULL, 0, &data, sizeof(data));
+	return data;
+}
+
+uint16_t i2c_read2(uint8_t addr)
+{
+	uint8_t data[2] = {0};
+	stub_transfer(addr, NULL, 0, data, sizeof(data));
+	return data[0] | (data[1] << 8);
+}
+
+uint32_t i2c_write(uint8_t addr, uint8_t data)
+{
+	return stub_transfer(addr, &data, sizeof(data), NULL, 0);
+}
+
+uint32_t i2c_write2(uint8_t addr, uint8_t data1, uint8_t data2)
+{
+	uint8_t data[2] = {data1, data2};
+	return stub_transfer(addr, data, sizeof(data), NULL, 0);
+}
+
+uint32_t i2c_memRead(uint8_t addr, uint8_t reg, uint8_t *data, uint16_t len)
+{
+	return stub_transfer(addr, &reg, sizeof(reg), data, len);
+}
+
+/* Like HAL_I2C_IsDeviceReady() != HAL_OK, true if nothing answers */
+bool i2c_deviceReady(uint8_t addr)
+{
+	return stub_transfer(addr, NULL, 0, NULL, 0) != HAL_I2C_ERROR_NONE;
+}
+
+/* Cost of a driver call */
+void sim_call_begin(sim_call *call)
+{
+	call->i2c = stats;
+	call->start_us = sim_time_us();
+}
+
+void sim_call_header(void)
+{
+	printf("%-36s %8s %8s %10s %10s\n", "call", "transfers", "bytes", "bus us", "total us");
+}
+
+void sim_call_end(const sim_call *call, const char *name)
+{
+	printf("%-36s %8u %8u %10llu %10llu\n", name,
+			stats.transactions - call->i2c.transactions,
+			stats.bytes - call->i2c.bytes,
+			(unsigned long long)(stats.bus_us - call->i2c.bus_us),
+			(unsigned long long)(sim_time_us() - call->start_us));
+}
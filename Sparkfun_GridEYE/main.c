@@ -1,85 +1,727 @@
 #include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <string.h>
 #include "stm32h7xx_hal.h"
 #include "stm32h7xx_nucleo.h"
+#include "cache.h"
+#include "clock.h"
+#include "scheduler.h"
+#include "frame_store.h"
+#include "sections.h"
+#include "console.h"
 #include "SparkFun_GridEYE_Arduino_Library.h"
 #include "debug.h"
+#include "telemetry.h"
+#include "profile.h"
+#include "ring.h"
+#include "pool.h"
+#include "upscale.h"
+#include "presence.h"
+#include "nuc.h"
+#include "flash_store.h"
+#include "denoise.h"
 
-void SystemClock_Config(void);
 void GPIO_Init(void);
-void USART3_UART_Init(void);
-
-UART_HandleTypeDef huart3;
 
 void Error_Handler();
 
-float temps[64];
+/*
+ * ACQUISITION_PERIODIC reads a full frame every 100 ms (the sensor's frame
+ * time at 10 FPS) on the scheduler's grid. The read runs in the background and
+ * its completion interrupt publishes the frame, stamped with the time the read
+ * started, to the frame store. The main loop borrows the latest frame and
+ * sends it while the user button is pressed.
+ *
+ * ACQUISITION_THRESHOLD lets the sensor watch for pixels above
+ * HOTSPOT_THRESHOLD. Its INT pin pulls D70/PF2 low, the EXTI interrupt wakes
+ * the MCU, which then reads the interrupt table and only the flagged pixels.
+ */
+#define ACQUISITION_PERIODIC  0
+#define ACQUISITION_THRESHOLD 1
+#ifndef ACQUISITION_MODE
+#define ACQUISITION_MODE ACQUISITION_PERIODIC
+#endif
 
-void get_temps() {
-    for (int i = 0; i < 64; i++) {
-        temps[i] = GridEYE_getPixelTemperature(i);
-    }
+#define FRAME_TIME_MS 100
+
+/* How often the main loop answers baud rate requests from the host */
+#define CONSOLE_POLL_MS 100
+
+/* Frames in the store, one being read, one published and one borrowed */
+#define FRAME_COUNT 3
+
+/* Core clock divider while waiting for the next frame, 1 to keep full speed */
+#ifndef IDLE_CLOCK_DIVIDER
+#define IDLE_CLOCK_DIVIDER 8
+#endif
+
+/*
+ * What the main loop does with each frame while the user button is pressed:
+ * send it as telemetry, print its temperatures, or draw the upscaled frame as
+ * ASCII art with the hottest point.
+ */
+#define OUTPUT_TELEMETRY 0
+#define OUTPUT_TEXT      1
+#define OUTPUT_VISUALIZE 2
+#ifndef OUTPUT_MODE
+#define OUTPUT_MODE OUTPUT_TELEMETRY
+#endif
+
+/* Every frame is interpolated to UPSCALE_SIZE x UPSCALE_SIZE, see upscale.h */
+#ifndef UPSCALE_SIZE
+#define UPSCALE_SIZE 32
+#endif
+#ifndef UPSCALE_KERNEL
+#define UPSCALE_KERNEL UPSCALE_BICUBIC
+#endif
+
+/*
+ * People are detected, tracked and counted on the 8x8 pixels, or on the
+ * upscaled frame with PRESENCE_UPSCALED, see presence.h
+ */
+#ifndef PRESENCE_UPSCALED
+#define PRESENCE_UPSCALED 0
+#endif
+#if PRESENCE_UPSCALED
+#define PRESENCE_SIZE UPSCALE_SIZE
+#else
+#define PRESENCE_SIZE 8
+#endif
+#if PRESENCE_SIZE * PRESENCE_SIZE > PRESENCE_MAX_PIXELS
+#error "PRESENCE_MAX_PIXELS is too small for the upscaled frame"
+#endif
+
+/*
+ * Temporal noise filter on every corrected frame, see denoise.h: DENOISE_EMA
+ * weighs each frame 1/2^DENOISE_SHIFT, DENOISE_BOXCAR averages 2^DENOISE_SHIFT
+ * frames, DENOISE_MEDIAN3 drops single frame outliers. Done here rather than
+ * with the sensor's moving average, which is only reachable through its
+ * undocumented reserved register.
+ */
+#ifndef DENOISE_MODE
+#define DENOISE_MODE DENOISE_OFF
+#endif
+#ifndef DENOISE_SHIFT
+#define DENOISE_SHIFT 2
+#endif
+#if DENOISE_SHIFT < 1 || DENOISE_SHIFT > DENOISE_MAX_SHIFT
+#error "DENOISE_SHIFT is out of range"
+#endif
+
+/* Quarter degrees Celsius, like the pixels */
+#define HOTSPOT_THRESHOLD  GRIDEYE_QUARTERS(30)
+#define HOTSPOT_HYSTERESIS GRIDEYE_QUARTERS(1)
+
+/* Levels of visualize_temps() */
+#define VISUALIZE_WARM    GRIDEYE_QUARTERS(20)
+#define VISUALIZE_HOT     GRIDEYE_QUARTERS(25)
+#define VISUALIZE_HOTTEST GRIDEYE_QUARTERS(30)
+
+/* GridEYE INT output, open drain, active low */
+#define GRIDEYE_INT_PORT GPIOF
+#define GRIDEYE_INT_PIN  GPIO_PIN_2
+#define GRIDEYE_INT_IRQn EXTI2_IRQn
+
+static int16_t frame_storage[FRAME_COUNT][GRIDEYE_PIXEL_COUNT] AXI_BSS;
+frame_store frames;
+
+/* Latest frame upscaled, and its hottest point */
+static upscaler up;
+static int16_t upscaled[UPSCALE_SIZE * UPSCALE_SIZE];
+upscale_peak hottest;
+
+static presence people;
+
+/* Pixel calibration, kept in its own flash sector (see the linker script) */
+extern const uint8_t _calibration_start[];
+static const flash_store calibration_store = {
+    .address = (uintptr_t)_calibration_start,
+    .magic = NUC_MAGIC,
+    .version = NUC_VERSION,
+};
+static nuc_table calibration;
+static nuc correction;
+
+static denoise smoothing;
+
+/* The background frame read, at most one at a time */
+static i2c_transaction frame_read;
+static uint8_t frame_raw[GRIDEYE_FRAME_BYTES];
+
+/* seq of the last frame the main loop has handled */
+static uint32_t handled_seq;
+
+/* Set by the EXTI interrupts, cleared by the main loop */
+volatile bool int_pending;
+volatile bool dump_pending;
+
+/* Send the raw frame as binary telemetry, see util/uart_gui_qt5.py */
+void send_frame(const frame *f) {
+    telemetry_send_at(TELEMETRY_TYPE_GRIDEYE_FRAME, f->data, sizeof(frame_storage[0]), f->timestamp);
 }
 
-void print_temps() {
+/* Print a frame in exact degrees Celsius */
+void print_temps(const int16_t *temps) {
+    char text[GRIDEYE_FORMAT_LENGTH];
+
     /* Clear screen and move cursor to home position */
     print("\033[2J\033[H");
     for (int i = 0; i < 64; i++) {
-        print("%f, ", temps[i]);
+        GridEYE_formatQuarters(temps[i], text);
+        print("%s, ", text);
         if (i % 8 == 7)
             print("\r\n");
     }
 }
 
-void visualize_temps() {
+/* Draw a size x size frame, e.g. the 8x8 pixels or the upscaled frame */
+void visualize_temps(const int16_t *temps, int size) {
     /* Clear screen and move cursor to home position */
     print("\033[2J\033[H");
-    for (int i = 0; i < 64; i++) {
+    for (int i = 0; i < size * size; i++) {
         char c = '.';
-        if (temps[i] > 20)
+        if (temps[i] > VISUALIZE_WARM)
             c = 'o';
-        if (temps[i] > 25)
+        if (temps[i] > VISUALIZE_HOT)
             c = '0';
-        if (temps[i] > 30)
+        if (temps[i] > VISUALIZE_HOTTEST)
             c = 'O';
         print("%c", c);
-        if (i % 8 == 7)
+        if (i % size == size - 1)
             print("\r\n");
     }
 }
 
+/* The hottest point of the upscaled frame, in sensor pixels */
+void print_hottest() {
+    char text[GRIDEYE_FORMAT_LENGTH];
+    GridEYE_formatQuarters(hottest.value, text);
+    print("hottest %s C at x %f, y %f\r\n", text,
+          upscale_position_x(&up, hottest.x), upscale_position_y(&up, hottest.y));
+}
+
+#if BENCHMARK
+int16_t raw_temps[64];
+uint8_t raw_frame[GRIDEYE_FRAME_BYTES];
+float temps[64];
+char temp_text[GRIDEYE_FORMAT_LENGTH];
+
+static upscaler bench_up;
+int16_t bench_upscaled_q15[UPSCALE_MAX_OUTPUT * UPSCALE_MAX_OUTPUT] AXI_BSS;
+float bench_upscaled_f32[UPSCALE_MAX_OUTPUT * UPSCALE_MAX_OUTPUT] AXI_BSS;
+
+/* Results, volatile so the optimizer can't drop the computations */
+volatile float frame_mean;
+volatile float frame_stddev;
+
+void bench_convert_frame() {
+    GridEYE_convertFrameToFloat(raw_temps, temps);
+}
+
+/* Registers to quarter degrees, what the I2C interrupt does for every frame */
+void bench_decode_frame() {
+    GridEYE_decodeFrame(raw_frame, raw_temps);
+}
+
+void bench_format_frame() {
+    for (int i = 0; i < 64; i++)
+        GridEYE_formatQuarters(raw_temps[i], temp_text);
+}
+
+void bench_frame_stats() {
+    float sum = 0;
+    float sum_sq = 0;
+    for (int i = 0; i < 64; i++) {
+        sum += temps[i];
+        sum_sq += temps[i] * temps[i];
+    }
+    float mean = sum / 64;
+    frame_mean = mean;
+    frame_stddev = sqrtf(sum_sq / 64 - mean * mean);
+}
+
+/* One record in and out of a ring, the cost of a hand-off between ISR and main loop */
+uint8_t bench_bytes[256];
+ring bench_byte_ring = RING_INIT(bench_bytes, sizeof(bench_bytes), 1);
+int16_t bench_frames[4][64];
+ring bench_frame_ring = RING_INIT(bench_frames, 4, sizeof(bench_frames[0]));
+
+void bench_ring_byte() {
+    uint8_t byte;
+    ring_put_byte(&bench_byte_ring, 0x55);
+    ring_get_byte(&bench_byte_ring, &byte);
+}
+
+void bench_ring_frame() {
+    ring_push(&bench_frame_ring, raw_temps);
+    ring_pop(&bench_frame_ring, raw_temps);
+}
+
+/* Per operation: 64 bytes copied in, then out, over the wrap of the index */
+#define BENCH_RING_OPS 128
+void bench_ring_copy_ops() {
+    uint8_t byte;
+    for (int i = 0; i < BENCH_RING_OPS / 2; i++)
+        ring_put_byte(&bench_byte_ring, (uint8_t)i);
+    for (int i = 0; i < BENCH_RING_OPS / 2; i++)
+        ring_get_byte(&bench_byte_ring, &byte);
+}
+
+/* Same in place, one record per reserve/commit and peek/release pair */
+void bench_ring_in_place_ops() {
+    uint32_t len;
+    for (int i = 0; i < BENCH_RING_OPS / 2; i++) {
+        uint8_t *dst = ring_reserve(&bench_byte_ring, &len);
+        *dst = (uint8_t)i;
+        ring_commit(&bench_byte_ring, 1);
+    }
+    for (int i = 0; i < BENCH_RING_OPS / 2; i++) {
+        ring_peek(&bench_byte_ring, &len);
+        ring_release(&bench_byte_ring, 1);
+    }
+}
+
+/* Interpolation of the 8x8 frame with bench_up */
+void bench_upscale_q15() {
+    upscale_q15(&bench_up, raw_temps, bench_upscaled_q15);
+}
+
+void bench_upscale_f32() {
+    upscale_f32(&bench_up, temps, bench_upscaled_f32);
+}
+
+typedef struct {
+    const char *name;
+    uint16_t size;
+    upscale_kernel kernel;
+    void (*fn)(void);
+} upscale_bench;
+
+static const upscale_bench upscale_benches[] = {
+    { "upscale_q15_bilinear_16", 16, UPSCALE_BILINEAR, bench_upscale_q15 },
+    { "upscale_q15_bicubic_16",  16, UPSCALE_BICUBIC,  bench_upscale_q15 },
+    { "upscale_f32_bilinear_16", 16, UPSCALE_BILINEAR, bench_upscale_f32 },
+    { "upscale_f32_bicubic_16",  16, UPSCALE_BICUBIC,  bench_upscale_f32 },
+    { "upscale_q15_bilinear_32", 32, UPSCALE_BILINEAR, bench_upscale_q15 },
+    { "upscale_q15_bicubic_32",  32, UPSCALE_BICUBIC,  bench_upscale_q15 },
+    { "upscale_f32_bilinear_32", 32, UPSCALE_BILINEAR, bench_upscale_f32 },
+    { "upscale_f32_bicubic_32",  32, UPSCALE_BICUBIC,  bench_upscale_f32 },
+    { "upscale_q15_bilinear_64", 64, UPSCALE_BILINEAR, bench_upscale_q15 },
+    { "upscale_q15_bicubic_64",  64, UPSCALE_BICUBIC,  bench_upscale_q15 },
+    { "upscale_f32_bilinear_64", 64, UPSCALE_BILINEAR, bench_upscale_f32 },
+    { "upscale_f32_bicubic_64",  64, UPSCALE_BICUBIC,  bench_upscale_f32 },
+};
+
+/* Offsets, a dead pixel and optionally gains, applied to the same frame over and over */
+static nuc bench_nuc;
+int16_t bench_corrected[64];
+
+void bench_correct_frame() {
+    nuc_apply(&bench_nuc, bench_corrected);
+}
+
+void benchmark_correction(const char *name, bool gains) {
+    static nuc_table table;
+    nuc_table_identity(&table, 8, 8);
+    for (int i = 0; i < 64; i++) {
+        table.offset[i] = i % 7 - 3;
+        if (gains)
+            table.gain[i] = NUC_GAIN_ONE + (i % 5 - 2) * 100;
+    }
+    table.dead[19] = 1;
+    table.dead_count = 1;
+    nuc_init(&bench_nuc, &table);
+    memcpy(bench_corrected, raw_temps, sizeof(raw_temps));
+    profile_benchmark(name, bench_correct_frame, BENCHMARK_ITERATIONS);
+}
+
+/* Each filter on the same frame over and over, after its first frame */
+static denoise bench_denoise;
+int16_t bench_denoised[64];
+
+void bench_denoise_frame() {
+    denoise_apply(&bench_denoise, bench_denoised);
+}
+
+void benchmark_denoise(const char *name, denoise_mode mode, uint8_t shift) {
+    denoise_init(&bench_denoise, mode, shift);
+    memcpy(bench_denoised, raw_temps, sizeof(raw_temps));
+    denoise_apply(&bench_denoise, bench_denoised);
+    profile_benchmark(name, bench_denoise_frame, BENCHMARK_ITERATIONS);
+}
+
+/* Presence detection on frames warmer than the learnt background */
+static presence bench_presence AXI_BSS;
+int16_t bench_background[PRESENCE_MAX_PIXELS] AXI_BSS;
+const int16_t *bench_presence_frame;
+uint32_t bench_timestamp;
+
+void bench_presence_update() {
+    bench_timestamp += FRAME_TIME_MS * 1000;
+    presence_update(&bench_presence, bench_presence_frame, bench_timestamp);
+}
+
+/* Learn a 22 C background, then time the updates with frame */
+void benchmark_presence(const char *name, uint16_t size, const int16_t *frame) {
+    presence_config config;
+    presence_default_config(&config, size, size);
+    presence_init(&bench_presence, &config);
+    for (int i = 0; i < size * size; i++)
+        bench_background[i] = GRIDEYE_QUARTERS(22);
+    bench_presence_frame = bench_background;
+    for (int i = 0; i < config.warmup_frames; i++)
+        bench_presence_update();
+
+    bench_presence_frame = frame;
+    profile_benchmark(name, bench_presence_update, BENCHMARK_ITERATIONS);
+}
+
+/* The block for a telemetry frame of pixels out of its size class and back */
+void bench_pool_frame() {
+    pool_put(pool_get(sizeof(telemetry_header) + sizeof(frame_storage[0]) + 4));
+}
+
+/* Fixed benchmark loop on a synthetic frame, see profile_benchmark() */
+void benchmark() {
+    for (int i = 0; i < 64; i++) {
+        raw_temps[i] = 80 + 3 * i; // 20 to 67.25 C
+        raw_frame[2 * i] = raw_temps[i] & 0xFF;
+        raw_frame[2 * i + 1] = raw_temps[i] >> 8;
+    }
+    profile_benchmark("decode_frame", bench_decode_frame, BENCHMARK_ITERATIONS);
+    benchmark_correction("correct_offsets", false);
+    benchmark_correction("correct_gains", true);
+    benchmark_denoise("denoise_ema_4", DENOISE_EMA, 2);
+    benchmark_denoise("denoise_boxcar_8", DENOISE_BOXCAR, 3);
+    benchmark_denoise("denoise_median3", DENOISE_MEDIAN3, 0);
+    profile_benchmark("format_frame", bench_format_frame, BENCHMARK_ITERATIONS);
+    profile_benchmark("convert_frame", bench_convert_frame, BENCHMARK_ITERATIONS);
+    /* The tables are set up once per size, only the interpolation is timed */
+    for (unsigned i = 0; i < sizeof(upscale_benches) / sizeof(upscale_benches[0]); i++) {
+        const upscale_bench *b = &upscale_benches[i];
+        upscale_init(&bench_up, 8, 8, b->size, b->size, b->kernel);
+        profile_benchmark(b->name, b->fn, BENCHMARK_ITERATIONS);
+    }
+    /* Most pixels of the synthetic frame are foreground, one large blob */
+    benchmark_presence("presence_8x8", 8, raw_temps);
+    upscale_init(&bench_up, 8, 8, 32, 32, UPSCALE_BICUBIC);
+    upscale_q15(&bench_up, raw_temps, bench_upscaled_q15);
+    benchmark_presence("presence_32x32", 32, bench_upscaled_q15);
+    profile_benchmark("frame_stats", bench_frame_stats, BENCHMARK_ITERATIONS);
+    profile_benchmark("ring_byte", bench_ring_byte, BENCHMARK_ITERATIONS);
+    profile_benchmark("ring_frame", bench_ring_frame, BENCHMARK_ITERATIONS);
+    profile_benchmark_ops("ring_copy_op", bench_ring_copy_ops, BENCHMARK_ITERATIONS, BENCH_RING_OPS);
+    profile_benchmark_ops("ring_in_place_op", bench_ring_in_place_ops, BENCHMARK_ITERATIONS, BENCH_RING_OPS);
+    profile_benchmark("pool_frame", bench_pool_frame, BENCHMARK_ITERATIONS);
+    profile_benchmark_done();
+}
+#endif
+
+/* Configure the sensor's threshold interrupt and the EXTI line for its INT pin */
+void hotspot_init() {
+    GridEYE_setUpperInterruptValueRaw(HOTSPOT_THRESHOLD);
+    /* Only interested in hot pixels, keep the lower threshold out of the way */
+    GridEYE_setLowerInterruptValueRaw(GRIDEYE_QUARTERS(-20));
+    GridEYE_setInterruptHysteresisRaw(HOTSPOT_HYSTERESIS);
+    GridEYE_setInterruptModeAbsolute();
+    GridEYE_interruptPinEnable();
+    GridEYE_clearAllStatusFlags();
+
+    __HAL_RCC_GPIOF_CLK_ENABLE();
+    __HAL_RCC_SYSCFG_CLK_ENABLE();
+
+    GPIO_InitTypeDef GPIO_InitStruct = {0};
+    GPIO_InitStruct.Pin = GRIDEYE_INT_PIN;
+    GPIO_InitStruct.Mode = GPIO_MODE_IT_FALLING;
+    GPIO_InitStruct.Pull = GPIO_PULLUP;
+    HAL_GPIO_Init(GRIDEYE_INT_PORT, &GPIO_InitStruct);
+
+    HAL_NVIC_SetPriority(GRIDEYE_INT_IRQn, 7, 0);
+    HAL_NVIC_EnableIRQ(GRIDEYE_INT_IRQn);
+
+    /* The pin may already have been low before the EXTI line was armed */
+    if (HAL_GPIO_ReadPin(GRIDEYE_INT_PORT, GRIDEYE_INT_PIN) == GPIO_PIN_RESET)
+        int_pending = true;
+}
+
+/*
+ * Read which pixels are above the threshold and their temperatures, and send
+ * them as one telemetry frame: the 8 byte interrupt table followed by the
+ * temperature (int16, quarter degrees) of each flagged pixel in pixel order.
+ */
+void handle_hotspot() {
+    uint8_t payload[GRIDEYE_INT_TABLE_LENGTH + 2 * GRIDEYE_PIXEL_COUNT];
+    uint8_t *table = payload;
+    uint16_t len = GRIDEYE_INT_TABLE_LENGTH;
+
+    if (!GridEYE_readInterruptTable(table))
+        return;
+
+    for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++) {
+        if (table[i / 8] & (1 << (i % 8))) {
+            int16_t temp = GridEYE_getPixelTemperatureSigned(i);
+            payload[len++] = temp & 0xFF;
+            payload[len++] = (temp >> 8) & 0xFF;
+        }
+    }
+    telemetry_send(TELEMETRY_TYPE_GRIDEYE_HOTSPOTS, payload, len);
+
+    /* Releases INT. The sensor pulls it again on its next frame if still hot. */
+    GridEYE_clearAllStatusFlags();
+}
+
+/* I2C interrupt, the background frame read has finished */
+void frame_read_done(i2c_transaction *t) {
+    frame *f = t->context;
+    if (t->error == HAL_I2C_ERROR_NONE) {
+        PROFILE_BEGIN(decode, "decode_frame");
+        GridEYE_decodeFrame(frame_raw, f->data);
+        PROFILE_END(decode);
+        PROFILE_BEGIN(correct, "correct_frame");
+        nuc_apply(&correction, f->data);
+        PROFILE_END(correct);
+        PROFILE_BEGIN(smooth, "denoise_frame");
+        denoise_apply(&smoothing, f->data);
+        PROFILE_END(smooth);
+        frame_store_publish(&frames, f);
+    } else {
+        frame_store_abandon(&frames, f);
+    }
+}
+
+/* Reads of a calibration frame before the capture is given up */
+#define CALIBRATION_READ_TRIES 3
+
+/*
+ * Flat-field calibration, with the user button held at reset: with the sensor
+ * looking at a uniform target, e.g. a blank wall, NUC_CAPTURE_FRAMES frames
+ * are averaged into per-pixel offsets and dead pixels and written to flash.
+ * A frame that can't be read is retried, and if that fails too the flash is
+ * left as it is.
+ */
+void capture_calibration() {
+    static nuc_capture capture;
+    int16_t frame[GRIDEYE_PIXEL_COUNT] = {0};
+
+    print("calibration: capturing %u frames of a uniform target\r\n", NUC_CAPTURE_FRAMES);
+    nuc_capture_begin(&capture);
+    for (int i = 0; i < NUC_CAPTURE_FRAMES; i++) {
+        bool read = false;
+        for (int tries = 0; tries < CALIBRATION_READ_TRIES && !read; tries++) {
+            HAL_Delay(FRAME_TIME_MS);
+            read = GridEYE_readFrame(frame);
+        }
+        if (!read) {
+            print("calibration: failed\r\n");
+            return;
+        }
+        nuc_capture_add(&capture, frame, GRIDEYE_PIXEL_COUNT);
+    }
+    if (!nuc_compute(&calibration, 8, 8, &capture, NULL) ||
+        !flash_store_write(&calibration_store, &calibration, sizeof(calibration)))
+        print("calibration: failed\r\n");
+}
+
+/* Correct frames with the calibration in flash, if there is one */
+void load_calibration() {
+    if (flash_store_read(&calibration_store, &calibration, sizeof(calibration))) {
+        print("calibration: %u dead pixels\r\n", calibration.dead_count);
+    } else {
+        nuc_table_identity(&calibration, 8, 8);
+        print("calibration: none, frames are not corrected\r\n");
+    }
+    nuc_init(&correction, &calibration);
+}
+
+/* Scheduler job of the periodic mode, starts a frame read and returns */
+void read_frame(const scheduler_sample *sample, void *context) {
+    /* NULL while the previous read is still running */
+    frame *f = frame_store_acquire(&frames);
+    if (f == NULL)
+        return;
+    f->timestamp = sample->start;
+    if (!GridEYE_startFrameRead(&frame_read, frame_raw, frame_read_done, f))
+        frame_store_abandon(&frames, f);
+}
+
+/* Scheduler job of the periodic mode, answers baud rate requests */
+void poll_console(const scheduler_sample *sample, void *context) {
+    console_handshake_poll();
+}
+
+void print_frame_stats() {
+    frame_store_stats stats;
+    frame_store_get_stats(&frames, &stats);
+    print("frames: %u published, %u dropped, %u overruns\r\n",
+          stats.published, stats.dropped, stats.overruns);
+}
+
+/* Report people crossing the counting line as they do */
+void print_crossings() {
+    static uint32_t entries = 0;
+    static uint32_t exits = 0;
+    presence_stats stats;
+    presence_get_stats(&people, &stats);
+    if (stats.entries == entries && stats.exits == exits)
+        return;
+    entries = stats.entries;
+    exits = stats.exits;
+    print("presence: %u entries, %u exits\r\n", entries, exits);
+}
+
+/* Handle the latest frame, if there is a new one */
+void handle_frame() {
+    static bool was_pressed = false;
+
+    const frame *f = frame_store_borrow(&frames, handled_seq);
+    if (f == NULL)
+        return;
+    handled_seq = f->seq;
+
+    PROFILE_BEGIN(upscale, "upscale_frame");
+    upscale_q15(&up, f->data, upscaled);
+    upscale_find_peak(&up, upscaled, &hottest);
+    PROFILE_END(upscale);
+
+    PROFILE_BEGIN(detect, "presence");
+#if PRESENCE_UPSCALED
+    presence_update(&people, upscaled, f->timestamp);
+#else
+    presence_update(&people, f->data, f->timestamp);
+#endif
+    PROFILE_END(detect);
+    print_crossings();
+
+    bool pressed = BSP_PB_GetState(BUTTON_USER) == BUTTON_PRESSED;
+    if (pressed) {
+#if OUTPUT_MODE == OUTPUT_TEXT
+        print_temps(f->data);
+#elif OUTPUT_MODE == OUTPUT_VISUALIZE
+        visualize_temps(upscaled, UPSCALE_SIZE);
+        print_hottest();
+#else
+        send_frame(f);
+#endif
+    }
+    frame_store_release(&frames, f);
+
+    /* Dump the profiling, scheduling and frame statistics once per press */
+    if (pressed && !was_pressed) {
+        profile_dump();
+        scheduler_dump();
+        print_frame_stats();
+        pool_dump();
+        presence_dump(&people);
+    }
+    was_pressed = pressed;
+}
+
+/* Sleep until a frame read is due or a new frame has arrived */
+void wait_for_frame() {
+    __disable_irq();
+    while (!scheduler_due() && frame_store_latest_seq(&frames) == handled_seq) {
+        __WFI();
+        __enable_irq();
+        __disable_irq();
+    }
+    __enable_irq();
+}
+
+/* Sleep until the next interrupt, unless one has already been handled */
+void wait_for_event() {
+    __disable_irq();
+    if (!int_pending && !dump_pending && !console_handshake_pending())
+        __WFI();
+    __enable_irq();
+}
+
 int main(void) {
-    HAL_MPU_Disable();
+    cache_init();
     HAL_Init();
-    SystemClock_Config();
+    clock_init();
 
     GPIO_Init();
-    USART3_UART_Init();
+    console_init(NULL);
+    print_init();
+    console_listen();
+    telemetry_init();
+    profile_init();
+
+#if BENCHMARK
+    benchmark();
+#endif
 
     GridEYE_begin();
 
-    BSP_PB_Init(BUTTON_USER, BUTTON_MODE_GPIO);
+#if ACQUISITION_MODE == ACQUISITION_THRESHOLD
+    /* The button wakes the MCU to dump the profiling statistics */
+    BSP_PB_Init(BUTTON_USER, BUTTON_MODE_EXTI);
+    hotspot_init();
 
     while (1) {
-        get_temps();
-        if (BSP_PB_GetState(BUTTON_USER) == BUTTON_PRESSED) {
-            print_temps();
+        wait_for_event();
+        if (int_pending) {
+            int_pending = false;
+            handle_hotspot();
         }
-        /* Give the sensor some rest time */
-        HAL_Delay(100);
+        if (dump_pending) {
+            dump_pending = false;
+            profile_dump();
+        }
+        console_handshake_poll();
     }
+#else
+    BSP_PB_Init(BUTTON_USER, BUTTON_MODE_GPIO);
+    if (BSP_PB_GetState(BUTTON_USER) == BUTTON_PRESSED)
+        capture_calibration();
+    load_calibration();
+    denoise_init(&smoothing, DENOISE_MODE, DENOISE_SHIFT);
+
+    if (!frame_store_init(&frames, frame_storage, sizeof(frame_storage[0]), FRAME_COUNT))
+        Error_Handler();
+    upscale_init(&up, 8, 8, UPSCALE_SIZE, UPSCALE_SIZE, UPSCALE_KERNEL);
+    presence_config config;
+    presence_default_config(&config, PRESENCE_SIZE, PRESENCE_SIZE);
+    presence_init(&people, &config);
+    scheduler_add("grideye", FRAME_TIME_MS * 1000, read_frame, NULL);
+    scheduler_add("console", CONSOLE_POLL_MS * 1000, poll_console, NULL);
+    scheduler_start(0);
+
+    while (1) {
+        clock_set_sysclk(clock_max_sysclk() / IDLE_CLOCK_DIVIDER);
+        wait_for_frame();
+        clock_set_sysclk(clock_max_sysclk());
+        scheduler_run();
+        handle_frame();
+    }
+#endif
 }
 
-/*
- * SysTick interrupt handler, needed for delays
- *
- * By default, an interrupt is generated every 1ms by the SysTick timer, which
- * calls this function. The HAL_delay() function checks a global variable to see
- * if the ms value passed to it has been reached. Here we increment that
- * variable by 1. Without this, the delay will just be an infinite loop.
- */
-void SysTick_Handler(void)
+/* GridEYE INT pin */
+void EXTI2_IRQHandler(void)
+{
+    HAL_GPIO_EXTI_IRQHandler(GRIDEYE_INT_PIN);
+}
+
+/* User button, in threshold mode */
+void EXTI15_10_IRQHandler(void)
+{
+    BSP_PB_IRQHandler(BUTTON_USER);
+}
+
+/* Called by BSP_PB_IRQHandler(), overrides the weak default */
+void BSP_PB_Callback(Button_TypeDef Button)
+{
+    if (Button == BUTTON_USER)
+        dump_pending = true;
+}
+
+/* Called by HAL_GPIO_EXTI_IRQHandler(), overrides the weak default */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
 {
-    HAL_IncTick();
+    if (GPIO_Pin == GRIDEYE_INT_PIN)
+        int_pending = true;
 }
 
 /* Initialize GPIO B pins 0 and 14 (for LEDs 1 and 3) */
@@ -102,96 +744,3 @@ void Error_Handler(void) {
         // Stay here
     }
 }
-
-/* Initialize UART clock, pins, and parameters */
-void USART3_UART_Init(void) {
-    RCC_PeriphCLKInitTypeDef RCC_PeriphClkInit;
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
-
-    // Enable GPIO clocks for USART3 TX and RX
-    __HAL_RCC_GPIOD_CLK_ENABLE();
-
-    // Enable USART3 clock
-    __HAL_RCC_USART3_CLK_ENABLE();
-
-    // Configure USART3 TX (PD8) and RX (PD9)
-    GPIO_InitStruct.Pin = GPIO_PIN_8 | GPIO_PIN_9;
-    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
-    GPIO_InitStruct.Alternate = GPIO_AF7_USART3;
-    HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
-
-    // Configure UART parameters
-    huart3.Instance = USART3;
-    huart3.Init.BaudRate = 115200;
-    huart3.Init.WordLength = UART_WORDLENGTH_8B;
-    huart3.Init.StopBits = UART_STOPBITS_1;
-    huart3.Init.Parity = UART_PARITY_NONE;
-    huart3.Init.Mode = UART_MODE_TX_RX;
-    huart3.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-    huart3.Init.OverSampling = UART_OVERSAMPLING_16;
-
-    if (HAL_UART_Init(&huart3) != HAL_OK) {
-        // Initialization Error
-        Error_Handler();
-    }
-}
-
-
-/* Clock setup, generated by CubeMX */
-void SystemClock_Config(void)
-{
-    RCC_OscInitTypeDef RCC_OscInitStruct = {0};
-    RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
-
-    /** Supply configuration update enable
-    */
-    HAL_PWREx_ConfigSupply(PWR_LDO_SUPPLY);
-
-    /** Configure the main internal regulator output voltage
-    */
-    __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE2);
-
-    while(!__HAL_PWR_GET_FLAG(PWR_FLAG_VOSRDY)) {}
-
-    /** Initializes the RCC Oscillators according to the specified parameters
-    * in the RCC_OscInitTypeDef structure.
-    */
-    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI|RCC_OSCILLATORTYPE_HSE;
-    RCC_OscInitStruct.HSEState = RCC_HSE_BYPASS;
-    RCC_OscInitStruct.HSIState = RCC_HSI_DIV1;
-    RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
-    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
-    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
-    RCC_OscInitStruct.PLL.PLLM = 1;
-    RCC_OscInitStruct.PLL.PLLN = 24;
-    RCC_OscInitStruct.PLL.PLLP = 2;
-    RCC_OscInitStruct.PLL.PLLQ = 4;
-    RCC_OscInitStruct.PLL.PLLR = 2;
-    RCC_OscInitStruct.PLL.PLLRGE = RCC_PLL1VCIRANGE_3;
-    RCC_OscInitStruct.PLL.PLLVCOSEL = RCC_PLL1VCOWIDE;
-    RCC_OscInitStruct.PLL.PLLFRACN = 0;
-    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
-    {
-        Error_Handler();
-    }
-
-    /** Initializes the CPU, AHB and APB buses clocks
-    */
-    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
-                                  |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2
-                                  |RCC_CLOCKTYPE_D3PCLK1|RCC_CLOCKTYPE_D1PCLK1;
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
-    RCC_ClkInitStruct.SYSCLKDivider = RCC_SYSCLK_DIV1;
-    RCC_ClkInitStruct.AHBCLKDivider = RCC_HCLK_DIV1;
-    RCC_ClkInitStruct.APB3CLKDivider = RCC_APB3_DIV1;
-    RCC_ClkInitStruct.APB1CLKDivider = RCC_APB1_DIV1;
-    RCC_ClkInitStruct.APB2CLKDivider = RCC_APB2_DIV1;
-    RCC_ClkInitStruct.APB4CLKDivider = RCC_APB4_DIV1;
-
-    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_1) != HAL_OK)
-    {
-        Error_Handler();
-    }
-}
@@ -27,6 +27,7 @@
   along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <string.h>
 #include "SparkFun_GridEYE_Arduino_Library.h"
 #include "i2c_stub.h"
 
@@ -59,7 +60,7 @@ float GridEYE_getPixelTemperature(unsigned char pixelAddr)
   if (!GridEYE_getRegister16(pixelLowRegister, &temperature))
     return -99.0; // Indicate a read error
 
-  return (GridEYE_convertSigned12ToFloat(temperature) * 0.25); // GridEYE_convert to Degrees C. LSB resolution is 0.25C.
+  return (GridEYE_convertSigned12ToFloat(temperature) * 0.25f); // GridEYE_convert to Degrees C. LSB resolution is 0.25C.
 }
 
 float GridEYE_getPixelTemperatureFahrenheit(unsigned char pixelAddr)
@@ -100,6 +101,111 @@ int16_t GridEYE_getPixelTemperatureSigned(unsigned char pixelAddr)
   return GridEYE_convertUnsignedSigned16(temperature); // GridEYE_convert to int16_t without ambiguity
 }
 
+/********************************************************
+ * Functions for retreiving the temperature of
+ * all pixels at once.
+ ********************************************************
+ *
+ * readFrame() - reads all 128 temperature registers in a
+ *    single auto-increment transfer and stores the signed
+ *    12-bit value of each pixel (0.25C per LSB) in out
+ *
+ * convertFrameToFloat() - converts a frame from readFrame()
+ *    to float Celsius
+ *
+ * startFrameRead() - queues the same transfer without
+ *    waiting for it, so a frame can be read while the
+ *    CPU does something else. The callback is called from
+ *    the I2C interrupt once raw holds the registers, which
+ *    decodeFrame() turns into pixels like readFrame().
+ *
+ * formatQuarters() - writes a pixel value as exact
+ *    decimal Celsius, e.g. "-3.75", without going
+ *    through float
+ *
+ ********************************************************/
+
+bool GridEYE_readFrame(int16_t out[GRIDEYE_PIXEL_COUNT])
+{
+  uint8_t raw[GRIDEYE_FRAME_BYTES];
+
+  if (!GridEYE_getRegisters(TEMPERATURE_REGISTER_START, raw, sizeof(raw)))
+    return false;
+
+  GridEYE_decodeFrame(raw, out);
+  return true;
+}
+
+bool GridEYE_startFrameRead(i2c_transaction *t, uint8_t raw[GRIDEYE_FRAME_BYTES], i2c_callback callback, void *context)
+{
+  static const uint8_t reg = TEMPERATURE_REGISTER_START;
+
+  t->addr = DEFAULT_ADDRESS;
+  t->tx = &reg;
+  t->tx_len = 1;
+  t->rx = raw;
+  t->rx_len = GRIDEYE_FRAME_BYTES;
+  t->callback = callback;
+  t->context = context;
+  return i2c_async_submit(t);
+}
+
+// Each pixel is stored low register first, as 12-bit twos complement. With the
+// 12 bits kept, (value ^ 0x800) - 0x800 sign-extends it.
+void GridEYE_decodeFrame(const uint8_t raw[GRIDEYE_FRAME_BYTES], int16_t out[GRIDEYE_PIXEL_COUNT])
+{
+#if defined(__ARM_FEATURE_DSP) && __ARM_FEATURE_DSP
+  // Two pixels per word, USUB16 subtracts the halfwords without a borrow from
+  // one into the other. Unaligned word accesses are fine on the M7.
+  for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i += 2)
+  {
+    uint32_t pair;
+    memcpy(&pair, &raw[2 * i], sizeof(pair));
+    pair = __USUB16((pair & 0x0FFF0FFF) ^ 0x08000800, 0x08000800);
+    memcpy(&out[i], &pair, sizeof(pair));
+  }
+#else
+  for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+  {
+    uint16_t temperature = (raw[2 * i] | (raw[2 * i + 1] << 8)) & 0x0FFF;
+    out[i] = (int16_t)((temperature ^ 0x0800) - 0x0800);
+  }
+#endif
+}
+
+void GridEYE_convertFrameToFloat(const int16_t in[GRIDEYE_PIXEL_COUNT], float out[GRIDEYE_PIXEL_COUNT])
+{
+  for (int i = 0; i < GRIDEYE_PIXEL_COUNT; i++)
+    out[i] = in[i] * 0.25f; // LSB resolution is 0.25C
+}
+
+int GridEYE_formatQuarters(int16_t quarters, char buf[GRIDEYE_FORMAT_LENGTH])
+{
+  static const char fractions[4][3] = {"00", "25", "50", "75"};
+  char digits[5];
+  int count = 0;
+  int len = 0;
+
+  uint16_t magnitude = quarters < 0 ? -quarters : quarters;
+  if (quarters < 0)
+    buf[len++] = '-';
+
+  uint16_t whole = magnitude >> 2;
+  do
+  {
+    digits[count++] = '0' + whole % 10;
+    whole /= 10;
+  } while (whole > 0);
+  while (count > 0)
+    buf[len++] = digits[--count];
+
+  buf[len++] = '.';
+  buf[len++] = fractions[magnitude & 3][0];
+  buf[len++] = fractions[magnitude & 3][1];
+  buf[len] = '\0';
+  return len;
+}
+
 /********************************************************
  * Functions for retreiving the temperature of
  * the device according to the embedded thermistor.
@@ -428,6 +534,10 @@ void GridEYE_clearAllStatusFlags()
  * pixelInterruptSet() - Returns true if interrupt flag
  * is set for the specified pixel
  *
+ * readInterruptTable() - Reads all 8 rows of the table
+ * in one transfer. Bit n of row r is set if the flag of
+ * pixel 8 * r + n is set
+ *
  ********************************************************/
 
 bool GridEYE_pixelInterruptSet(uint8_t pixelAddr)
@@ -443,6 +553,11 @@ bool GridEYE_pixelInterruptSet(uint8_t pixelAddr)
   return (interruptTableRow & (1 << pixelPosition));
 }
 
+bool GridEYE_readInterruptTable(uint8_t table[GRIDEYE_INT_TABLE_LENGTH])
+{
+  return GridEYE_getRegisters(INT_TABLE_REGISTER_INT0, table, GRIDEYE_INT_TABLE_LENGTH);
+}
+
 /********************************************************
  * Functions for manipulating Average Register
  ********************************************************
@@ -752,6 +867,8 @@ int16_t GridEYE_getInterruptHysteresisSigned()
  *
  * GridEYE_getRegister() - get up to INT16 value from unsigned char register
  *
+ * GridEYE_getRegisters() - get len consecutive registers starting at reg
+ *
  ********************************************************/
 
 bool GridEYE_setRegister(unsigned char reg, unsigned char val)
@@ -774,6 +891,11 @@ bool GridEYE_getRegister16(unsigned char reg, uint16_t *val)
   return true;
 }
 
+bool GridEYE_getRegisters(unsigned char reg, uint8_t *buf, uint16_t len)
+{
+  return i2c_memRead(DEFAULT_ADDRESS, reg, buf, len) == HAL_I2C_ERROR_NONE;
+}
+
 // Provided for backward compatibility only. Not recommended...
 int16_t GridEYE_getRegister(unsigned char reg, int8_t len)
 {
@@ -837,7 +959,7 @@ uint16_t GridEYE_convertFloatToSigned12(float val)
   int16_t signedVal = (int16_t)val;
   uint16_t unsignedVal = GridEYE_convertSignedUnsigned16(signedVal); // GridEYE_convert without ambiguity
 
-  if (unsignedVal | (1 << 15)) // If the two's complement value is negative
+  if (unsignedVal & (1 << 15)) // If the two's complement value is negative
     return ((unsignedVal & 0x0FFF) | (1 << 11)); // Limit to 12-bits
   else
     return(unsignedVal & 0x07FF);
@@ -31,6 +31,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include "i2c_async.h"
 
 // The default I2C address for the THING on the SparkX breakout is 0x69. 0x68 is also possible.
 #define DEFAULT_ADDRESS 0x69
@@ -63,6 +64,15 @@
 #define RESERVED_AVERAGE_REGISTER 0x1F
 #define TEMPERATURE_REGISTER_START 0x80
 
+// Frame geometry
+#define GRIDEYE_PIXEL_COUNT 64
+#define GRIDEYE_INT_TABLE_LENGTH 8 // One bit per pixel, INT0 to INT7
+#define GRIDEYE_FRAME_BYTES (2 * GRIDEYE_PIXEL_COUNT) // Temperature registers of a frame
+
+// Pixel values are signed quarter-degrees Celsius, the sensor's native unit
+#define GRIDEYE_QUARTERS(degreesC) ((int16_t)((degreesC) * 4))
+#define GRIDEYE_FORMAT_LENGTH 9 // "-8192.00" and the terminating zero, for any int16_t
+
 void GridEYE_begin();
 
 float GridEYE_getPixelTemperature(unsigned char pixelAddr);
@@ -70,6 +80,12 @@ int16_t GridEYE_getPixelTemperatureRaw(unsigned char pixelAddr); // The return v
 int16_t GridEYE_getPixelTemperatureSigned(unsigned char pixelAddr);
 float GridEYE_getPixelTemperatureFahrenheit(unsigned char pixelAddr);
 
+bool GridEYE_readFrame(int16_t out[GRIDEYE_PIXEL_COUNT]); // Signed quarter-degrees Celsius, one burst read
+void GridEYE_convertFrameToFloat(const int16_t in[GRIDEYE_PIXEL_COUNT], float out[GRIDEYE_PIXEL_COUNT]);
+bool GridEYE_startFrameRead(i2c_transaction *t, uint8_t raw[GRIDEYE_FRAME_BYTES], i2c_callback callback, void *context); // Returns at once, callback runs in the I2C interrupt
+void GridEYE_decodeFrame(const uint8_t raw[GRIDEYE_FRAME_BYTES], int16_t out[GRIDEYE_PIXEL_COUNT]);
+int GridEYE_formatQuarters(int16_t quarters, char buf[GRIDEYE_FORMAT_LENGTH]); // Exact decimal Celsius, returns the length
+
 float GridEYE_getDeviceTemperature();
 int16_t GridEYE_getDeviceTemperatureRaw(); // The return value is somewhat ambiguous. Use getDeviceTemperatureSigned for a better experience...
 int16_t GridEYE_getDeviceTemperatureSigned();
@@ -101,6 +117,7 @@ void GridEYE_clearAllOverflow();
 void GridEYE_clearAllStatusFlags();
 
 bool GridEYE_pixelInterruptSet(uint8_t pixelAddr);
+bool GridEYE_readInterruptTable(uint8_t table[GRIDEYE_INT_TABLE_LENGTH]); // All rows in one burst read
 
 void GridEYE_movingAverageEnable();
 void GridEYE_movingAverageDisable();
@@ -137,6 +154,7 @@ bool GridEYE_setRegister(unsigned char reg, unsigned char val);
 int16_t GridEYE_getRegister(unsigned char reg, int8_t len); // Provided for backward compatibility only. Not recommended...
 bool GridEYE_getRegister8(unsigned char reg, uint8_t *val);
 bool GridEYE_getRegister16(unsigned char reg, uint16_t *val); // Note: this returns an unsigned val. Use convertUnsignedSigned to convert to int16_t
+bool GridEYE_getRegisters(unsigned char reg, uint8_t *buf, uint16_t len); // Burst read using the sensor's address auto-increment
 int16_t GridEYE_convertUnsignedSigned16(uint16_t val);
 uint16_t GridEYE_convertSignedUnsigned16(int16_t val);
 float GridEYE_convertSigned12ToFloat(uint16_t val);
@@ -1,60 +1,148 @@
 #include <stdint.h>
+#include <math.h>
 #include "stm32h7xx_hal.h"
 #include "stm32h7xx_nucleo.h"
+#include "cache.h"
+#include "clock.h"
+#include "scheduler.h"
+#include "console.h"
 #include "SparkFun_AS7265X.h"
 #include "debug.h"
+#include "telemetry.h"
+#include "profile.h"
+#include "pool.h"
 
-void SystemClock_Config(void);
 void GPIO_Init(void);
-void USART3_UART_Init(void);
-
-UART_HandleTypeDef huart3;
 
 void Error_Handler();
 
+/* Set to 1 to compare the per-channel getters with AS7265X_readSpectrum() once at startup */
+#ifndef SPECTRUM_BENCHMARK
+#define SPECTRUM_BENCHMARK 0
+#endif
+
+/* Time between measurements while the user button is pressed, gives the sensor some rest */
+#define SAMPLE_PERIOD_MS 1000
+
+/* How often the main loop answers baud rate requests from the host */
+#define CONSOLE_POLL_MS 100
+
+AS7265X_Spectrum spectrum;
+
+#if SPECTRUM_BENCHMARK
+/* Read all 18 calibrated channels the old way and with one readSpectrum() call */
+void benchmark_spectrum() {
+    float (*const getters[AS7265X_CHANNEL_COUNT])() = {
+        AS7265X_getCalibratedA, AS7265X_getCalibratedB, AS7265X_getCalibratedC,
+        AS7265X_getCalibratedD, AS7265X_getCalibratedE, AS7265X_getCalibratedF,
+        AS7265X_getCalibratedG, AS7265X_getCalibratedH, AS7265X_getCalibratedR,
+        AS7265X_getCalibratedI, AS7265X_getCalibratedS, AS7265X_getCalibratedJ,
+        AS7265X_getCalibratedT, AS7265X_getCalibratedU, AS7265X_getCalibratedV,
+        AS7265X_getCalibratedW, AS7265X_getCalibratedK, AS7265X_getCalibratedL,
+    };
+
+    uint32_t start = profile_cycles();
+    for (int i = 0; i < AS7265X_CHANNEL_COUNT; i++)
+        spectrum.calibrated[i] = getters[i]();
+    uint32_t getters_cycles = profile_cycles() - start;
+
+    start = profile_cycles();
+    AS7265X_readSpectrum(&spectrum);
+    uint32_t spectrum_cycles = profile_cycles() - start;
+
+    print("18 getters: %u cycles (%u us)\r\n", getters_cycles, profile_cycles_to_us(getters_cycles));
+    print("readSpectrum: %u cycles (%u us)\r\n", spectrum_cycles, profile_cycles_to_us(spectrum_cycles));
+}
+#endif
+
+#if BENCHMARK
+/* Results, volatile so the optimizer can't drop the computations */
+volatile float centroid;
+float normalized[AS7265X_CHANNEL_COUNT];
+
+/* Irradiance-weighted mean wavelength in nm */
+void bench_centroid() {
+    float weighted = 0;
+    float total = 0;
+    for (int i = 0; i < AS7265X_CHANNEL_COUNT; i++) {
+        weighted += spectrum.calibrated[i] * AS7265X_wavelengths[i];
+        total += spectrum.calibrated[i];
+    }
+    centroid = weighted / total;
+}
+
+/* Scale the spectrum to a peak of 1 */
+void bench_normalize() {
+    float peak = spectrum.calibrated[0];
+    for (int i = 1; i < AS7265X_CHANNEL_COUNT; i++)
+        peak = fmaxf(peak, spectrum.calibrated[i]);
+    for (int i = 0; i < AS7265X_CHANNEL_COUNT; i++)
+        normalized[i] = spectrum.calibrated[i] / peak;
+}
+
+/* Fixed benchmark loop on a synthetic spectrum, see profile_benchmark() */
+void benchmark() {
+    for (int i = 0; i < AS7265X_CHANNEL_COUNT; i++)
+        spectrum.calibrated[i] = 100.0f + 7.5f * i;
+    profile_benchmark("centroid", bench_centroid, BENCHMARK_ITERATIONS);
+    profile_benchmark("normalize", bench_normalize, BENCHMARK_ITERATIONS);
+    profile_benchmark_done();
+}
+#endif
+
+/* Scheduler job, answers baud rate requests */
+void poll_console(const scheduler_sample *sample, void *context) {
+    console_handshake_poll();
+}
+
+/* Scheduler job, measures and sends the spectrum while the button is pressed */
+void measure(const scheduler_sample *sample, void *context) {
+    if (BSP_PB_GetState(BUTTON_USER) != BUTTON_PRESSED)
+        return;
+
+    AS7265X_takeMeasurementsWithBulb();
+    /* Send out all channels, see util/uart_gui_qt5.py */
+    AS7265X_readSpectrum(&spectrum);
+    telemetry_send_at(TELEMETRY_TYPE_AS7265X_SPECTRUM, &spectrum, sizeof(spectrum), sample->start);
+    profile_dump();
+    scheduler_dump();
+    pool_dump();
+}
+
 int main(void) {
-    HAL_MPU_Disable();
+    cache_init();
     HAL_Init();
-    SystemClock_Config();
+    clock_init();
 
     GPIO_Init();
-    USART3_UART_Init();
+    console_init(NULL);
+    print_init();
+    console_listen();
+    telemetry_init();
+    profile_init();
+
+#if BENCHMARK
+    benchmark();
+#endif
 
     AS7265X_begin();
 
+#if SPECTRUM_BENCHMARK
+    benchmark_spectrum();
+#endif
+
     BSP_PB_Init(BUTTON_USER, BUTTON_MODE_GPIO);
 
+    scheduler_add("spectrum", SAMPLE_PERIOD_MS * 1000, measure, NULL);
+    scheduler_add("console", CONSOLE_POLL_MS * 1000, poll_console, NULL);
+    scheduler_start(0);
+
     while (1) {
-        if (BSP_PB_GetState(BUTTON_USER) == BUTTON_PRESSED) {
-            AS7265X_takeMeasurementsWithBulb();
-            /* Print out some values */
-            print("A: %f, B: %f, C: %f, D: %f, E: %f, F: %f\r\n",
-                  AS7265X_getCalibratedA(),
-                  AS7265X_getCalibratedB(),
-                  AS7265X_getCalibratedC(),
-                  AS7265X_getCalibratedD(),
-                  AS7265X_getCalibratedE(),
-                  AS7265X_getCalibratedF()
-                );
-            /* Give the sensor some rest time */
-            HAL_Delay(1000);
-        }
+        scheduler_wait();
+        scheduler_run();
     }
 }
 
-/*
- * SysTick interrupt handler, needed for delays
- *
- * By default, an interrupt is generated every 1ms by the SysTick timer, which
- * calls this function. The HAL_delay() function checks a global variable to see
- * if the ms value passed to it has been reached. Here we increment that
- * variable by 1. Without this, the delay will just be an infinite loop.
- */
-void SysTick_Handler(void)
-{
-    HAL_IncTick();
-}
-
 /* Initialize GPIO B pins 0 and 14 (for LEDs 1 and 3) */
 void GPIO_Init(void) {
     __HAL_RCC_GPIOB_CLK_ENABLE();
@@ -75,96 +163,3 @@ void Error_Handler(void) {
         // Stay here
     }
 }
-
-/* Initialize UART clock, pins, and parameters */
-void USART3_UART_Init(void) {
-    RCC_PeriphCLKInitTypeDef RCC_PeriphClkInit;
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
-
-    // Enable GPIO clocks for USART3 TX and RX
-    __HAL_RCC_GPIOD_CLK_ENABLE();
-
-    // Enable USART3 clock
-    __HAL_RCC_USART3_CLK_ENABLE();
-
-    // Configure USART3 TX (PD8) and RX (PD9)
-    GPIO_InitStruct.Pin = GPIO_PIN_8 | GPIO_PIN_9;
-    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
-    GPIO_InitStruct.Alternate = GPIO_AF7_USART3;
-    HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
-
-    // Configure UART parameters
-    huart3.Instance = USART3;
-    huart3.Init.BaudRate = 115200;
-    huart3.Init.WordLength = UART_WORDLENGTH_8B;
-    huart3.Init.StopBits = UART_STOPBITS_1;
-    huart3.Init.Parity = UART_PARITY_NONE;
-    huart3.Init.Mode = UART_MODE_TX_RX;
-    huart3.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-    huart3.Init.OverSampling = UART_OVERSAMPLING_16;
-
-    if (HAL_UART_Init(&huart3) != HAL_OK) {
-        // Initialization Error
-        Error_Handler();
-    }
-}
-
-
-/* Clock setup, generated by CubeMX */
-void SystemClock_Config(void)
-{
-    RCC_OscInitTypeDef RCC_OscInitStruct = {0};
-    RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
-
-    /** Supply configuration update enable
-    */
-    HAL_PWREx_ConfigSupply(PWR_LDO_SUPPLY);
-
-    /** Configure the main internal regulator output voltage
-    */
-    __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE2);
-
-    while(!__HAL_PWR_GET_FLAG(PWR_FLAG_VOSRDY)) {}
-
-    /** Initializes the RCC Oscillators according to the specified parameters
-    * in the RCC_OscInitTypeDef structure.
-    */
-    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSI|RCC_OSCILLATORTYPE_HSE;
-    RCC_OscInitStruct.HSEState = RCC_HSE_BYPASS;
-    RCC_OscInitStruct.HSIState = RCC_HSI_DIV1;
-    RCC_OscInitStruct.HSICalibrationValue = RCC_HSICALIBRATION_DEFAULT;
-    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
-    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
-    RCC_OscInitStruct.PLL.PLLM = 1;
-    RCC_OscInitStruct.PLL.PLLN = 24;
-    RCC_OscInitStruct.PLL.PLLP = 2;
-    RCC_OscInitStruct.PLL.PLLQ = 4;
-    RCC_OscInitStruct.PLL.PLLR = 2;
-    RCC_OscInitStruct.PLL.PLLRGE = RCC_PLL1VCIRANGE_3;
-    RCC_OscInitStruct.PLL.PLLVCOSEL = RCC_PLL1VCOWIDE;
-    RCC_OscInitStruct.PLL.PLLFRACN = 0;
-    if (HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
-    {
-        Error_Handler();
-    }
-
-    /** Initializes the CPU, AHB and APB buses clocks
-    */
-    RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
-                                  |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2
-                                  |RCC_CLOCKTYPE_D3PCLK1|RCC_CLOCKTYPE_D1PCLK1;
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
-    RCC_ClkInitStruct.SYSCLKDivider = RCC_SYSCLK_DIV1;
-    RCC_ClkInitStruct.AHBCLKDivider = RCC_HCLK_DIV1;
-    RCC_ClkInitStruct.APB3CLKDivider = RCC_APB3_DIV1;
-    RCC_ClkInitStruct.APB1CLKDivider = RCC_APB1_DIV1;
-    RCC_ClkInitStruct.APB2CLKDivider = RCC_APB2_DIV1;
-    RCC_ClkInitStruct.APB4CLKDivider = RCC_APB4_DIV1;
-
-    if (HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_1) != HAL_OK)
-    {
-        Error_Handler();
-    }
-}
@@ -28,6 +28,24 @@
 #include "SparkFun_AS7265X.h"
 #include "i2c_stub.h"
 #include "debug.h"
+#include "profile.h"
+#include "timebase.h"
+
+//Device selected in AS7265X_DEV_SELECT_CONTROL, to skip writing it again
+#define AS7265X_DEVICE_UNKNOWN 0xFF
+static uint8_t selectedDevice = AS7265X_DEVICE_UNKNOWN;
+
+const char AS7265X_channelNames[AS7265X_CHANNEL_COUNT + 1] = "ABCDEFGHRISJTUVWKL";
+const uint16_t AS7265X_wavelengths[AS7265X_CHANNEL_COUNT] = {
+    410, 435, 460, 485, 510, 535, 560, 585, 610,
+    645, 680, 705, 730, 760, 810, 860, 900, 940};
+
+//Position in AS7265X_Spectrum of each device's six channels, in register order
+static const uint8_t spectrumIndex[3][AS7265X_CAL_CHANNEL_COUNT] = {
+    [AS72651_NIR] = {8, 10, 12, 13, 14, 15},   //R S T U V W
+    [AS72652_VISIBLE] = {6, 7, 9, 11, 16, 17}, //G H I J K L
+    [AS72653_UV] = {0, 1, 2, 3, 4, 5},         //A B C D E F
+};
 
 
 //Initializes the sensor with basic settings
@@ -35,6 +53,7 @@
 bool AS7265X_begin()
 {
     i2c_begin();
+    selectedDevice = AS7265X_DEVICE_UNKNOWN;
 
     while (i2c_deviceReady(AS7265X_ADDR)) {
         HAL_Delay(2000);
@@ -228,9 +247,9 @@ uint16_t AS7265X_getF()
 uint16_t AS7265X_getChannel(uint8_t channelRegister, uint8_t device)
 {
     AS7265X_selectDevice(device);
-    uint16_t colorData = AS7265X_virtualReadRegister(channelRegister) << 8; //High uint8_t
-    colorData |= AS7265X_virtualReadRegister(channelRegister + 1);                    //Low uint8_t
-    return (colorData);
+    uint8_t b[2];
+    AS7265X_virtualReadRegisters(channelRegister, b, sizeof(b));
+    return ((b[0] << 8) | b[1]); //High byte first
 }
 
 //Returns the various calibration data
@@ -310,25 +329,62 @@ float AS7265X_getCalibratedW()
     return (AS7265X_getCalibratedValue(AS7265X_W_L_F_CAL, AS72651_NIR));
 }
 
+//Channel calibrated values are stored big-endian
+static float AS7265X_calBytesToFloat(const uint8_t *b)
+{
+    uint32_t calBytes = 0;
+    calBytes |= ((uint32_t)b[0] << (8 * 3));
+    calBytes |= ((uint32_t)b[1] << (8 * 2));
+    calBytes |= ((uint32_t)b[2] << (8 * 1));
+    calBytes |= ((uint32_t)b[3] << (8 * 0));
+
+    return (AS7265X_convertBytesToFloat(calBytes));
+}
+
 //Given an address, read four bytes and return the floating point calibrated value
 float AS7265X_getCalibratedValue(uint8_t calAddress, uint8_t device)
 {
     AS7265X_selectDevice(device);
 
-    uint8_t b0, b1, b2, b3;
-    b0 = AS7265X_virtualReadRegister(calAddress + 0);
-    b1 = AS7265X_virtualReadRegister(calAddress + 1);
-    b2 = AS7265X_virtualReadRegister(calAddress + 2);
-    b3 = AS7265X_virtualReadRegister(calAddress + 3);
+    uint8_t b[4];
+    AS7265X_virtualReadRegisters(calAddress, b, sizeof(b));
 
-    //Channel calibrated values are stored big-endian
-    uint32_t calBytes = 0;
-    calBytes |= ((uint32_t)b0 << (8 * 3));
-    calBytes |= ((uint32_t)b1 << (8 * 2));
-    calBytes |= ((uint32_t)b2 << (8 * 1));
-    calBytes |= ((uint32_t)b3 << (8 * 0));
+    return (AS7265X_calBytesToFloat(b));
+}
 
-    return (AS7265X_convertBytesToFloat(calBytes));
+//Read all six calibrated channels of a device in one pipelined sequence
+//out[0] is the R, G or A channel, out[5] the W, L or F channel
+void AS7265X_getCalibratedValues(uint8_t device, float out[AS7265X_CAL_CHANNEL_COUNT])
+{
+    AS7265X_selectDevice(device);
+
+    uint8_t b[AS7265X_CAL_BYTES];
+    AS7265X_virtualReadRegisters(AS7265X_R_G_A_CAL, b, sizeof(b));
+
+    for (int i = 0; i < AS7265X_CAL_CHANNEL_COUNT; i++)
+        out[i] = AS7265X_calBytesToFloat(&b[4 * i]);
+}
+
+//Read every channel of every device. The raw and calibrated registers are
+//adjacent, so each device takes one device select and one 36 byte read.
+void AS7265X_readSpectrum(AS7265X_Spectrum *out)
+{
+    uint8_t b[AS7265X_RAW_BYTES + AS7265X_CAL_BYTES];
+
+    for (uint8_t device = AS72651_NIR; device <= AS72653_UV; device++)
+    {
+        AS7265X_selectDevice(device);
+        AS7265X_virtualReadRegisters(AS7265X_R_G_A, b, sizeof(b));
+
+        for (int i = 0; i < AS7265X_CAL_CHANNEL_COUNT; i++)
+        {
+            uint8_t index = spectrumIndex[device][i];
+            out->raw[index] = (b[2 * i] << 8) | b[2 * i + 1]; //High byte first
+            out->calibrated[index] = AS7265X_calBytesToFloat(&b[AS7265X_RAW_BYTES + 4 * i]);
+        }
+    }
+
+    out->timestamp = HAL_GetTick();
 }
 
 //Given 4 bytes returns the floating point value
@@ -447,8 +503,12 @@ void AS7265X_setBulbCurrent(uint8_t current, uint8_t device)
 //As we read various registers we have to point at the master or first/second slave
 void AS7265X_selectDevice(uint8_t device)
 {
+    if (device == selectedDevice)
+        return; //Already pointing there, save the virtual write
+
     //Set the bits 0:1. Just overwrite whatever is there because masking in the correct value doesn't work.
     AS7265X_virtualWriteRegister(AS7265X_DEV_SELECT_CONTROL, device);
+    selectedDevice = device;
 
     //This fails
     //uint8_t value = AS7265X_virtualReadRegister(AS7265X_DEV_SELECT_CONTROL);
@@ -522,73 +582,141 @@ void AS7265X_softReset()
     uint8_t value = AS7265X_virtualReadRegister(AS7265X_CONFIG); //Read
     value |= (1 << 7);                                                                     //Set RST bit, automatically cleared after reset
     AS7265X_virtualWriteRegister(AS7265X_CONFIG, value);                 //Write
+    selectedDevice = AS7265X_DEVICE_UNKNOWN;                             //Reset selects the master again
 }
 
-//Read a virtual register from the AS7265x
-uint8_t AS7265X_virtualReadRegister(uint8_t virtualAddr)
+//Prepare reading len consecutive virtual registers into buf
+void AS7265X_virtualReadStart(AS7265X_VirtualOp *op, uint8_t virtualAddr, uint8_t *buf, uint8_t len)
 {
-    uint8_t status;
+    op->state = AS7265X_VIRTUAL_WAIT_TX;
+    op->write = false;
+    op->addr = virtualAddr;
+    op->buf = buf;
+    op->len = len;
+    op->pos = 0;
+}
 
-    //Do a prelim check of the read register
-    status = AS7265X_readRegister(AS7265X_STATUS_REG);
-    if ((status & AS7265X_RX_VALID) != 0) //There is data to be read
-    {
-        AS7265X_readRegister(AS7265X_READ_REG); //Read the byte but do nothing with it
-    }
+//Prepare writing one virtual register
+void AS7265X_virtualWriteStart(AS7265X_VirtualOp *op, uint8_t virtualAddr, uint8_t dataToWrite)
+{
+    op->state = AS7265X_VIRTUAL_WAIT_TX;
+    op->write = true;
+    op->addr = virtualAddr;
+    op->data = dataToWrite;
+}
 
-    //Wait for WRITE flag to clear
-    while (1)
+//Read the status register once and take the next step if the flags allow it
+//Returns true if the op made progress, false if the caller should back off
+bool AS7265X_virtualPoll(AS7265X_VirtualOp *op)
+{
+    uint8_t status;
+
+    switch (op->state)
     {
+    case AS7265X_VIRTUAL_WAIT_TX:
         status = AS7265X_readRegister(AS7265X_STATUS_REG);
-        if ((status & AS7265X_TX_VALID) == 0)
-            break; // If TX bit is clear, it is ok to write
-        HAL_Delay(AS7265X_POLLING_DELAY);
-    }
+        if (!op->write && (status & AS7265X_RX_VALID) != 0)
+            AS7265X_readRegister(AS7265X_READ_REG); //Stale byte from an earlier read, discard it
+        if ((status & AS7265X_TX_VALID) != 0)
+            return (false); //Inbound TX still pending at slave
+
+        if (op->write)
+        {
+            // Send the virtual register address (setting bit 7 to indicate we are writing to a register).
+            AS7265X_writeRegister(AS7265X_WRITE_REG, (op->addr | 1 << 7));
+            op->state = AS7265X_VIRTUAL_WAIT_TX_DATA;
+        }
+        else if (op->len == 0)
+        {
+            op->state = AS7265X_VIRTUAL_DONE;
+        }
+        else
+        {
+            // Send the virtual register address (bit 7 should be 0 to indicate we are reading a register).
+            AS7265X_writeRegister(AS7265X_WRITE_REG, op->addr);
+            op->state = AS7265X_VIRTUAL_WAIT_RX;
+        }
+        return (true);
+
+    case AS7265X_VIRTUAL_WAIT_RX:
+        status = AS7265X_readRegister(AS7265X_STATUS_REG);
+        if ((status & AS7265X_RX_VALID) == 0)
+            return (false); //Read data not ready yet
+
+        op->buf[op->pos++] = AS7265X_readRegister(AS7265X_READ_REG);
+        if (op->pos == op->len)
+        {
+            op->state = AS7265X_VIRTUAL_DONE;
+        }
+        else
+        {
+            //The slave has consumed the previous address to produce RX data, so
+            //the next one can go out right away without checking TX_VALID
+            AS7265X_writeRegister(AS7265X_WRITE_REG, op->addr + op->pos);
+        }
+        return (true);
+
+    case AS7265X_VIRTUAL_WAIT_TX_DATA:
+        status = AS7265X_readRegister(AS7265X_STATUS_REG);
+        if ((status & AS7265X_TX_VALID) != 0)
+            return (false); //Slave hasn't taken the address yet
 
-    // Send the virtual register address (bit 7 should be 0 to indicate we are reading a register).
-    AS7265X_writeRegister(AS7265X_WRITE_REG, virtualAddr);
+        // Send the data to complete the operation.
+        AS7265X_writeRegister(AS7265X_WRITE_REG, op->data);
+        op->state = AS7265X_VIRTUAL_DONE;
+        return (true);
 
-    //Wait for READ flag to be set
-    while (1)
-    {
-        status = AS7265X_readRegister(AS7265X_STATUS_REG);
-        if ((status & AS7265X_RX_VALID) != 0)
-            break; // Read data is ready.
-        HAL_Delay(AS7265X_POLLING_DELAY);
+    case AS7265X_VIRTUAL_DONE:
+    default:
+        return (false);
     }
-
-    uint8_t incoming = AS7265X_readRegister(AS7265X_READ_REG);
-    return (incoming);
 }
 
-//Write to a virtual register in the AS726x
-void AS7265X_virtualWriteRegister(uint8_t virtualAddr, uint8_t dataToWrite)
+//Step the op until it's done, backing off exponentially while the slave is busy
+void AS7265X_virtualRun(AS7265X_VirtualOp *op)
 {
-    uint8_t status;
+    uint32_t backoff = AS7265X_VIRTUAL_POLL_MIN_US;
 
-    //Wait for WRITE register to be empty
-    while (1)
+    while (op->state != AS7265X_VIRTUAL_DONE)
     {
-        status = AS7265X_readRegister(AS7265X_STATUS_REG);
-        if ((status & AS7265X_TX_VALID) == 0)
-            break; // No inbound TX pending at slave. Okay to write now.
-        HAL_Delay(AS7265X_POLLING_DELAY);
+        if (AS7265X_virtualPoll(op))
+        {
+            backoff = AS7265X_VIRTUAL_POLL_MIN_US;
+            continue;
+        }
+        timebase_sleep_us(backoff);
+        backoff *= 2;
+        if (backoff > AS7265X_VIRTUAL_POLL_MAX_US)
+            backoff = AS7265X_VIRTUAL_POLL_MAX_US;
     }
+}
 
-    // Send the virtual register address (setting bit 7 to indicate we are writing to a register).
-    AS7265X_writeRegister(AS7265X_WRITE_REG, (virtualAddr | 1 << 7));
+//Read a virtual register from the AS7265x
+uint8_t AS7265X_virtualReadRegister(uint8_t virtualAddr)
+{
+    uint8_t incoming;
+    AS7265X_virtualReadRegisters(virtualAddr, &incoming, 1);
+    return (incoming);
+}
 
-    //Wait for WRITE register to be empty
-    while (1)
-    {
-        status = AS7265X_readRegister(AS7265X_STATUS_REG);
-        if ((status & AS7265X_TX_VALID) == 0)
-            break; // No inbound TX pending at slave. Okay to write now.
-        HAL_Delay(AS7265X_POLLING_DELAY);
-    }
+//Read len consecutive virtual registers, sending each address as soon as the previous byte arrived
+void AS7265X_virtualReadRegisters(uint8_t virtualAddr, uint8_t *buf, uint8_t len)
+{
+    PROFILE_BEGIN(vread, "as7265x_vread");
+    AS7265X_VirtualOp op;
+    AS7265X_virtualReadStart(&op, virtualAddr, buf, len);
+    AS7265X_virtualRun(&op);
+    PROFILE_END(vread);
+}
 
-    // Send the data to complete the operation.
-    AS7265X_writeRegister(AS7265X_WRITE_REG, dataToWrite);
+//Write to a virtual register in the AS726x
+void AS7265X_virtualWriteRegister(uint8_t virtualAddr, uint8_t dataToWrite)
+{
+    PROFILE_BEGIN(vwrite, "as7265x_vwrite");
+    AS7265X_VirtualOp op;
+    AS7265X_virtualWriteStart(&op, virtualAddr, dataToWrite);
+    AS7265X_virtualRun(&op);
+    PROFILE_END(vwrite);
 }
 
 //Reads from a give location from the AS726x
@@ -78,7 +78,28 @@
 
 //Settings
 
-#define AS7265X_POLLING_DELAY 5 //Amount of ms to wait between checking for virtual register changes
+#define AS7265X_POLLING_DELAY 5 //Amount of ms to wait between checking for data ready
+
+//Back-off between checks of the virtual register status flags, doubles up to the maximum
+#define AS7265X_VIRTUAL_POLL_MIN_US 20
+#define AS7265X_VIRTUAL_POLL_MAX_US 1000
+
+#define AS7265X_CAL_CHANNEL_COUNT 6
+#define AS7265X_CAL_BYTES (4 * AS7265X_CAL_CHANNEL_COUNT) //AS7265X_R_G_A_CAL to the end of AS7265X_W_L_F_CAL
+#define AS7265X_RAW_BYTES (2 * AS7265X_CAL_CHANNEL_COUNT) //AS7265X_R_G_A to the end of AS7265X_W_L_F
+
+#define AS7265X_CHANNEL_COUNT 18
+
+//All channels of the three devices, sorted by wavelength
+typedef struct
+{
+    uint32_t timestamp; //HAL tick in ms when the read finished
+    uint16_t raw[AS7265X_CHANNEL_COUNT];
+    float calibrated[AS7265X_CHANNEL_COUNT];
+} AS7265X_Spectrum;
+
+extern const char AS7265X_channelNames[AS7265X_CHANNEL_COUNT + 1]; //"ABCDEFGHRISJTUVWKL"
+extern const uint16_t AS7265X_wavelengths[AS7265X_CHANNEL_COUNT];  //In nm, same order
 
 #define AS72651_NIR 0x00
 #define AS72652_VISIBLE 0x01
@@ -193,8 +214,37 @@ float AS7265X_convertBytesToFloat(uint32_t myLong);
 
 void AS7265X_selectDevice(uint8_t device); //Change between the x51, x52, or x53 for data and settings
 
+//Virtual register access, as a state machine that can be stepped without blocking
+typedef enum
+{
+    AS7265X_VIRTUAL_WAIT_TX,      //Waiting for TX_VALID to clear to send the address
+    AS7265X_VIRTUAL_WAIT_RX,      //Waiting for RX_VALID, the data of the current address
+    AS7265X_VIRTUAL_WAIT_TX_DATA, //Waiting for TX_VALID to clear to send the data to write
+    AS7265X_VIRTUAL_DONE
+} AS7265X_VirtualState;
+
+typedef struct
+{
+    AS7265X_VirtualState state;
+    bool write;
+    uint8_t addr;  //First virtual register
+    uint8_t *buf;  //Destination of a read
+    uint8_t len;   //Number of registers to read
+    uint8_t pos;   //Registers read so far
+    uint8_t data;  //Value to write
+} AS7265X_VirtualOp;
+
+void AS7265X_virtualReadStart(AS7265X_VirtualOp *op, uint8_t virtualAddr, uint8_t *buf, uint8_t len);
+void AS7265X_virtualWriteStart(AS7265X_VirtualOp *op, uint8_t virtualAddr, uint8_t dataToWrite);
+bool AS7265X_virtualPoll(AS7265X_VirtualOp *op); //Checks the status once, returns true if the op made progress
+void AS7265X_virtualRun(AS7265X_VirtualOp *op);  //Polls with back-off until the op is done
+
 uint8_t AS7265X_virtualReadRegister(uint8_t virtualAddr);
+void AS7265X_virtualReadRegisters(uint8_t virtualAddr, uint8_t *buf, uint8_t len); //Pipelined read of consecutive registers
 void AS7265X_virtualWriteRegister(uint8_t virtualAddr, uint8_t dataToWrite);
 
+void AS7265X_getCalibratedValues(uint8_t device, float out[AS7265X_CAL_CHANNEL_COUNT]); //All 6 channels of one device, in register order
+void AS7265X_readSpectrum(AS7265X_Spectrum *out); //Raw and calibrated values of all 18 channels
+
 uint8_t AS7265X_readRegister(uint8_t addr);
 bool AS7265X_writeRegister(uint8_t addr, uint8_t val);
@@ -79,6 +79,22 @@ LoopCopyDataInit:
   adds r4, r0, r3
   cmp r4, r1
   bcc CopyDataInit
+/* Copy the code placed in ITCM from flash */
+  ldr r0, =_sitcm_text
+  ldr r1, =_eitcm_text
+  ldr r2, =_siitcm_text
+  movs r3, #0
+  b LoopCopyItcmInit
+
+CopyItcmInit:
+  ldr r4, [r2, r3]
+  str r4, [r0, r3]
+  adds r3, r3, #4
+
+LoopCopyItcmInit:
+  adds r4, r0, r3
+  cmp r4, r1
+  bcc CopyItcmInit
 /* Zero fill the bss segment. */
   ldr r2, =_sbss
   ldr r4, =_ebss
@@ -92,6 +108,30 @@ FillZerobss:
 LoopFillZerobss:
   cmp r2, r4
   bcc FillZerobss
+/* Zero fill the DMA buffers in D2 SRAM, SystemInit() enabled its clocks */
+  ldr r2, =_sdma_buffers
+  ldr r4, =_edma_buffers
+  b LoopFillZeroDma
+
+FillZeroDma:
+  str  r3, [r2]
+  adds r2, r2, #4
+
+LoopFillZeroDma:
+  cmp r2, r4
+  bcc FillZeroDma
+/* Zero fill the AXI SRAM bss */
+  ldr r2, =_saxi_bss
+  ldr r4, =_eaxi_bss
+  b LoopFillZeroAxi
+
+FillZeroAxi:
+  str  r3, [r2]
+  adds r2, r2, #4
+
+LoopFillZeroAxi:
+  cmp r2, r4
+  bcc FillZeroAxi
 
 /* Call static constructors */
     bl __libc_init_array
@@ -1,61 +1,272 @@
 #include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
 #include "stm32h7xx_hal.h"
 #include "stm32h7xx_nucleo.h"
+#include "cache.h"
+#include "clock.h"
+#include "console.h"
+#include "ring.h"
+#include "sections.h"
+
+/* Sizes of the receive ring and the buffer for \r\n expansion, powers of 2 */
+#define RX_BUF_SZ 4096
+#define TX_BUF_SZ 1024
 
-void SystemClock_Config(void);
 void GPIO_Init(void);
-void USART3_UART_Init(void);
+void USART3_DMA_Init(void);
+void Error_Handler(void);
+
+DMA_HandleTypeDef hdma_usart3_rx;
+DMA_HandleTypeDef hdma_usart3_tx;
+
+static uint8_t rx_buf[RX_BUF_SZ] DMA_BUFFER;
+static uint8_t tx_buf[TX_BUF_SZ] DMA_BUFFER;
+
+/*
+ * rx_buf as a ring: the DMA fills it, the receive event commits what it wrote,
+ * and the transmit side releases what has been echoed.
+ */
+static ring rx = RING_INIT(rx_buf, RX_BUF_SZ, 1);
+
+/* Received data before this ring position was discarded */
+static volatile uint32_t resync;
+
+/* Last DMA write position in rx_buf reported by the HAL */
+static uint32_t rx_pos;
+
+/* Received bytes sent straight out of rx_buf by the running transmission */
+static uint32_t tx_pending;
+static volatile bool tx_busy;
+
+/* Baud rate requested by the host, switched to once the echo has drained */
+static volatile uint32_t pending_baudrate;
+
+/* Lost data, either by being lapped by the receiver or by receive errors */
+static volatile uint32_t overruns;
+static volatile uint32_t rx_errors;
+
+static void rx_start(void) {
+    if (HAL_UARTEx_ReceiveToIdle_DMA(&huart3, rx_buf, RX_BUF_SZ) != HAL_OK) {
+        Error_Handler();
+    }
+}
+
+/*
+ * Drop stale cache lines over newly received data in rx_buf[start], which may
+ * wrap around. The CPU never writes rx_buf, so no dirty lines are lost.
+ */
+static ITCM_TEXT void rx_invalidate(uint32_t start, uint32_t len) {
+    uint32_t first = len;
+    if (first > RX_BUF_SZ - start)
+        first = RX_BUF_SZ - start;
+
+    cache_invalidate(&rx_buf[start], first);
+    if (first < len)
+        cache_invalidate(rx_buf, len - first);
+}
+
+/* Bytes the DMA has written to rx_buf since the last receive event */
+static ITCM_TEXT uint32_t rx_uncommitted(void) {
+    uint32_t pos = RX_BUF_SZ - __HAL_DMA_GET_COUNTER(huart3.hdmarx);
+    return (pos - rx_pos) & (RX_BUF_SZ - 1);
+}
+
+/* Look for a baud rate request in received data from rx_buf[start] on */
+static void handshake_scan(uint32_t start, uint32_t len) {
+    uint32_t first = len;
+    if (first > RX_BUF_SZ - start)
+        first = RX_BUF_SZ - start;
+
+    uint32_t baudrate = console_handshake_feed(&rx_buf[start], first);
+    if (baudrate != 0)
+        pending_baudrate = baudrate;
+    /* The parser goes on over the wrap, a request completed there wins */
+    baudrate = console_handshake_feed(rx_buf, len - first);
+    if (baudrate != 0)
+        pending_baudrate = baudrate;
+}
+
+/* Answer a baud rate request and continue with empty buffers at the new rate */
+static void switch_baudrate(uint32_t baudrate) {
+    if (console_handshake_reply(baudrate)) {
+        /* The switch aborted all transfers, so no callback can interfere */
+        ring_init(&rx, rx_buf, RX_BUF_SZ, 1);
+        resync = 0;
+        rx_pos = 0;
+        tx_pending = 0;
+        tx_busy = false;
+        rx_start();
+    }
+}
 
-UART_HandleTypeDef huart3;
+/*
+ * Send the next block of received data. Blocks without carriage returns are
+ * sent straight out of the receive ring, otherwise they are copied to tx_buf
+ * run by run with a newline added after each carriage return.
+ *
+ * A block sent in place stays in the ring until it has gone out, so the DMA
+ * must not write over it in the meantime. That is only done while more of the
+ * ring is free than the block is long: at the same baud rate, the receiver
+ * then can't reach the block before it has been sent. Otherwise it is copied
+ * and released at once.
+ *
+ * Called from the UART and DMA interrupts, which share a priority.
+ */
+static ITCM_TEXT void echo_start(void) {
+    if (tx_busy)
+        return;
+
+    if ((int32_t)(resync - rx.head) > 0)
+        ring_release(&rx, resync - rx.head);
+
+    uint32_t avail = ring_count(&rx);
+    if (avail == 0)
+        return;
+    uint32_t used = avail + rx_uncommitted();
+    if (used > RX_BUF_SZ) {
+        /* The DMA has overwritten data we did not send yet */
+        overruns++;
+        uint32_t drop = used - RX_BUF_SZ / 2;
+        if (drop > avail)
+            drop = avail;
+        ring_release(&rx, drop);
+        avail -= drop;
+        used -= drop;
+        if (avail == 0)
+            return;
+    }
+
+    uint32_t len;
+    uint8_t *chunk = ring_peek(&rx, &len);
+
+    if (memchr(chunk, '\r', len) == NULL && RX_BUF_SZ - used >= len) {
+        tx_pending = len;
+        tx_busy = true;
+        HAL_UART_Transmit_DMA(&huart3, chunk, len);
+        return;
+    }
+
+    uint32_t in = 0;
+    uint32_t out = 0;
+    while (in < len && out < TX_BUF_SZ) {
+        uint32_t space = TX_BUF_SZ - out;
+        uint8_t *cr = memchr(chunk + in, '\r', len - in);
+        uint32_t run = cr ? (uint32_t)(cr - (chunk + in)) + 1 : len - in;
+
+        if (cr && run + 1 <= space) {
+            memcpy(tx_buf + out, chunk + in, run);
+            in += run;
+            out += run;
+            tx_buf[out++] = '\n';
+            continue;
+        }
+
+        /* Fill the rest, but keep a trailing \r together with its \n */
+        uint32_t n = run < space ? run : space;
+        if (cr && n == run)
+            n--;
+        memcpy(tx_buf + out, chunk + in, n);
+        in += n;
+        out += n;
+        break;
+    }
+
+    cache_clean(tx_buf, out);
+    ring_release(&rx, in);
+    tx_pending = 0;
+    tx_busy = true;
+    HAL_UART_Transmit_DMA(&huart3, tx_buf, out);
+}
 
 int main(void) {
-    HAL_MPU_Disable();
+    cache_init();
     HAL_Init();
-    SystemClock_Config();
+    clock_init();
 
     GPIO_Init();
-    USART3_UART_Init();
+    console_init(NULL);
+    USART3_DMA_Init();
 
-    const uint8_t BUF_SZ = 10;
-    uint8_t rcv[BUF_SZ];
-    const unsigned char NEWLINE = '\n';
-    uint8_t idx = 0;
+    rx_start();
 
     while (1) {
-        /* Handle received data byte by byte */
-        if (HAL_UART_Receive(&huart3, &rcv[idx], 1, HAL_MAX_DELAY) == HAL_OK) {
-            /* Toggle LED to signal character reception */
-            HAL_GPIO_TogglePin(GPIOB, GPIO_PIN_0);
-
-            /* Echo the received character back out */
-            HAL_UART_Transmit(&huart3, &rcv[idx], 1, HAL_MAX_DELAY);
-
-            /* Add a newline after each carriage return */
-            if (rcv[idx] == '\r') {
-                HAL_UART_Transmit(&huart3, &NEWLINE, 1, HAL_MAX_DELAY);
-            }
-
-            /* We have received BUF_SZ characters, so reset */
-            if (idx == BUF_SZ - 1) {
-                idx = 0;
-            } else {
-                idx++;
-            }
+        /* Switch only once the request itself has been echoed */
+        __disable_irq();
+        if (pending_baudrate != 0 && !tx_busy && ring_empty(&rx)) {
+            uint32_t baudrate = pending_baudrate;
+            pending_baudrate = 0;
+            switch_baudrate(baudrate);
         }
+        __enable_irq();
+        /* Everything else happens in the interrupts */
+        __WFI();
     }
 }
 
 /*
- * SysTick interrupt handler, needed for delays
- *
- * By default, an interrupt is generated every 1ms by the SysTick timer, which
- * calls this function. The HAL_delay() function checks a global variable to see
- * if the ms value passed to it has been reached. Here we increment that
- * variable by 1. Without this, the delay will just be an infinite loop.
+ * Called by the HAL when the receiver went idle or the DMA passed the half or
+ * end of rx_buf. Size is the DMA write position in rx_buf.
  */
-void SysTick_Handler(void)
-{
-    HAL_IncTick();
+ITCM_TEXT void HAL_UARTEx_RxEventCallback(UART_HandleTypeDef *huart, uint16_t Size) {
+    if (huart != &huart3)
+        return;
+
+    uint32_t pos = Size & (RX_BUF_SZ - 1);
+    uint32_t received = (pos - rx_pos) & (RX_BUF_SZ - 1);
+    rx_invalidate(rx_pos, received);
+    handshake_scan(rx_pos, received);
+    ring_commit(&rx, received);
+    rx_pos = pos;
+
+    /* Toggle LED to signal reception */
+    HAL_GPIO_TogglePin(GPIOB, GPIO_PIN_0);
+
+    echo_start();
+}
+
+ITCM_TEXT void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+    if (huart != &huart3)
+        return;
+
+    /* Sent in place, but the receiver lapped it after all, e.g. from a faster host clock */
+    if (tx_pending != 0 && ring_count(&rx) + rx_uncommitted() > RX_BUF_SZ)
+        overruns++;
+    ring_release(&rx, tx_pending);
+    tx_pending = 0;
+    tx_busy = false;
+    echo_start();
+}
+
+/* A receive error stops the DMA, drop what is pending and start over */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+    if (huart != &huart3)
+        return;
+
+    rx_errors++;
+    if (huart->RxState == HAL_UART_STATE_READY) {
+        /* Skip to the start of rx_buf, where the DMA starts over */
+        ring_commit(&rx, -rx.tail & (RX_BUF_SZ - 1));
+        resync = rx.tail;
+        rx_pos = 0;
+        rx_start();
+    }
+    if (huart->gState == HAL_UART_STATE_READY && tx_busy) {
+        tx_busy = false;
+        echo_start();
+    }
+}
+
+ITCM_TEXT void USART3_IRQHandler(void) {
+    HAL_UART_IRQHandler(&huart3);
+}
+
+ITCM_TEXT void DMA1_Stream0_IRQHandler(void) {
+    HAL_DMA_IRQHandler(&hdma_usart3_rx);
+}
+
+ITCM_TEXT void DMA1_Stream1_IRQHandler(void) {
+    HAL_DMA_IRQHandler(&hdma_usart3_tx);
 }
 
 /* Initialize GPIO B pins 0 and 14 (for LEDs 1 and 3) */
@@ -79,105 +290,47 @@ void Error_Handler(void) {
     }
 }
 
-/* Initialize UART clock, pins, and parameters */
-void USART3_UART_Init(void) {
-    RCC_PeriphCLKInitTypeDef RCC_PeriphClkInit;
-    GPIO_InitTypeDef GPIO_InitStruct = {0};
-
-    // Enable GPIO clocks for USART3 TX and RX
-    __HAL_RCC_GPIOD_CLK_ENABLE();
-
-    // Enable USART3 clock
-    __HAL_RCC_USART3_CLK_ENABLE();
-
-    // Configure USART3 TX (PD8) and RX (PD9)
-    GPIO_InitStruct.Pin = GPIO_PIN_8 | GPIO_PIN_9;
-    GPIO_InitStruct.Mode = GPIO_MODE_AF_PP;
-    GPIO_InitStruct.Pull = GPIO_PULLUP;
-    GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_VERY_HIGH;
-    GPIO_InitStruct.Alternate = GPIO_AF7_USART3;
-    HAL_GPIO_Init(GPIOD, &GPIO_InitStruct);
-
-    // Configure UART parameters
-    huart3.Instance = USART3;
-    huart3.Init.BaudRate = 115200;
-    huart3.Init.WordLength = UART_WORDLENGTH_8B;
-    huart3.Init.StopBits = UART_STOPBITS_1;
-    huart3.Init.Parity = UART_PARITY_NONE;
-    huart3.Init.Mode = UART_MODE_TX_RX;
-    huart3.Init.HwFlowCtl = UART_HWCONTROL_NONE;
-    huart3.Init.OverSampling = UART_OVERSAMPLING_16;
-
-    if (HAL_UART_Init(&huart3) != HAL_OK) {
-        // Initialization Error
+/* Set up the DMA streams for USART3 reception and transmission */
+void USART3_DMA_Init(void) {
+    // The DMA buffers live in D2 SRAM, SystemInit() has enabled its clocks
+    __HAL_RCC_DMA1_CLK_ENABLE();
+
+    // Receive into a ring buffer that the DMA fills continuously
+    hdma_usart3_rx.Instance = DMA1_Stream0;
+    hdma_usart3_rx.Init.Request = DMA_REQUEST_USART3_RX;
+    hdma_usart3_rx.Init.Direction = DMA_PERIPH_TO_MEMORY;
+    hdma_usart3_rx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_usart3_rx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_usart3_rx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_usart3_rx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_usart3_rx.Init.Mode = DMA_CIRCULAR;
+    hdma_usart3_rx.Init.Priority = DMA_PRIORITY_HIGH;
+    hdma_usart3_rx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_usart3_rx) != HAL_OK) {
         Error_Handler();
     }
-}
-
-
-/* Clock setup, generated by CubeMX */
-void SystemClock_Config(void)
-{
-    RCC_ClkInitTypeDef RCC_ClkInitStruct;
-    RCC_OscInitTypeDef RCC_OscInitStruct;
-    HAL_StatusTypeDef ret = HAL_OK;
-
-    /*!< Supply configuration update enable */
-    HAL_PWREx_ConfigSupply(PWR_LDO_SUPPLY);
-
-    /* The voltage scaling allows optimizing the power consumption when the device is
-       clocked below the maximum system frequency, to update the voltage scaling value
-       regarding system frequency refer to product datasheet.  */
-    __HAL_PWR_VOLTAGESCALING_CONFIG(PWR_REGULATOR_VOLTAGE_SCALE1);
-
-    while(!__HAL_PWR_GET_FLAG(PWR_FLAG_VOSRDY)) {}
-
-    /* Enable HSE Oscillator and activate PLL with HSE as source */
-    RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
-    RCC_OscInitStruct.HSEState = RCC_HSE_BYPASS;
-    RCC_OscInitStruct.HSIState = RCC_HSI_OFF;
-    RCC_OscInitStruct.CSIState = RCC_CSI_OFF;
-    RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
-    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
-
-    RCC_OscInitStruct.PLL.PLLM = 4;
-    RCC_OscInitStruct.PLL.PLLN = 400;
-    RCC_OscInitStruct.PLL.PLLFRACN = 0;
-    RCC_OscInitStruct.PLL.PLLP = 2;
-    RCC_OscInitStruct.PLL.PLLR = 2;
-    RCC_OscInitStruct.PLL.PLLQ = 4;
-
-    RCC_OscInitStruct.PLL.PLLVCOSEL = RCC_PLL1VCOWIDE;
-    RCC_OscInitStruct.PLL.PLLRGE = RCC_PLL1VCIRANGE_1;
-    ret = HAL_RCC_OscConfig(&RCC_OscInitStruct);
-    if(ret != HAL_OK)
-    {
-      Error_Handler();
-    }
-
-    /* Select PLL as system clock source and configure  bus clocks dividers */
-    RCC_ClkInitStruct.ClockType = (RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_D1PCLK1 | RCC_CLOCKTYPE_PCLK1 | \
-                                   RCC_CLOCKTYPE_PCLK2  | RCC_CLOCKTYPE_D3PCLK1);
-
-    RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
-    RCC_ClkInitStruct.SYSCLKDivider = RCC_SYSCLK_DIV1;
-    RCC_ClkInitStruct.AHBCLKDivider = RCC_HCLK_DIV2;
-    RCC_ClkInitStruct.APB3CLKDivider = RCC_APB3_DIV2;
-    RCC_ClkInitStruct.APB1CLKDivider = RCC_APB1_DIV2;
-    RCC_ClkInitStruct.APB2CLKDivider = RCC_APB2_DIV2;
-    RCC_ClkInitStruct.APB4CLKDivider = RCC_APB4_DIV2;
-    ret = HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_4);
-    if(ret != HAL_OK)
-    {
-      Error_Handler();
+    __HAL_LINKDMA(&huart3, hdmarx, hdma_usart3_rx);
+
+    hdma_usart3_tx.Instance = DMA1_Stream1;
+    hdma_usart3_tx.Init.Request = DMA_REQUEST_USART3_TX;
+    hdma_usart3_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_usart3_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_usart3_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_usart3_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_usart3_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_usart3_tx.Init.Mode = DMA_NORMAL;
+    hdma_usart3_tx.Init.Priority = DMA_PRIORITY_MEDIUM;
+    hdma_usart3_tx.Init.FIFOMode = DMA_FIFOMODE_DISABLE;
+    if (HAL_DMA_Init(&hdma_usart3_tx) != HAL_OK) {
+        Error_Handler();
     }
-
-    /* Activate CSI clock mandatory for I/O Compensation Cell */
-    __HAL_RCC_CSI_ENABLE() ;
-
-    /* Enable SYSCFG clock mandatory for I/O Compensation Cell */
-    __HAL_RCC_SYSCFG_CLK_ENABLE() ;
-
-    /* Enables the I/O Compensation Cell */
-    HAL_EnableCompensationCell();
+    __HAL_LINKDMA(&huart3, hdmatx, hdma_usart3_tx);
+
+    // Same priority for all, so the callbacks never preempt each other
+    HAL_NVIC_SetPriority(DMA1_Stream0_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Stream0_IRQn);
+    HAL_NVIC_SetPriority(DMA1_Stream1_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Stream1_IRQn);
+    HAL_NVIC_SetPriority(USART3_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(USART3_IRQn);
 }
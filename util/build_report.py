@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+
+"""
+Prints how much of each memory region a firmware image uses and, optionally,
+the cycle counts of the benchmark loop the firmware runs at startup when built
+with BENCHMARK=1 (see ../Common/release.mk), read from the board's serial port
+or from a capture of it.
+
+Sections are assigned to the regions of the linker script by address. Sections
+that are copied at startup (.data, .itcm_text) count for both their RAM region
+and the flash holding their initial contents.
+"""
+
+import argparse
+import re
+import shlex
+import subprocess
+import sys
+import time
+
+BENCH_RE = re.compile(r'^bench (\S+) (\d+) cycles \(min (\d+)\)$')
+
+MEMORY_RE = re.compile(r'^\s*(\w+)\s*\([^)]*\)\s*:\s*ORIGIN\s*=\s*(\w+)\s*,\s*LENGTH\s*=\s*(\w+)',
+                       re.MULTILINE)
+
+
+def parse_size(text):
+    units = {'K': 1024, 'M': 1024 * 1024}
+    if text[-1].upper() in units:
+        return int(text[:-1], 0) * units[text[-1].upper()]
+    return int(text, 0)
+
+
+def read_regions(linker_script):
+    with open(linker_script) as f:
+        script = f.read()
+    return [(name, int(origin, 0), parse_size(length))
+            for name, origin, length in MEMORY_RE.findall(script)]
+
+
+def read_sections(objdump, elf):
+    """(name, size, vma, lma, loaded) of every allocated section"""
+    output = subprocess.run([objdump, '-h', elf], check=True, capture_output=True,
+                            text=True).stdout
+    lines = output.splitlines()
+    sections = []
+    for line, flags in zip(lines, lines[1:]):
+        fields = line.split()
+        if len(fields) < 7 or not fields[0].isdigit() or 'ALLOC' not in flags:
+            continue
+        sections.append((fields[1], int(fields[2], 16), int(fields[3], 16),
+                         int(fields[4], 16), 'LOAD' in flags))
+    return sections
+
+
+def find_region(regions, address):
+    for name, origin, length in regions:
+        if origin <= address < origin + length:
+            return name
+    return None
+
+
+def size_report(regions, sections):
+    used = {name: 0 for name, _, _ in regions}
+    rows = []
+    for name, size, vma, lma, loaded in sections:
+        if size == 0:
+            continue
+        region = find_region(regions, vma)
+        load_region = find_region(regions, lma) if loaded and lma != vma else None
+        if region:
+            used[region] += size
+        if load_region:
+            used[load_region] += size
+        placement = region or f'{vma:#010x}'
+        if load_region:
+            placement += f' (loaded from {load_region})'
+        rows.append((name, size, placement))
+
+    print('Sections:')
+    for name, size, placement in rows:
+        print(f'  {name:<20} {size:>8}  {placement}')
+    print()
+    print('Memory regions:')
+    for name, origin, length in regions:
+        print(f'  {name:<10} {used[name]:>8} / {length:>8} bytes  '
+              f'{100 * used[name] / length:5.1f}%')
+
+
+def parse_benchmark(lines):
+    """
+    (name, mean, min) of the profile_benchmark() lines up to "bench done", and
+    whether that came. Raises ValueError on a line that doesn't parse.
+    """
+    results = []
+    for line in lines:
+        line = line.strip()
+        if line == 'bench done':
+            return results, True
+        if line.startswith('bench '):
+            match = BENCH_RE.match(line)
+            if not match:
+                raise ValueError(f'bad benchmark line: {line!r}')
+            results.append((match[1], int(match[2]), int(match[3])))
+    return results, False
+
+
+def serial_lines(port, baudrate, reset_cmd, timeout):
+    import serial
+
+    conn = serial.Serial(port, baudrate, timeout=0.1)
+    conn.reset_input_buffer()
+    if reset_cmd:
+        subprocess.run(shlex.split(reset_cmd), check=True,
+                       stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+    deadline = time.monotonic() + timeout
+    try:
+        while time.monotonic() < deadline:
+            yield conn.readline().decode(errors='replace')
+    finally:
+        conn.close()
+
+
+def benchmark_report(lines):
+    print()
+    print('Benchmark (cycles per iteration):')
+    try:
+        results, done = parse_benchmark(lines)
+    except ValueError as e:
+        print(f'  {e}')
+        return False
+    for name, mean, fastest in results:
+        print(f'  {name:<20} {mean:>10}  (min {fastest})')
+    if not done:
+        print('  no "bench done" from the board, was it built with BENCHMARK=1?')
+    return done
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('elf', nargs='?', help='image for the size report')
+    parser.add_argument('--linker-script')
+    parser.add_argument('--objdump', default='arm-none-eabi-objdump')
+    parser.add_argument('--port', help='serial port to read the benchmark results from')
+    parser.add_argument('--baudrate', type=int, default=115200)
+    parser.add_argument('--reset-cmd', help='command that restarts the board')
+    parser.add_argument('--timeout', type=float, default=10.0,
+                        help='seconds to wait for the benchmark to finish')
+    parser.add_argument('--benchmark-log',
+                        help='read the benchmark results from a capture of the UART instead')
+    args = parser.parse_args()
+    if args.elf and not args.linker_script:
+        parser.error('the size report needs --linker-script')
+
+    if args.elf:
+        print(f'{args.elf}')
+        print()
+        size_report(read_regions(args.linker_script), read_sections(args.objdump, args.elf))
+
+    if args.benchmark_log:
+        with open(args.benchmark_log, errors='replace') as f:
+            done = benchmark_report(f)
+    elif args.port:
+        done = benchmark_report(serial_lines(args.port, args.baudrate, args.reset_cmd,
+                                             args.timeout))
+    else:
+        done = True
+    if not done:
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
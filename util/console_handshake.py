@@ -0,0 +1,33 @@
+"""
+Baud rate handshake with firmware using Common/Src/console.c.
+
+The request is sent at the rate the connection is currently open with. The
+firmware answers at the same rate and switches right afterwards, so once the
+answer has arrived, the host switches too.
+"""
+
+import time
+
+
+def negotiate_baudrate(conn, baudrate, timeout=1.0):
+    """Ask the board to switch to baudrate. Returns True if both sides switched."""
+    if conn.baudrate == baudrate:
+        return True
+
+    ok = b'--BAUD_OK:%d--' % baudrate
+    err = b'--BAUD_ERR:%d--' % baudrate
+
+    conn.reset_input_buffer()
+    conn.write(b'--BAUD:%d--' % baudrate)
+    conn.flush()
+
+    reply = bytearray()
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        reply.extend(conn.read(conn.in_waiting or 1))
+        if ok in reply:
+            conn.baudrate = baudrate
+            return True
+        if err in reply:
+            return False
+    return False
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+
+"""
+Decoder for the binary telemetry frames sent by Common/Src/telemetry.c.
+
+See Common/Inc/telemetry.h for the frame layout. Run on a raw capture of the
+UART, it prints how many frames of each type it holds and how many were lost.
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+from collections import namedtuple
+
+SYNC = b'\xa5\xc3'
+VERSION = 2
+MAX_PAYLOAD = 256
+
+TYPE_GRIDEYE_FRAME = 0x01
+TYPE_AS7265X_CHANNELS = 0x02
+TYPE_GRIDEYE_HOTSPOTS = 0x03
+TYPE_AS7265X_SPECTRUM = 0x04
+
+# AS7265X channels sorted by wavelength, as in AS7265X_Spectrum
+SPECTRUM_CHANNELS = 'ABCDEFGHRISJTUVWKL'
+SPECTRUM_WAVELENGTHS = [410, 435, 460, 485, 510, 535, 560, 585, 610,
+                        645, 680, 705, 730, 760, 810, 860, 900, 940]
+SPECTRUM = struct.Struct('<I18H18f')
+
+Spectrum = namedtuple('Spectrum', 'read_time raw calibrated')
+
+HEADER = struct.Struct('<HBBHHI')
+CRC = struct.Struct('<I')
+
+Frame = namedtuple('Frame', 'type seq timestamp values')
+
+
+def decode_payload(frame_type, payload):
+    """Turn a payload into a list of values, or return the raw bytes for unknown types."""
+    if frame_type == TYPE_GRIDEYE_FRAME:
+        # quarter degrees Celsius
+        return [t / 4 for t in struct.unpack('<%dh' % (len(payload) // 2), payload)]
+    if frame_type == TYPE_AS7265X_CHANNELS:
+        return list(struct.unpack('<%df' % (len(payload) // 4), payload))
+    if frame_type == TYPE_AS7265X_SPECTRUM:
+        values = SPECTRUM.unpack(payload)
+        return Spectrum(values[0], list(values[1:19]), list(values[19:]))
+    if frame_type == TYPE_GRIDEYE_HOTSPOTS:
+        # interrupt table, then the temperatures of the flagged pixels
+        table = int.from_bytes(payload[:8], 'little')
+        pixels = [i for i in range(64) if table & (1 << i)]
+        temps = struct.unpack('<%dh' % len(pixels), payload[8:8 + 2 * len(pixels)])
+        return {pixel: t / 4 for pixel, t in zip(pixels, temps)}
+    return bytes(payload)
+
+
+def parse_frame(buffer):
+    """
+    Parse a frame at the start of buffer.
+
+    Returns (frame, consumed). If more data is needed, that's (None, 0). If the
+    buffer doesn't start with a valid frame, it's (None, 1) so the caller can
+    skip a byte and search for the next sync word.
+    """
+    if len(buffer) < HEADER.size:
+        return None, 0
+
+    sync, frame_type, version, seq, length, timestamp = HEADER.unpack_from(buffer)
+    if sync.to_bytes(2, 'little') != SYNC or version != VERSION or length > MAX_PAYLOAD:
+        return None, 1
+
+    end = HEADER.size + length
+    if len(buffer) < end + CRC.size:
+        return None, 0
+    (crc,) = CRC.unpack_from(buffer, end)
+    if zlib.crc32(bytes(buffer[:end])) != crc:
+        return None, 1
+
+    values = decode_payload(frame_type, buffer[HEADER.size:end])
+    return Frame(frame_type, seq, timestamp, values), end + CRC.size
+
+
+def decode_stream(data):
+    """
+    Decode the frames in data. Returns the frames, the number of bytes skipped
+    between them and the number of those that looked like a sync word.
+    """
+    frames = []
+    skipped = 0
+    bad_syncs = 0
+    i = 0
+    while i < len(data):
+        frame, consumed = parse_frame(data[i:i + HEADER.size + MAX_PAYLOAD + CRC.size])
+        if frame is not None:
+            frames.append(frame)
+        else:
+            consumed = max(consumed, 1)
+            skipped += consumed
+            if data[i:i + 2] == SYNC:
+                bad_syncs += 1
+        i += consumed
+    return frames, skipped, bad_syncs
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('capture', help='raw UART capture, e.g. cat /dev/ttyACM0 > capture.bin')
+    parser.add_argument('--check', action='store_true',
+                        help='exit with 1 unless there are frames and none was lost or corrupted')
+    args = parser.parse_args()
+
+    with open(args.capture, 'rb') as f:
+        frames, skipped, bad_syncs = decode_stream(f.read())
+
+    lost = sum((b.seq - a.seq - 1) & 0xFFFF for a, b in zip(frames, frames[1:]))
+    types = {}
+    for frame in frames:
+        types[frame.type] = types.get(frame.type, 0) + 1
+    for frame_type, count in sorted(types.items()):
+        print(f'type {frame_type:#04x}: {count} frames')
+    print(f'{len(frames)} frames, {lost} lost, {skipped} bytes skipped, '
+          f'{bad_syncs} bad frames')
+
+    if args.check and (not frames or lost or bad_syncs):
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
@@ -1,29 +1,38 @@
 #!/usr/bin/env python3
 
+import argparse
 import sys
 import time
 from PyQt5.QtWidgets import (QApplication, QMainWindow, QWidget, QVBoxLayout, QHBoxLayout,
                              QTextEdit, QPushButton, QLineEdit, QFileDialog, QLabel, QStatusBar)
 from PyQt5.QtCore import QThread, pyqtSignal, QTimer, QCoreApplication
-from PyQt5.QtGui import QImage, QPixmap
+from PyQt5.QtCore import Qt
+from PyQt5.QtGui import QImage, QPixmap, QColor
 import serial
 import serial.tools.list_ports
 from PIL import Image
 import os
 
+from console_handshake import negotiate_baudrate
+import telemetry
+
 class SerialThread(QThread):
     data_received = pyqtSignal(bytes)
 
-    def __init__(self, port, baudrate):
+    def __init__(self, port, baudrate, initial_baudrate):
         super().__init__()
         self.port = port
         self.baudrate = baudrate
+        self.initial_baudrate = initial_baudrate
         self.serial_connection = None
         self.running = False
 
     def run(self):
         try:
-            self.serial_connection = serial.Serial(self.port, self.baudrate, timeout=1)
+            self.serial_connection = serial.Serial(self.port, self.initial_baudrate, timeout=1)
+            if not negotiate_baudrate(self.serial_connection, self.baudrate):
+                print(f"Board did not switch to {self.baudrate} baud, "
+                      f"staying at {self.initial_baudrate}")
             self.running = True
             while self.running:
                 if self.serial_connection.in_waiting:
@@ -43,12 +52,17 @@ class UARTGUI(QMainWindow):
     IMAGE_END = b'--IMAGE_END--'
     TEXT_DELIMITER = b'\n'  # Assuming '\n' as end of text message
 
-    def __init__(self):
+    def __init__(self, baudrate, initial_baudrate):
         super().__init__()
+        self.baudrate = baudrate
+        self.initial_baudrate = initial_baudrate
         self.serial_send = None
         self.serial_receive = None
         self.received_buffer = bytearray()
         self.receiving_image = False
+        self.last_seq = None
+        self.lost_frames = 0
+        self.bad_bytes = 0
 
         self.initUI()
 
@@ -82,6 +96,10 @@ class UARTGUI(QMainWindow):
         self.received_text.setPlaceholderText("Received text (or image)")
         layout.addWidget(self.received_text)
 
+        self.thermal_view = QLabel()
+        self.thermal_view.setAlignment(Qt.AlignCenter)
+        layout.addWidget(self.thermal_view)
+
         button_layout = QHBoxLayout()
         self.pick_image_button = QPushButton('Pick Image')
         self.pick_image_button.clicked.connect(self.pick_image)
@@ -136,13 +154,13 @@ class UARTGUI(QMainWindow):
         receive_port = self.receive_port_entry.text()
 
         if send_port == receive_port:
-            self.serial_send = SerialThread(send_port, 115200)
+            self.serial_send = SerialThread(send_port, self.baudrate, self.initial_baudrate)
             self.serial_send.data_received.connect(self.receive_data)
             self.serial_send.start()
             self.serial_receive = self.serial_send
         else:
-            self.serial_send = SerialThread(send_port, 115200)
-            self.serial_receive = SerialThread(receive_port, 115200)
+            self.serial_send = SerialThread(send_port, self.baudrate, self.initial_baudrate)
+            self.serial_receive = SerialThread(receive_port, self.baudrate, self.initial_baudrate)
             self.serial_receive.data_received.connect(self.receive_data)
             self.serial_send.start()
             self.serial_receive.start()
@@ -166,7 +184,20 @@ class UARTGUI(QMainWindow):
                     break
             else:
                 image_start_index = self.received_buffer.find(self.IMAGE_START)
-                if image_start_index != -1:
+                sync_index = self.received_buffer.find(telemetry.SYNC)
+                if sync_index != -1 and (image_start_index == -1 or sync_index < image_start_index):
+                    if sync_index > 0:
+                        self.process_received_text(self.received_buffer[:sync_index].decode(errors='replace'))
+                        self.received_buffer = self.received_buffer[sync_index:]
+                    frame, consumed = telemetry.parse_frame(self.received_buffer)
+                    if consumed == 0:
+                        break
+                    if frame:
+                        self.process_telemetry(frame)
+                    else:
+                        self.bad_bytes += consumed
+                    self.received_buffer = self.received_buffer[consumed:]
+                elif image_start_index != -1:
                     if image_start_index > 0:
                         self.process_received_text(self.received_buffer[:image_start_index].decode())
                     self.received_buffer = self.received_buffer[image_start_index + len(self.IMAGE_START):]
@@ -185,6 +216,38 @@ class UARTGUI(QMainWindow):
             self.received_text.append(text)
             print(f"Processed text data: {text}")
 
+    def process_telemetry(self, frame):
+        if self.last_seq is not None:
+            self.lost_frames += (frame.seq - self.last_seq - 1) & 0xFFFF
+        self.last_seq = frame.seq
+
+        if frame.type == telemetry.TYPE_GRIDEYE_FRAME:
+            self.display_thermal(frame.values)
+        elif frame.type == telemetry.TYPE_AS7265X_CHANNELS:
+            text = ', '.join(f"{name}: {value:.3f}" for name, value in zip("ABCDEF", frame.values))
+            self.process_received_text(f"[{frame.timestamp / 1000:.1f} ms] {text}")
+        elif frame.type == telemetry.TYPE_AS7265X_SPECTRUM:
+            text = ', '.join(f"{name} ({nm} nm): {value:.3f}" for name, nm, value in
+                             zip(telemetry.SPECTRUM_CHANNELS, telemetry.SPECTRUM_WAVELENGTHS,
+                                 frame.values.calibrated))
+            self.process_received_text(f"[{frame.timestamp / 1000:.1f} ms] {text}")
+        elif frame.type == telemetry.TYPE_GRIDEYE_HOTSPOTS:
+            text = ', '.join(f"{pixel}: {t:.2f}" for pixel, t in frame.values.items())
+            self.process_received_text(f"[{frame.timestamp / 1000:.1f} ms] Hot pixels {text}")
+        else:
+            print(f"Unknown telemetry frame type {frame.type}")
+        self.update_status(f"Frame {frame.seq} at {frame.timestamp / 1000:.1f} ms, "
+                           f"{self.lost_frames} lost, {self.bad_bytes} bad bytes")
+
+    def display_thermal(self, temps, low=20.0, high=35.0):
+        size = int(len(temps) ** 0.5)
+        image = QImage(size, size, QImage.Format_RGB32)
+        for i, t in enumerate(temps):
+            # blue for cold, red for hot
+            level = min(max((t - low) / (high - low), 0.0), 1.0)
+            image.setPixelColor(i % size, i // size, QColor(int(255 * level), 0, int(255 * (1 - level))))
+        self.thermal_view.setPixmap(QPixmap.fromImage(image).scaled(256, 256))
+
     def display_image(self, data):
         with open("received_image.png", "wb") as f:
             f.write(data)
@@ -207,7 +270,14 @@ class UARTGUI(QMainWindow):
         event.accept()
 
 if __name__ == '__main__':
-    app = QApplication(sys.argv)
-    ex = UARTGUI()
+    parser = argparse.ArgumentParser()
+    parser.add_argument('--baudrate', type=int, default=921600,
+                        help='rate to negotiate with the board')
+    parser.add_argument('--initial-baudrate', type=int, default=115200,
+                        help='rate the board starts with')
+    args, qt_args = parser.parse_known_args()
+
+    app = QApplication(sys.argv[:1] + qt_args)
+    ex = UARTGUI(args.baudrate, args.initial_baudrate)
     ex.show()
     sys.exit(app.exec_())
@@ -0,0 +1,105 @@
+#!/usr/bin/env python3
+
+"""
+Measures the throughput of the UART_echo firmware.
+
+Random data is written to the board while a second thread reads the echo. At
+the end, the echo is compared with what was sent (with every carriage return
+expanded to CR LF, like the firmware does) and the achieved rates are printed.
+
+The data has no carriage returns unless --carriage-returns is given. Each one
+makes the echo a byte longer than the input, so the board can't keep up with a
+host sending at the full line rate. With them, the writes are slowed to the
+rate at which the expanded echo fits the line.
+"""
+
+import argparse
+import os
+import sys
+import threading
+import time
+
+import serial
+
+from console_handshake import negotiate_baudrate
+
+
+def expected_echo(data):
+    return data.replace(b'\r', b'\r\n')
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--port', default='/dev/ttyACM0')
+    parser.add_argument('--baudrate', type=int, default=921600,
+                        help='rate to negotiate with the board')
+    parser.add_argument('--initial-baudrate', type=int, default=115200,
+                        help='rate the board starts with')
+    parser.add_argument('--size', type=int, default=1024 * 1024,
+                        help='number of bytes to send')
+    parser.add_argument('--chunk', type=int, default=4096,
+                        help='bytes per write call')
+    parser.add_argument('--timeout', type=float, default=2.0,
+                        help='seconds to wait for the rest of the echo')
+    parser.add_argument('--carriage-returns', action='store_true',
+                        help='keep carriage returns in the data, and send slower')
+    args = parser.parse_args()
+
+    data = os.urandom(args.size)
+    if not args.carriage_returns:
+        data = data.replace(b'\r', b'\n')
+    expected = expected_echo(data)
+
+    # 10 bits per byte on the wire (start + 8 data + stop)
+    line_rate = args.baudrate / 10
+    send_rate = line_rate * len(data) / len(expected)
+    received = bytearray()
+
+    conn = serial.Serial(args.port, args.initial_baudrate, timeout=0.1)
+    if not negotiate_baudrate(conn, args.baudrate):
+        print(f"FAIL: board did not switch to {args.baudrate} baud")
+        sys.exit(1)
+    conn.reset_input_buffer()
+
+    def reader():
+        last = time.monotonic()
+        while len(received) < len(expected):
+            chunk = conn.read(conn.in_waiting or 1)
+            if chunk:
+                received.extend(chunk)
+                last = time.monotonic()
+            elif time.monotonic() - last > args.timeout:
+                break
+
+    thread = threading.Thread(target=reader)
+    start = time.monotonic()
+    thread.start()
+    for i in range(0, len(data), args.chunk):
+        if args.carriage_returns:
+            # Not ahead of what the echo can carry
+            delay = start + i / send_rate - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+        conn.write(data[i:i + args.chunk])
+    conn.flush()
+    sent = time.monotonic()
+    thread.join()
+    done = time.monotonic()
+    conn.close()
+
+    tx_rate = len(data) / (sent - start)
+    rx_rate = len(received) / (done - start)
+    print(f"sent {len(data)} bytes in {sent - start:.2f}s ({tx_rate / 1024:.1f} KiB/s)")
+    print(f"received {len(received)} of {len(expected)} bytes in {done - start:.2f}s "
+          f"({rx_rate / 1024:.1f} KiB/s, {100 * rx_rate / line_rate:.0f}% of line rate)")
+
+    if bytes(received) != expected:
+        mismatch = next((i for i, (a, b) in enumerate(zip(received, expected)) if a != b),
+                        min(len(received), len(expected)))
+        print(f"FAIL: echo differs from sent data at byte {mismatch}")
+        sys.exit(1)
+    print("OK: echo matches")
+
+
+if __name__ == '__main__':
+    main()